@@ -50,6 +50,12 @@
 		#include <arpa/inet.h>
 		#include <errno.h>
 		#include <unistd.h> // needed for close()
+		#include <sys/time.h>
+		#include <pthread.h>
+		#include <time.h>
+		#ifdef __APPLE__
+			#include <mach/mach_time.h>
+		#endif
 		#include <string>
 	#endif
 
@@ -73,9 +79,19 @@
 		#define SOCKET_INIT()
 		#define SOCKET int
 		#define PRINT_SOCKET_ERROR(msg) printf(msg" - socket error: %s\n", strerror(errno));
+		#ifndef INVALID_SOCKET
+			#define INVALID_SOCKET -1
+		#endif
 	#endif
 
 	#define OI_READBUF(type, buf, offset, val) val = *((type*)&buf[offset]); offset += sizeof(type);
+
+	// Full memory barrier, used by the structures shared with the receiver thread.
+	#ifdef OMICRON_OS_WIN
+		#define OMICRON_CONNECTOR_BARRIER() MemoryBarrier()
+	#else
+		#define OMICRON_CONNECTOR_BARRIER() __sync_synchronize()
+	#endif
 #endif
 
 #ifndef OMICRON_EVENTBASE_DEFINED
@@ -323,6 +339,26 @@ namespace omicron
 }
 #endif
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// The shared memory transport uses /dev/shm, available on linux.
+#if defined(__linux__)
+	#define OMICRON_CONNECTOR_SHARED_MEMORY
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+// Datagrams are received in batches with recvmmsg, available on linux. g++ defines _GNU_SOURCE,
+// needed for the recvmmsg declaration.
+#if defined(__linux__) && defined(_GNU_SOURCE)
+	#define OMICRON_CONNECTOR_RECVMMSG
+#endif
+
 namespace omicronConnector
 {
 #ifndef OMICRON_EVENTDATA_DEFINED
@@ -348,12 +384,71 @@ namespace omicronConnector
 		float orz;
 		float orw;
 
+		// Event creation time and device capture time on the server, in 
+		// microseconds (see omicron::otimestamp). Both are zero if the server
+		// does not send them. deviceTime is also zero when the device does
+		// not report capture times.
+		unsigned long long time;
+		unsigned long long deviceTime;
+
+		// Pose prediction (see OmicronConnectorClient::setPredictionLead). 
+		// When predictionLead is not zero, the event position and orientation
+		// have been extrapolated by the server predictionLead microseconds 
+		// past the send time, and the raw fields hold the measured pose.
+		// Otherwise the raw fields are equal to the event pose.
+		unsigned int predictionLead;
+		float rawPosx;
+		float rawPosy;
+		float rawPosz;
+		float rawOrx;
+		float rawOry;
+		float rawOrz;
+		float rawOrw;
+
 		static const int ExtraDataSize = 1024;
 		unsigned int extraDataType;
 		unsigned int extraDataItems;
 		unsigned int extraDataMask;
 		unsigned char extraData[ExtraDataSize];
 
+		// Marks the optional event time section following the extra data
+		// in event packets ('OTIM').
+		static const unsigned int TimeTag = 0x4D49544F;
+		// Marks the optional pose prediction section, following the time
+		// section ('OPRD').
+		static const unsigned int PredictionTag = 0x4452504F;
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Marks the event as not predicted: copies the event pose to the raw pose.
+		inline void setRawPose()
+		{
+			predictionLead = 0;
+			rawPosx = posx;
+			rawPosy = posy;
+			rawPosz = posz;
+			rawOrx = orx;
+			rawOry = ory;
+			rawOrz = orz;
+			rawOrw = orw;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns the size in bytes of the event extra data.
+		inline int getExtraDataSize() const
+		{
+			switch(extraDataType)
+			{
+			case ExtraDataFloatArray:
+			case ExtraDataIntArray:
+				return extraDataItems * 4;
+			case ExtraDataVector3Array:
+				return extraDataItems * 4 * 3;
+			case ExtraDataNull:
+				return 0;
+			}
+			return extraDataItems;
+		}
+
 		bool getExtraDataVector3(int index, float* data) const
 		{
 			if(extraDataType != ExtraDataVector3Array) return false;
@@ -383,235 +478,3254 @@ namespace omicronConnector
 			return OINT_PTR(extraData[index * 4]);
 		}
 	};
-#endif
 
-// if OMICRON_CONNECTOR_LEAN_AND_MEAN, only define the omicron::EventBase and omicronConnector::EventData classes.
-// Skip the OmicronConnectorClient class and all socket functionality.
-#ifndef OMICRON_CONNECTOR_LEAN_AND_MEAN
-#ifndef OMICRON_CONNECTORCLIENT_DEFINED
-#define OMICRON_CONNECTORCLIENT_DEFINED
 	//////////////////////////////////////////////////////////////////////////////////////////////////
-	class IOmicronConnectorClientListener
+	//! Header of batch mode datagrams. In batch mode the server packs all the events generated 
+	//! in one update into as few datagrams (frames) as possible. The header is followed by 
+	//! eventCount events, each one prefixed by its size in bytes (16 bit unsigned) and using the
+	//! same format as single event datagrams.
+	struct FrameHeader
 	{
-	public:
-		virtual void onEvent(const EventData& e) = 0;
+		// Marks frame datagrams ('OFRM'). Single event datagrams start with the event timestamp,
+		// which is always lower than this value.
+		static const unsigned int Tag = 0x4D52464F;
+		// Size of the header on the wire, in bytes.
+		static const int Size = 20;
+		// Maximum size of a frame datagram.
+		static const int MaxFrameSize = 8192;
+		// Set in the flags of reliable lane frames. Reliable frames contain a single discrete
+		// event and have their own sequence numbers. They are retransmitted by the server until
+		// acknowledged by the client (see OmicronConnectorClient::setReliableMode).
+		static const unsigned short FlagReliable = 1;
+		// Set when the frame events use the compact encoding (see CompactCodec). Reliable frames
+		// of compact streams carry keyframes, which are not delivered as events.
+		static const unsigned short FlagCompact = 2;
+
+		unsigned int tag;
+		unsigned short eventCount;
+		unsigned short flags;
+		// Frame sequence number, incremented by one for each frame sent by the server.
+		// Reliable frames use a separate sequence.
+		unsigned int sequence;
+		// Time the frame was sent by the server, in microseconds (see omicron::otimestamp).
+		unsigned long long time;
 	};
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////
-	//template<typename ListenerType>
-	class OmicronConnectorClient
+	//! Wire encoding helpers. All the values sent on the network are little endian. Values are 
+	//! read and written one byte at a time, so buffers never need to be aligned.
+	namespace wire
 	{
-	public:
-		OmicronConnectorClient(IOmicronConnectorClientListener* clistener): listener(clistener)
-		{}
-
-		void connect(const char* server, int port = 27000, int dataPort = 7000);
-		void poll();
-		void dispose();
-		void setDataport(int);
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		template<typename T> inline T load(const char* p)
+		{
+			unsigned long long v = 0;
+			for(int i = (int)sizeof(T) - 1; i >= 0; i--) v = (v << 8) | (unsigned char)p[i];
+			return (T)v;
+		}
 
-	private:
-		void initHandshake();
-		void parseDGram(int);
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		template<typename T> inline void store(char* p, T value)
+		{
+			unsigned long long v = (unsigned long long)value;
+			for(int i = 0; i < (int)sizeof(T); i++) { p[i] = (char)(v & 0xFF); v >>= 8; }
+		}
 
-	private:
-		//typedef ListenerType Listener;
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		template<> inline float load<float>(const char* p)
+		{
+			unsigned int bits = load<unsigned int>(p);
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
 
-	#ifdef OMICRON_OS_WIN	
-		WSADATA wsaData;
-	#endif
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		template<> inline void store<float>(char* p, float value)
+		{
+			unsigned int bits;
+			memcpy(&bits, &value, sizeof(bits));
+			store<unsigned int>(p, bits);
+		}
+	};
 
-		SOCKET ConnectSocket;
-		SOCKET RecvSocket;
-		struct timeval timeout;
-		sockaddr_in SenderAddr;
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! A field of a wire structure: a value of type T at a fixed offset.
+	template<typename T, int FieldOffset> struct WireField
+	{
+		typedef T Type;
+		static const int Offset = FieldOffset;
+		//! Offset of the first byte after this field.
+		static const int End = FieldOffset + (int)sizeof(T);
 
-		const char* serverAddress;
-		int serverPort;
-		int dataPort;
+		static inline T read(const char* buf) { return wire::load<T>(&buf[Offset]); }
+		static inline void write(char* buf, T value) { wire::store<T>(&buf[Offset], value); }
+	};
 
-		#define DEFAULT_BUFLEN 1024
-		char recvbuf[DEFAULT_BUFLEN];
-		int iResult, iSendResult;
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! A field following the Previous one.
+	template<typename T, typename Previous> struct WireNext: public WireField<T, Previous::End> {};
 
-		int SenderAddrSize;
-		int recvbuflen;
-		bool readyToReceive;
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! Layout of events on the wire: this is the only definition of the event format, used by 
+	//! both EventWriter (server) and EventView (clients). Events are made of a fixed size header,
+	//! followed by the extra data, by an optional time trailer (marked by EventData::TimeTag)
+	//! and by an optional prediction trailer (marked by EventData::PredictionTag).
+	struct EventLayout
+	{
+		typedef WireField<unsigned int, 0> Timestamp;
+		typedef WireNext<unsigned int, Timestamp> SourceId;
+		typedef WireNext<int, SourceId> ServiceId;
+		typedef WireNext<unsigned int, ServiceId> ServiceType;
+		typedef WireNext<unsigned int, ServiceType> Type;
+		typedef WireNext<unsigned int, Type> Flags;
+		typedef WireNext<float, Flags> PosX;
+		typedef WireNext<float, PosX> PosY;
+		typedef WireNext<float, PosY> PosZ;
+		typedef WireNext<float, PosZ> OrW;
+		typedef WireNext<float, OrW> OrX;
+		typedef WireNext<float, OrX> OrY;
+		typedef WireNext<float, OrY> OrZ;
+		typedef WireNext<unsigned int, OrZ> ExtraDataType;
+		typedef WireNext<unsigned int, ExtraDataType> ExtraDataItems;
+		typedef WireNext<unsigned int, ExtraDataItems> ExtraDataMask;
+		static const int HeaderSize = ExtraDataMask::End;
+
+		// Time trailer, relative to the end of the extra data.
+		typedef WireField<unsigned int, 0> TimeTag;
+		typedef WireNext<unsigned long long, TimeTag> Time;
+		typedef WireNext<unsigned long long, Time> DeviceTime;
+		static const int TrailerSize = DeviceTime::End;
+
+		// Prediction trailer, following the time trailer: lead time and raw pose.
+		typedef WireField<unsigned int, 0> PredictionTag;
+		typedef WireNext<unsigned int, PredictionTag> Lead;
+		typedef WireNext<float, Lead> RawPosX;
+		typedef WireNext<float, RawPosX> RawPosY;
+		typedef WireNext<float, RawPosY> RawPosZ;
+		typedef WireNext<float, RawPosZ> RawOrW;
+		typedef WireNext<float, RawOrW> RawOrX;
+		typedef WireNext<float, RawOrX> RawOrY;
+		typedef WireNext<float, RawOrY> RawOrZ;
+		static const int PredictionTrailerSize = RawOrZ::End;
 
-		IOmicronConnectorClientListener* listener;
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Size of one extra data item, in bytes.
+		static inline int getExtraDataItemSize(unsigned int extraDataType)
+		{
+			switch(extraDataType)
+			{
+			case omicron::EventBase::ExtraDataFloatArray:
+			case omicron::EventBase::ExtraDataIntArray:
+				return 4;
+			case omicron::EventBase::ExtraDataVector3Array:
+				return 4 * 3;
+			case omicron::EventBase::ExtraDataNull:
+				return 0;
+			}
+			return 1;
+		}
 	};
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//template<typename ListenerType>
-	inline void OmicronConnectorClient::connect(const char* server, int port, int pdataPort) 
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! Layout of frame headers on the wire (see FrameHeader). Each event in a frame is prefixed
+	//! by an EventSize field.
+	struct FrameLayout
 	{
-		serverAddress = server;
-		serverPort = port;
-		dataPort = pdataPort;
+		typedef WireField<unsigned int, 0> Tag;
+		typedef WireNext<unsigned short, Tag> EventCount;
+		typedef WireNext<unsigned short, EventCount> Flags;
+		typedef WireNext<unsigned int, Flags> Sequence;
+		typedef WireNext<unsigned long long, Sequence> Time;
+		static const int Size = Time::End;
 
-		char srvPortChr[256];
-		sprintf(srvPortChr, "%d", serverPort);
+		typedef WireField<unsigned short, 0> EventSize;
 
-		SOCKET_INIT();
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		static inline void read(const char* buf, FrameHeader& header)
+		{
+			header.tag = Tag::read(buf);
+			header.eventCount = EventCount::read(buf);
+			header.flags = Flags::read(buf);
+			header.sequence = Sequence::read(buf);
+			header.time = Time::read(buf);
+		}
 
-		struct addrinfo hints, *res;
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		static inline void write(char* buf, unsigned short eventCount, unsigned short flags, 
+			unsigned int sequence, unsigned long long time)
+		{
+			Tag::write(buf, FrameHeader::Tag);
+			EventCount::write(buf, eventCount);
+			Flags::write(buf, flags);
+			Sequence::write(buf, sequence);
+			Time::write(buf, time);
+		}
+	};
 
-		// First, load up address structs with getaddrinfo():
-		memset(&hints, 0, sizeof hints);
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
+	// The layouts must match the documented sizes.
+	typedef char EventLayoutSizeCheck[EventLayout::HeaderSize == 64 && EventLayout::TrailerSize == 20 && 
+		EventLayout::PredictionTrailerSize == 36 ? 1 : -1];
+	typedef char FrameLayoutSizeCheck[FrameLayout::Size == FrameHeader::Size ? 1 : -1];
 
-		// Get the server address
-		getaddrinfo(serverAddress, srvPortChr, &hints, &res);
-		if(res == NULL)
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! Encodes an event directly into a datagram or frame buffer. The header setters can be called
+	//! in any order. setExtraData must be called before setTimes, and setTimes before 
+	//! setPrediction.
+	class EventWriter
+	{
+	public:
+		EventWriter(char* buffer, int capacity): 
+			myBuffer(buffer), myCapacity(capacity), myLength(EventLayout::HeaderSize) 
 		{
-			printf("omicronConnectorClient: Unable to connect to server '%s' on port '%d'", serverAddress, serverPort);
-			PRINT_SOCKET_ERROR("");
-			SOCKET_CLEANUP();
-			return;
+			EventLayout::ExtraDataType::write(myBuffer, omicron::EventBase::ExtraDataNull);
+			EventLayout::ExtraDataItems::write(myBuffer, 0);
+			EventLayout::ExtraDataMask::write(myBuffer, 0);
 		}
 
-		// Generate the socket
-		ConnectSocket = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline void setHeader(unsigned int timestamp, unsigned int sourceId, int serviceId, 
+			unsigned int serviceType, unsigned int type, unsigned int flags)
+		{
+			EventLayout::Timestamp::write(myBuffer, timestamp);
+			EventLayout::SourceId::write(myBuffer, sourceId);
+			EventLayout::ServiceId::write(myBuffer, serviceId);
+			EventLayout::ServiceType::write(myBuffer, serviceType);
+			EventLayout::Type::write(myBuffer, type);
+			EventLayout::Flags::write(myBuffer, flags);
+		}
 
-		// Connect to server
-		int result = ::connect(ConnectSocket, res->ai_addr, res->ai_addrlen);
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline void setPosition(float x, float y, float z)
+		{
+			EventLayout::PosX::write(myBuffer, x);
+			EventLayout::PosY::write(myBuffer, y);
+			EventLayout::PosZ::write(myBuffer, z);
+		}
 
-		if (result == -1) 
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline void setOrientation(float w, float x, float y, float z)
 		{
-			printf("omicronConnectorClient: Unable to connect to server '%s' on port '%d'", serverAddress, serverPort);
-			PRINT_SOCKET_ERROR("");
-			SOCKET_CLEANUP();
-			return;
+			EventLayout::OrW::write(myBuffer, w);
+			EventLayout::OrX::write(myBuffer, x);
+			EventLayout::OrY::write(myBuffer, y);
+			EventLayout::OrZ::write(myBuffer, z);
 		}
-		else
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Copies the extra data. Items that do not fit in the buffer are dropped, and not counted
+		//! in the item count sent. Returns the number of items written.
+		inline unsigned int setExtraData(unsigned int type, unsigned int items, unsigned int mask, const void* data)
 		{
-			printf("NetService: Connected to server '%s' on port '%d'!\n", serverAddress, serverPort);
+			int itemSize = EventLayout::getExtraDataItemSize(type);
+			int maxItems = itemSize > 0 ? (myCapacity - EventLayout::HeaderSize) / itemSize : 0;
+			if((int)items > maxItems) items = maxItems;
+			int size = items * itemSize;
+			if(size > 0) memcpy(&myBuffer[EventLayout::HeaderSize], data, size);
+
+			EventLayout::ExtraDataType::write(myBuffer, type);
+			EventLayout::ExtraDataItems::write(myBuffer, items);
+			EventLayout::ExtraDataMask::write(myBuffer, mask);
+			myLength = EventLayout::HeaderSize + size;
+			return items;
 		}
-		initHandshake();
 
-	}
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Appends the time trailer, if it fits in the buffer. Older clients ignore it.
+		inline void setTimes(unsigned long long time, unsigned long long deviceTime)
+		{
+			if(myLength + EventLayout::TrailerSize > myCapacity) return;
+			char* trailer = &myBuffer[myLength];
+			EventLayout::TimeTag::write(trailer, EventData::TimeTag);
+			EventLayout::Time::write(trailer, time);
+			EventLayout::DeviceTime::write(trailer, deviceTime);
+			myLength += EventLayout::TrailerSize;
+		}
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//template<typename ListenerType>
-	inline void OmicronConnectorClient::initHandshake() 
-	{
-		char sendbuf[50];
-		sprintf(sendbuf, "omicron_data_on,%d", dataPort);
-		printf("NetService: Sending handshake: '%s'\n", sendbuf);
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Appends the prediction trailer, if it fits in the buffer: the lead time (in microseconds) 
+		//! used to extrapolate the event pose, and the raw pose.
+		inline void setPrediction(unsigned int lead, const float* rawPosition, const float* rawOrientation)
+		{
+			if(myLength + EventLayout::PredictionTrailerSize > myCapacity) return;
+			char* trailer = &myBuffer[myLength];
+			EventLayout::PredictionTag::write(trailer, EventData::PredictionTag);
+			EventLayout::Lead::write(trailer, lead);
+			EventLayout::RawPosX::write(trailer, rawPosition[0]);
+			EventLayout::RawPosY::write(trailer, rawPosition[1]);
+			EventLayout::RawPosZ::write(trailer, rawPosition[2]);
+			EventLayout::RawOrW::write(trailer, rawOrientation[0]);
+			EventLayout::RawOrX::write(trailer, rawOrientation[1]);
+			EventLayout::RawOrY::write(trailer, rawOrientation[2]);
+			EventLayout::RawOrZ::write(trailer, rawOrientation[3]);
+			myLength += EventLayout::PredictionTrailerSize;
+		}
 
-		iResult = send(ConnectSocket, sendbuf, (int) strlen(sendbuf), 0);
+		//! Returns the size of the encoded event.
+		inline int getLength() const { return myLength; }
 
-		if (iResult == -1) 
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns the maximum encoded size of an event with the specified extra data.
+		static inline int getMaxLength(unsigned int extraDataType, unsigned int extraDataItems, int capacity, 
+			bool predicted = false)
 		{
-			PRINT_SOCKET_ERROR("NetService: Send failed");
-			SOCKET_CLOSE(ConnectSocket);
-			SOCKET_CLEANUP()
-			return;
+			int size = EventLayout::HeaderSize + EventLayout::getExtraDataItemSize(extraDataType) * extraDataItems + 
+				EventLayout::TrailerSize + (predicted ? EventLayout::PredictionTrailerSize : 0);
+			return size < capacity ? size : capacity;
 		}
 
-		sockaddr_in RecvAddr;
-		SenderAddrSize = sizeof(SenderAddr);
-		RecvSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-
-		// Bind the socket to any address and the specified port.
-		RecvAddr.sin_family = AF_INET;
-		RecvAddr.sin_port = htons(dataPort);
-		RecvAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-		::bind(RecvSocket, (const sockaddr*) &RecvAddr, sizeof(RecvAddr));
-		readyToReceive = true;
-	}
+	private:
+		char* myBuffer;
+		int myCapacity;
+		int myLength;
+	};
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//template<typename ListenerType>
-	inline void OmicronConnectorClient::poll()
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! Read-only view of an encoded event. Fields are decoded from the datagram when accessed, 
+	//! nothing is copied. The view is valid as long as the datagram buffer is.
+	class EventView
 	{
-		if(readyToReceive)
-		{
-			int result;
+	public:
+		EventView(const char* buffer, int size): myBuffer(buffer), mySize(size) {}
+
+		//! Returns false if the buffer is too short to contain an event.
+		bool isValid() const { return mySize >= EventLayout::HeaderSize; }
+
+		unsigned int getTimestamp() const { return EventLayout::Timestamp::read(myBuffer); }
+		unsigned int getSourceId() const { return EventLayout::SourceId::read(myBuffer); }
+		int getServiceId() const { return EventLayout::ServiceId::read(myBuffer); }
+		unsigned int getServiceType() const { return EventLayout::ServiceType::read(myBuffer); }
+		unsigned int getType() const { return EventLayout::Type::read(myBuffer); }
+		unsigned int getFlags() const { return EventLayout::Flags::read(myBuffer); }
+		float getPosX() const { return EventLayout::PosX::read(myBuffer); }
+		float getPosY() const { return EventLayout::PosY::read(myBuffer); }
+		float getPosZ() const { return EventLayout::PosZ::read(myBuffer); }
+		float getOrW() const { return EventLayout::OrW::read(myBuffer); }
+		float getOrX() const { return EventLayout::OrX::read(myBuffer); }
+		float getOrY() const { return EventLayout::OrY::read(myBuffer); }
+		float getOrZ() const { return EventLayout::OrZ::read(myBuffer); }
+		unsigned int getExtraDataType() const { return EventLayout::ExtraDataType::read(myBuffer); }
+		unsigned int getExtraDataItems() const { return EventLayout::ExtraDataItems::read(myBuffer); }
+		unsigned int getExtraDataMask() const { return EventLayout::ExtraDataMask::read(myBuffer); }
+
+		//! Returns the extra data, inside the datagram buffer.
+		const char* getExtraData() const { return &myBuffer[EventLayout::HeaderSize]; }
 
-			// Create a set of fd_set to store sockets
-			fd_set ReadFDs, WriteFDs, ExceptFDs;
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns the size of the extra data actually present in the datagram.
+		inline int getExtraDataSize() const
+		{
+			int size = EventLayout::getExtraDataItemSize(getExtraDataType()) * (int)getExtraDataItems();
+			int available = mySize - EventLayout::HeaderSize;
+			if(size > available) size = available;
+			return size > 0 ? size : 0;
+		}
 
-			// Set collections to null
-			FD_ZERO(&ReadFDs);
-			FD_ZERO(&WriteFDs);
-			FD_ZERO(&ExceptFDs);
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns the time trailer, or NULL if the server did not send it.
+		inline const char* getTrailer() const
+		{
+			int offset = EventLayout::HeaderSize + getExtraDataSize();
+			if(offset + EventLayout::TrailerSize > mySize) return NULL;
+			const char* trailer = &myBuffer[offset];
+			if(EventLayout::TimeTag::read(trailer) != EventData::TimeTag) return NULL;
+			return trailer;
+		}
 
-			FD_SET(RecvSocket, &ReadFDs);
-			FD_SET(RecvSocket, &ExceptFDs);
+		unsigned long long getTime() const 
+		{ const char* t = getTrailer(); return t != NULL ? EventLayout::Time::read(t) : 0; }
+		unsigned long long getDeviceTime() const 
+		{ const char* t = getTrailer(); return t != NULL ? EventLayout::DeviceTime::read(t) : 0; }
 
-			timeout.tv_sec  = 0;
-			timeout.tv_usec = 0;
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns the prediction trailer, or NULL if the event pose has not been predicted.
+		inline const char* getPredictionTrailer() const
+		{
+			int offset = EventLayout::HeaderSize + getExtraDataSize();
+			if(getTrailer() != NULL) offset += EventLayout::TrailerSize;
+			if(offset + EventLayout::PredictionTrailerSize > mySize) return NULL;
+			const char* trailer = &myBuffer[offset];
+			if(EventLayout::PredictionTag::read(trailer) != EventData::PredictionTag) return NULL;
+			return trailer;
+		}
 
-			do
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Copies the event to an EventData structure. Only the extra data present in the datagram
+		//! is copied.
+		inline void toEventData(EventData& ed) const
+		{
+			ed.timestamp = getTimestamp();
+			ed.sourceId = getSourceId();
+			ed.serviceId = getServiceId();
+			ed.serviceType = getServiceType();
+			ed.type = getType();
+			ed.flags = getFlags();
+			ed.posx = getPosX();
+			ed.posy = getPosY();
+			ed.posz = getPosZ();
+			ed.orw = getOrW();
+			ed.orx = getOrX();
+			ed.ory = getOrY();
+			ed.orz = getOrZ();
+			ed.extraDataType = getExtraDataType();
+			ed.extraDataItems = getExtraDataItems();
+			ed.extraDataMask = getExtraDataMask();
+
+			int extraDataSize = getExtraDataSize();
+			if(extraDataSize > EventData::ExtraDataSize - 1) extraDataSize = EventData::ExtraDataSize - 1;
+			memcpy(ed.extraData, getExtraData(), extraDataSize);
+			ed.extraData[extraDataSize] = '\0';
+
+			const char* trailer = getTrailer();
+			ed.time = trailer != NULL ? EventLayout::Time::read(trailer) : 0;
+			ed.deviceTime = trailer != NULL ? EventLayout::DeviceTime::read(trailer) : 0;
+
+			const char* prediction = getPredictionTrailer();
+			if(prediction != NULL)
 			{
-				// Check if UDP socket has data waiting to be read before socket blocks to attempt to read.
-				result = select(RecvSocket+1, &ReadFDs, &WriteFDs, &ExceptFDs, &timeout);
-				if( result > 0 ) parseDGram(result);
-			} while(result > 0);
+				ed.predictionLead = EventLayout::Lead::read(prediction);
+				ed.rawPosx = EventLayout::RawPosX::read(prediction);
+				ed.rawPosy = EventLayout::RawPosY::read(prediction);
+				ed.rawPosz = EventLayout::RawPosZ::read(prediction);
+				ed.rawOrw = EventLayout::RawOrW::read(prediction);
+				ed.rawOrx = EventLayout::RawOrX::read(prediction);
+				ed.rawOry = EventLayout::RawOrY::read(prediction);
+				ed.rawOrz = EventLayout::RawOrZ::read(prediction);
+			}
+			else
+			{
+				ed.setRawPose();
+			}
 		}
-	}
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//template<typename ListenerType>
-	inline void OmicronConnectorClient::dispose() 
+	private:
+		const char* myBuffer;
+		int mySize;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! A quantized event, as sent by the compact event encoding (see CompactCodec). Positions and 
+	//! Vector3 array extra data are stored as fixed point values.
+	struct CompactEvent
 	{
-		// Close the socket when finished receiving datagrams
-		printf("NetService: Finished receiving. Closing socket.\n");
-		iResult = SOCKET_CLOSE(RecvSocket);
-		if (iResult == -1) 
+		static const int MaxCoordinates = EventData::ExtraDataSize / 4;
+
+		//! Keyframe id, for keyframes.
+		unsigned char keyId;
+		unsigned int timestamp;
+		unsigned int sourceId;
+		int serviceId;
+		unsigned int serviceType;
+		unsigned int type;
+		unsigned int flags;
+		unsigned long long time;
+		unsigned long long deviceTime;
+		int position[3];
+		//! Orientation, after quantization (w, x, y, z).
+		float orientation[4];
+		unsigned int extraDataType;
+		unsigned int extraDataItems;
+		unsigned int extraDataMask;
+		//! Size of the extra data in bytes. For Vector3 arrays, 3 fixed point coordinates are 
+		//! stored per item.
+		int extraDataSize;
+		union 
 		{
-			PRINT_SOCKET_ERROR("NetService: Closesocket failed");
-			return;
-		}
-		SOCKET_CLEANUP();
-		printf("NetService: Shutting down.");
-	}
+			int coordinates[MaxCoordinates];
+			char bytes[EventData::ExtraDataSize];
+		} extraData;
+	};
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//template<typename ListenerType>
-	inline void OmicronConnectorClient::parseDGram(int result)
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! Compact encoding for continuous events. Fields are sent as variable length integers, 
+	//! positions and Vector3 arrays (i.e. skeleton joints) as fixed point values, unit 
+	//! quaternions in the smallest three form (48 bits).
+	//! Each source has keyframes, sent by the server on the reliable lane and stored by the client.
+	//! Once a keyframe has been acknowledged, the events of its source are sent as deltas against 
+	//! it: fields equal to the keyframe ones are omitted. Events sent before that are absolute.
+	//! Compact events are only sent in frames with the FrameHeader::FlagCompact flag.
+	class CompactCodec
 	{
-		result = recvfrom(RecvSocket, 
-			recvbuf,
-			DEFAULT_BUFLEN-1,
-			0,
-			(sockaddr *)&SenderAddr, 
-			(socklen_t*)&SenderAddrSize);
-		if(result > 0)
-		{
-			int offset = 0;
-			int msgLen = result - 1;
-			char* eventPacket = recvbuf;
-
-			EventData ed;
-
-			OI_READBUF(unsigned int, eventPacket, offset, ed.timestamp); 
-			OI_READBUF(unsigned int, eventPacket, offset, ed.sourceId); 
-			OI_READBUF(int, eventPacket, offset, ed.serviceId); 
-			OI_READBUF(unsigned int, eventPacket, offset, ed.serviceType); 
-			OI_READBUF(unsigned int, eventPacket, offset, ed.type); 
-			OI_READBUF(unsigned int, eventPacket, offset, ed.flags); 
-			OI_READBUF(float, eventPacket, offset, ed.posx); 
-			OI_READBUF(float, eventPacket, offset, ed.posy); 
-			OI_READBUF(float, eventPacket, offset, ed.posz); 
-			OI_READBUF(float, eventPacket, offset, ed.orw); 
-			OI_READBUF(float, eventPacket, offset, ed.orx); 
-			OI_READBUF(float, eventPacket, offset, ed.ory); 
-			OI_READBUF(float, eventPacket, offset, ed.orz); 
-		
-			OI_READBUF(unsigned int, eventPacket, offset, ed.extraDataType); 
-			OI_READBUF(unsigned int, eventPacket, offset, ed.extraDataItems); 
-			OI_READBUF(unsigned int, eventPacket, offset, ed.extraDataMask); 
-			memcpy(ed.extraData, &eventPacket[offset], EventData::ExtraDataSize);
-
-			listener->onEvent(ed);
-		} 
-		else 
+	public:
+		//! Event kinds, in the two lower bits of the first byte. Keyframes are stored by the 
+		//! client, and not delivered as events.
+		enum Kind { Absolute = 1, Keyframe = 2, Delta = 3 };
+		//! Field bits, in the first byte. Fields are present when they are different from the
+		//! reference event (a keyframe for deltas, a zero event otherwise).
+		enum Fields { KindMask = 3, HasHeader = 4, HasPosition = 8, HasOrientation = 16, 
+			HasExtraData = 32, HasDeviceTime = 64, RawOrientation = 128 };
+		//! Maximum size difference between a compact event and the same event in the standard 
+		//! encoding.
+		static const int MaxOverhead = 32;
+		//! Default fixed point scale: millimeters, for positions in meters.
+		static const int DefaultScale = 1000;
+		//! Fixed point values are clamped to +/- MaxFixed, so deltas always fit 4 bytes.
+		static const int MaxFixed = (1 << 26) - 1;
+
+		CompactCodec(int scale = DefaultScale): myScale(scale) {}
+
+		void setScale(int value) { myScale = value > 0 ? value : DefaultScale; }
+		int getScale() const { return myScale; }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns the reference event used by absolute events.
+		static const CompactEvent& getZeroEvent()
 		{
-			PRINT_SOCKET_ERROR("recvfrom failed");
+			static CompactEvent zero;
+			static bool initialized = false;
+			if(!initialized)
+			{
+				memset(&zero, 0, sizeof(zero));
+				zero.orientation[0] = 1;
+				initialized = true;
+			}
+			return zero;
 		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Quantizes an event in the standard encoding.
+		inline void quantize(const EventView& view, CompactEvent& evt) const
+		{
+			evt.keyId = 0;
+			evt.timestamp = view.getTimestamp();
+			evt.sourceId = view.getSourceId();
+			evt.serviceId = view.getServiceId();
+			evt.serviceType = view.getServiceType();
+			evt.type = view.getType();
+			evt.flags = view.getFlags();
+			evt.time = view.getTime();
+			evt.deviceTime = view.getDeviceTime();
+			evt.position[0] = toFixed(view.getPosX());
+			evt.position[1] = toFixed(view.getPosY());
+			evt.position[2] = toFixed(view.getPosZ());
+			quantizeOrientation(view.getOrW(), view.getOrX(), view.getOrY(), view.getOrZ(), evt.orientation);
+			evt.extraDataType = view.getExtraDataType();
+			evt.extraDataMask = view.getExtraDataMask();
+			evt.extraDataSize = view.getExtraDataSize();
+			if(evt.extraDataSize > EventData::ExtraDataSize) evt.extraDataSize = EventData::ExtraDataSize;
+			if(evt.extraDataType == omicron::EventBase::ExtraDataVector3Array)
+			{
+				evt.extraDataItems = evt.extraDataSize / 12;
+				evt.extraDataSize = evt.extraDataItems * 12;
+				const char* data = view.getExtraData();
+				for(int i = 0; i < (int)evt.extraDataItems * 3; i++)
+					evt.extraData.coordinates[i] = toFixed(wire::load<float>(&data[i * 4]));
+			}
+			else
+			{
+				evt.extraDataItems = view.getExtraDataItems();
+				memcpy(evt.extraData.bytes, view.getExtraData(), evt.extraDataSize);
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline void toEventData(const CompactEvent& evt, EventData& ed) const
+		{
+			ed.timestamp = evt.timestamp;
+			ed.sourceId = evt.sourceId;
+			ed.serviceId = evt.serviceId;
+			ed.serviceType = evt.serviceType;
+			ed.type = evt.type;
+			ed.flags = evt.flags;
+			ed.posx = toFloat(evt.position[0]);
+			ed.posy = toFloat(evt.position[1]);
+			ed.posz = toFloat(evt.position[2]);
+			ed.orw = evt.orientation[0];
+			ed.orx = evt.orientation[1];
+			ed.ory = evt.orientation[2];
+			ed.orz = evt.orientation[3];
+			ed.extraDataType = evt.extraDataType;
+			ed.extraDataItems = evt.extraDataItems;
+			ed.extraDataMask = evt.extraDataMask;
+			int size = evt.extraDataSize < EventData::ExtraDataSize - 1 ? evt.extraDataSize : EventData::ExtraDataSize - 1;
+			if(evt.extraDataType == omicron::EventBase::ExtraDataVector3Array)
+			{
+				for(int i = 0; i < size / 4; i++)
+				{
+					float value = toFloat(evt.extraData.coordinates[i]);
+					memcpy(&ed.extraData[i * 4], &value, 4);
+				}
+			}
+			else
+			{
+				memcpy(ed.extraData, evt.extraData.bytes, size);
+			}
+			ed.extraData[size] = '\0';
+			ed.time = evt.time;
+			ed.deviceTime = evt.deviceTime;
+			ed.setRawPose();
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Encodes an event. Deltas and keyframes are encoded against ref, absolute events against 
+		//! the zero event. buf must have room for the event standard encoding size + MaxOverhead 
+		//! bytes. Returns the encoded size.
+		inline int encode(Kind kind, const CompactEvent& evt, const CompactEvent* ref, char* buf) const
+		{
+			if(kind != Delta || ref == NULL) ref = &getZeroEvent();
+
+			int fields = kind;
+			if(evt.serviceType != ref->serviceType || evt.type != ref->type || evt.flags != ref->flags) 
+				fields |= HasHeader;
+			if(memcmp(evt.position, ref->position, sizeof(evt.position)) != 0) fields |= HasPosition;
+			if(memcmp(evt.orientation, ref->orientation, sizeof(evt.orientation)) != 0) 
+				fields |= isUnit(evt.orientation) ? HasOrientation : HasOrientation | RawOrientation;
+			if(evt.extraDataType != ref->extraDataType || evt.extraDataItems != ref->extraDataItems ||
+				evt.extraDataMask != ref->extraDataMask || evt.extraDataSize != ref->extraDataSize ||
+				memcmp(evt.extraData.bytes, ref->extraData.bytes, evt.extraDataSize) != 0)
+				fields |= HasExtraData;
+			if(evt.deviceTime != 0) fields |= HasDeviceTime;
+
+			int offset = 0;
+			buf[offset++] = (char)fields;
+			if(kind != Absolute) buf[offset++] = (char)evt.keyId;
+			offset += putVarint(&buf[offset], evt.sourceId);
+			offset += putSigned(&buf[offset], evt.serviceId);
+			offset += putSigned(&buf[offset], (int)(evt.timestamp - ref->timestamp));
+			offset += putSigned(&buf[offset], (long long)(evt.time - ref->time));
+			if(fields & HasHeader)
+			{
+				offset += putVarint(&buf[offset], evt.serviceType);
+				offset += putVarint(&buf[offset], evt.type);
+				offset += putVarint(&buf[offset], evt.flags);
+			}
+			if(fields & HasDeviceTime) offset += putSigned(&buf[offset], (long long)(evt.deviceTime - evt.time));
+			if(fields & HasPosition)
+			{
+				for(int i = 0; i < 3; i++) offset += putSigned(&buf[offset], evt.position[i] - ref->position[i]);
+			}
+			if(fields & RawOrientation)
+			{
+				for(int i = 0; i < 4; i++) { wire::store<float>(&buf[offset], evt.orientation[i]); offset += 4; }
+			}
+			else if(fields & HasOrientation)
+			{
+				unsigned long long bits = packOrientation(evt.orientation);
+				for(int i = 0; i < 6; i++) buf[offset++] = (char)((bits >> (i * 8)) & 0xFF);
+			}
+			if(fields & HasExtraData)
+			{
+				offset += putVarint(&buf[offset], evt.extraDataType);
+				offset += putVarint(&buf[offset], evt.extraDataItems);
+				offset += putVarint(&buf[offset], evt.extraDataMask);
+				offset += putVarint(&buf[offset], evt.extraDataSize);
+				if(evt.extraDataType == omicron::EventBase::ExtraDataVector3Array)
+				{
+					// Joints are sent as deltas against the same joint in the reference event.
+					int refCoordinates = ref->extraDataType == evt.extraDataType ? ref->extraDataSize / 4 : 0;
+					for(int i = 0; i < evt.extraDataSize / 4; i++)
+					{
+						int refValue = i < refCoordinates ? ref->extraData.coordinates[i] : 0;
+						offset += putSigned(&buf[offset], evt.extraData.coordinates[i] - refValue);
+					}
+				}
+				else
+				{
+					memcpy(&buf[offset], evt.extraData.bytes, evt.extraDataSize);
+					offset += evt.extraDataSize;
+				}
+			}
+			return offset;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Reads the part of a compact event needed to find its reference keyframe. Returns the 
+		//! offset of the rest of the event, or 0 if the event is truncated.
+		static inline int decodeHeader(const char* buf, int size, int& fields, unsigned char& keyId, 
+			int& serviceId, unsigned int& sourceId)
+		{
+			if(size < 1) return 0;
+			int offset = 0;
+			fields = (unsigned char)buf[offset++];
+			keyId = 0;
+			if((fields & KindMask) != Absolute)
+			{
+				if(offset >= size) return 0;
+				keyId = (unsigned char)buf[offset++];
+			}
+			unsigned long long value;
+			if(!getVarint(buf, size, offset, value)) return 0;
+			sourceId = (unsigned int)value;
+			if(!getVarint(buf, size, offset, value)) return 0;
+			serviceId = (int)unzigzag(value);
+			return offset;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Decodes the rest of a compact event (see decodeHeader). ref is the keyframe a delta event
+		//! refers to. Returns false if the event is truncated or invalid.
+		inline bool decode(const char* buf, int size, int offset, int fields, const CompactEvent* ref, 
+			CompactEvent& evt) const
+		{
+			if((fields & KindMask) != Delta || ref == NULL) ref = &getZeroEvent();
+
+			unsigned long long value;
+			if(!getVarint(buf, size, offset, value)) return false;
+			evt.timestamp = ref->timestamp + (int)unzigzag(value);
+			if(!getVarint(buf, size, offset, value)) return false;
+			evt.time = ref->time + unzigzag(value);
+
+			evt.serviceType = ref->serviceType;
+			evt.type = ref->type;
+			evt.flags = ref->flags;
+			if(fields & HasHeader)
+			{
+				if(!getVarint(buf, size, offset, value)) return false;
+				evt.serviceType = (unsigned int)value;
+				if(!getVarint(buf, size, offset, value)) return false;
+				evt.type = (unsigned int)value;
+				if(!getVarint(buf, size, offset, value)) return false;
+				evt.flags = (unsigned int)value;
+			}
+			evt.deviceTime = 0;
+			if(fields & HasDeviceTime)
+			{
+				if(!getVarint(buf, size, offset, value)) return false;
+				evt.deviceTime = evt.time + unzigzag(value);
+			}
+			for(int i = 0; i < 3; i++)
+			{
+				evt.position[i] = ref->position[i];
+				if(fields & HasPosition)
+				{
+					if(!getVarint(buf, size, offset, value)) return false;
+					evt.position[i] += (int)unzigzag(value);
+				}
+			}
+			if(fields & RawOrientation)
+			{
+				if(offset + 16 > size) return false;
+				for(int i = 0; i < 4; i++) { evt.orientation[i] = wire::load<float>(&buf[offset]); offset += 4; }
+			}
+			else if(fields & HasOrientation)
+			{
+				if(offset + 6 > size) return false;
+				unsigned long long bits = 0;
+				for(int i = 5; i >= 0; i--) bits = (bits << 8) | (unsigned char)buf[offset + i];
+				offset += 6;
+				unpackOrientation(bits, evt.orientation);
+			}
+			else
+			{
+				memcpy(evt.orientation, ref->orientation, sizeof(evt.orientation));
+			}
+
+			if(!(fields & HasExtraData))
+			{
+				evt.extraDataType = ref->extraDataType;
+				evt.extraDataItems = ref->extraDataItems;
+				evt.extraDataMask = ref->extraDataMask;
+				evt.extraDataSize = ref->extraDataSize;
+				memcpy(evt.extraData.bytes, ref->extraData.bytes, ref->extraDataSize);
+				return true;
+			}
+
+			if(!getVarint(buf, size, offset, value)) return false;
+			evt.extraDataType = (unsigned int)value;
+			if(!getVarint(buf, size, offset, value)) return false;
+			evt.extraDataItems = (unsigned int)value;
+			if(!getVarint(buf, size, offset, value)) return false;
+			evt.extraDataMask = (unsigned int)value;
+			if(!getVarint(buf, size, offset, value) || value > (unsigned long long)EventData::ExtraDataSize) return false;
+			evt.extraDataSize = (int)value;
+			if(evt.extraDataType == omicron::EventBase::ExtraDataVector3Array)
+			{
+				int refCoordinates = ref->extraDataType == evt.extraDataType ? ref->extraDataSize / 4 : 0;
+				for(int i = 0; i < evt.extraDataSize / 4; i++)
+				{
+					if(!getVarint(buf, size, offset, value)) return false;
+					int refValue = i < refCoordinates ? ref->extraData.coordinates[i] : 0;
+					evt.extraData.coordinates[i] = refValue + (int)unzigzag(value);
+				}
+			}
+			else
+			{
+				if(offset + evt.extraDataSize > size) return false;
+				memcpy(evt.extraData.bytes, &buf[offset], evt.extraDataSize);
+			}
+			return true;
+		}
+
+	private:
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline int toFixed(float value) const
+		{
+			// NaNs fail both comparisons and end up as 0.
+			double fixed = floor((double)value * myScale + 0.5);
+			if(fixed > MaxFixed) return MaxFixed;
+			if(fixed < -MaxFixed) return -MaxFixed;
+			if(fixed >= -MaxFixed && fixed <= MaxFixed) return (int)fixed;
+			return 0;
+		}
+
+		inline float toFloat(int value) const { return (float)((double)value / myScale); }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		static inline bool isUnit(const float* q)
+		{
+			float norm = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+			return norm > 0.99f && norm < 1.01f;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Stores the orientation the client will decode. Non unit quaternions are sent as they are.
+		static inline void quantizeOrientation(float w, float x, float y, float z, float* q)
+		{
+			q[0] = w; q[1] = x; q[2] = y; q[3] = z;
+			if(isUnit(q)) unpackOrientation(packOrientation(q), q);
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Smallest three: the index of the largest component (2 bits), the other three 
+		//! components (15 bits each) and the sign of the largest component (1 bit). The largest 
+		//! component is recomputed by the receiver. q and -q are the same rotation, but the sign
+		//! is kept so clients get the quaternion the server had.
+		static inline unsigned long long packOrientation(const float* q)
+		{
+			int largest = 0;
+			for(int i = 1; i < 4; i++) if(fabs(q[i]) > fabs(q[largest])) largest = i;
+			float sign = q[largest] < 0 ? -1.0f : 1.0f;
+			// The three smallest components of a unit quaternion are in [-1/sqrt(2), 1/sqrt(2)].
+			const double QuaternionRange = 0.70710678118654752;
+
+			unsigned long long bits = largest;
+			int shift = 2;
+			for(int i = 0; i < 4; i++)
+			{
+				if(i == largest) continue;
+				double c = q[i] * sign;
+				if(c > QuaternionRange) c = QuaternionRange;
+				if(c < -QuaternionRange) c = -QuaternionRange;
+				unsigned long long v = (unsigned long long)floor((c + QuaternionRange) / (2 * QuaternionRange) * 32767 + 0.5);
+				bits |= v << shift;
+				shift += 15;
+			}
+			if(sign < 0) bits |= 1ULL << 47;
+			return bits;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		static inline void unpackOrientation(unsigned long long bits, float* q)
+		{
+			const double QuaternionRange = 0.70710678118654752;
+			int largest = (int)(bits & 3);
+			int shift = 2;
+			double sum = 0;
+			for(int i = 0; i < 4; i++)
+			{
+				if(i == largest) continue;
+				double c = (double)((bits >> shift) & 0x7FFF) / 32767 * (2 * QuaternionRange) - QuaternionRange;
+				q[i] = (float)c;
+				sum += c * c;
+				shift += 15;
+			}
+			q[largest] = (float)sqrt(sum < 1 ? 1 - sum : 0);
+			if(bits & (1ULL << 47))
+				for(int i = 0; i < 4; i++) q[i] = -q[i];
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		static inline int putVarint(char* buf, unsigned long long value)
+		{
+			int len = 0;
+			while(value >= 0x80)
+			{
+				buf[len++] = (char)((value & 0x7F) | 0x80);
+				value >>= 7;
+			}
+			buf[len++] = (char)value;
+			return len;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		static inline int putSigned(char* buf, long long value)
+		{
+			// Zigzag encoding: small negative values get short varints too.
+			return putVarint(buf, ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		static inline bool getVarint(const char* buf, int size, int& offset, unsigned long long& value)
+		{
+			value = 0;
+			for(int shift = 0; shift < 64 && offset < size; shift += 7)
+			{
+				unsigned char b = (unsigned char)buf[offset++];
+				value |= (unsigned long long)(b & 0x7F) << shift;
+				if(!(b & 0x80)) return true;
+			}
+			return false;
+		}
+
+		static inline long long unzigzag(unsigned long long value)
+		{ return (long long)(value >> 1) ^ -(long long)(value & 1); }
+
+	private:
+		int myScale;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! The keyframes received by a compact mode client (see CompactCodec). The last two keyframes
+	//! of each source are kept: the server keeps sending deltas against the previous keyframe 
+	//! until the client acknowledges the new one. The table grows with the number of sources:
+	//! sources never replace each other, since the server would keep sending deltas against
+	//! keyframes the client dropped.
+	class CompactKeyTable
+	{
+	public:
+		//! Initial number of entries. The table doubles when it is half full.
+		static const int InitialCapacity = 64;
+
+		CompactKeyTable(): myEntries(NULL), myCapacity(0), mySize(0) {}
+		~CompactKeyTable() { delete[] myEntries; }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		void clear()
+		{
+			for(int i = 0; i < myCapacity; i++) myEntries[i].used = false;
+			mySize = 0;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns a keyframe, or NULL if it has not been received.
+		const CompactEvent* find(int serviceId, unsigned int sourceId, unsigned char keyId) const
+		{
+			Entry* entry = findEntry(serviceId, sourceId);
+			if(entry == NULL || !entry->used) return NULL;
+			for(int i = 0; i < 2; i++)
+				if(entry->valid[i] && entry->keys[i].keyId == keyId) return &entry->keys[i];
+			return NULL;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Stores a keyframe, replacing the one with the same id or the oldest one of its source.
+		void store(const CompactEvent& key)
+		{
+			if(mySize * 2 >= myCapacity) grow();
+			Entry* entry = findEntry(key.serviceId, key.sourceId);
+			if(!entry->used)
+			{
+				entry->used = true;
+				entry->serviceId = key.serviceId;
+				entry->sourceId = key.sourceId;
+				entry->newest = 1;
+				entry->valid[0] = entry->valid[1] = false;
+				mySize++;
+			}
+			int slot = entry->newest ^ 1;
+			if(entry->valid[entry->newest] && entry->keys[entry->newest].keyId == key.keyId) slot = entry->newest;
+			entry->keys[slot] = key;
+			entry->valid[slot] = true;
+			entry->newest = slot;
+		}
+
+	private:
+		struct Entry
+		{
+			bool used;
+			int serviceId;
+			unsigned int sourceId;
+			int newest;
+			bool valid[2];
+			CompactEvent keys[2];
+		};
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		// Open addressing: returns the entry of a source, or the free entry where it should be 
+		// stored. The table is never full.
+		Entry* findEntry(int serviceId, unsigned int sourceId) const
+		{
+			if(myEntries == NULL) return NULL;
+			int i = (int)((sourceId * 31 + (unsigned int)serviceId) & (unsigned int)(myCapacity - 1));
+			while(myEntries[i].used && 
+				(myEntries[i].serviceId != serviceId || myEntries[i].sourceId != sourceId))
+			{
+				i = (i + 1) & (myCapacity - 1);
+			}
+			return &myEntries[i];
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		void grow()
+		{
+			Entry* entries = myEntries;
+			int capacity = myCapacity;
+			myCapacity = capacity == 0 ? InitialCapacity : capacity * 2;
+			myEntries = new Entry[myCapacity];
+			for(int i = 0; i < myCapacity; i++) myEntries[i].used = false;
+			for(int i = 0; i < capacity; i++)
+			{
+				if(entries[i].used) *findEntry(entries[i].serviceId, entries[i].sourceId) = entries[i];
+			}
+			delete[] entries;
+		}
+
+	private:
+		Entry* myEntries;
+		// Number of entries (a power of two), and of used entries.
+		int myCapacity;
+		int mySize;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! Appends opt to the string in buf (size bytes) if the whole option fits. Returns false otherwise.
+	inline bool appendOption(char* buf, size_t size, const char* opt)
+	{
+		size_t len = strlen(buf);
+		size_t optlen = strlen(opt);
+		if(len + optlen >= size) return false;
+		memcpy(&buf[len], opt, optlen + 1);
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! A client subscription: selects the events a client receives from the server, by service 
+	//! type, event type and source id. Subscriptions are sent to the server as handshake options.
+	//! An empty filter (the default) accepts all events.
+	struct EventFilter
+	{
+		static const int MaxSourceRanges = 16;
+		//! Size of a buffer that holds any filter written by toString, i.e. with all the masks set 
+		//! and MaxSourceRanges ranges of 10 digit ids.
+		static const int MaxStringLength = 400;
+
+		//! Bit n set: accept events from services of type n (see EventBase::ServiceType).
+		unsigned int serviceTypes;
+		//! Bit n set: accept events of type n (see EventBase::Type). Types above 30 use bit 31.
+		unsigned int eventTypes;
+		//! Accepted source id ranges (inclusive). When empty, all sources are accepted.
+		int numSourceRanges;
+		unsigned int sourceRanges[MaxSourceRanges][2];
+
+		EventFilter() { reset(); }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline void reset()
+		{
+			serviceTypes = 0xFFFFFFFF;
+			eventTypes = 0xFFFFFFFF;
+			numSourceRanges = 0;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline bool isEmpty() const
+		{
+			return serviceTypes == 0xFFFFFFFF && eventTypes == 0xFFFFFFFF && numSourceRanges == 0;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		static inline unsigned int getTypeBit(unsigned int type)
+		{
+			return type < 31 ? (1u << type) : (1u << 31);
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Adds a range of accepted source ids. Returns false if there are too many ranges.
+		inline bool addSourceRange(unsigned int first, unsigned int last)
+		{
+			if(numSourceRanges == MaxSourceRanges) return false;
+			sourceRanges[numSourceRanges][0] = first;
+			sourceRanges[numSourceRanges][1] = last;
+			numSourceRanges++;
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline bool accepts(unsigned int serviceType, unsigned int type, unsigned int sourceId) const
+		{
+			if(serviceType >= 32 || (serviceTypes & (1u << serviceType)) == 0) return false;
+			if((eventTypes & getTypeBit(type)) == 0) return false;
+			if(numSourceRanges == 0) return true;
+			for(int i = 0; i < numSourceRanges; i++)
+			{
+				if(sourceId >= sourceRanges[i][0] && sourceId <= sourceRanges[i][1]) return true;
+			}
+			return false;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Writes the filter as handshake options: ' services=<mask> types=<mask> sources=<a-b>+..'
+		//! Only options different from the defaults are written. Returns false if the filter did not 
+		//! fit in size bytes (see MaxStringLength): buf then holds the options that fit.
+		inline bool toString(char* buf, size_t size) const
+		{
+			buf[0] = '\0';
+			char opt[32];
+			if(serviceTypes != 0xFFFFFFFF)
+			{
+				snprintf(opt, sizeof(opt), " services=0x%x", serviceTypes);
+				if(!appendOption(buf, size, opt)) return false;
+			}
+			if(eventTypes != 0xFFFFFFFF)
+			{
+				snprintf(opt, sizeof(opt), " types=0x%x", eventTypes);
+				if(!appendOption(buf, size, opt)) return false;
+			}
+			for(int i = 0; i < numSourceRanges; i++)
+			{
+				snprintf(opt, sizeof(opt), "%s%u-%u", i == 0 ? " sources=" : "+", sourceRanges[i][0], sourceRanges[i][1]);
+				if(!appendOption(buf, size, opt)) return false;
+			}
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Parses a single handshake option. Returns false if the option is not a filter option.
+		inline bool parseOption(const char* opt)
+		{
+			if(strncmp(opt, "services=", 9) == 0)
+			{
+				serviceTypes = (unsigned int)strtoul(&opt[9], NULL, 0);
+			}
+			else if(strncmp(opt, "types=", 6) == 0)
+			{
+				eventTypes = (unsigned int)strtoul(&opt[6], NULL, 0);
+			}
+			else if(strncmp(opt, "sources=", 8) == 0)
+			{
+				// Ranges are separated by '+'. A range is a single id or two ids separated by '-'.
+				numSourceRanges = 0;
+				const char* range = &opt[8];
+				while(*range != '\0')
+				{
+					char* end;
+					unsigned int first = (unsigned int)strtoul(range, &end, 0);
+					unsigned int last = first;
+					if(*end == '-') last = (unsigned int)strtoul(end + 1, &end, 0);
+					if(end == range || !addSourceRange(first, last)) break;
+					range = end;
+					if(*range == '+') range++;
+				}
+			}
+			else
+			{
+				return false;
+			}
+			return true;
+		}
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! A client output policy: limits the rate at which the server sends events to a client, for
+	//! each service type. When a service type is rate limited, continuous events (Update and Move)
+	//! are conflated: the server only sends the latest one for each source, at most maxRate times
+	//! per second. Other events (Down, Up, Trace, Untrace...) are never dropped or delayed.
+	//! Policies are sent to the server as handshake options. The default policy has no limits.
+	struct OutputPolicy
+	{
+		static const int MaxServiceTypes = 32;
+		//! Size of a buffer that holds any policy written by toString (a rate for each service type).
+		static const int MaxStringLength = 672;
+
+		//! Maximum number of updates per second for each service type. 0 means no limit.
+		float maxRates[MaxServiceTypes];
+
+		OutputPolicy() { reset(); }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline void reset()
+		{
+			for(int i = 0; i < MaxServiceTypes; i++) maxRates[i] = 0;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline bool isEmpty() const
+		{
+			for(int i = 0; i < MaxServiceTypes; i++) if(maxRates[i] > 0) return false;
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Sets the maximum rate for all service types.
+		inline void setMaxRate(float rate)
+		{
+			for(int i = 0; i < MaxServiceTypes; i++) maxRates[i] = rate;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline void setMaxRate(unsigned int serviceType, float rate)
+		{
+			if(serviceType < MaxServiceTypes) maxRates[serviceType] = rate;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline float getMaxRate(unsigned int serviceType) const
+		{
+			return serviceType < MaxServiceTypes ? maxRates[serviceType] : 0;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns true for the event types that can be conflated (or lost). Update events 
+		//! carrying a string (i.e. SagePointer pointer info) are discrete.
+		static inline bool isContinuous(unsigned int type, unsigned int extraDataType = omicron::EventBase::ExtraDataNull)
+		{
+			if(extraDataType == omicron::EventBase::ExtraDataString) return false;
+			return type == omicron::EventBase::Update || type == omicron::EventBase::Move;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Writes the policy as handshake options: ' rate=<hz>' when all service types use the 
+		//! same limit, ' rate=<serviceType>:<hz>' for each limited service type otherwise.
+		//! Returns false if the policy did not fit in size bytes: buf then holds the options that fit.
+		inline bool toString(char* buf, size_t size) const
+		{
+			buf[0] = '\0';
+			char opt[32];
+			bool uniform = true;
+			for(int i = 1; i < MaxServiceTypes; i++) if(maxRates[i] != maxRates[0]) uniform = false;
+			if(uniform)
+			{
+				if(maxRates[0] > 0)
+				{
+					snprintf(opt, sizeof(opt), " rate=%g", maxRates[0]);
+					return appendOption(buf, size, opt);
+				}
+				return true;
+			}
+			for(int i = 0; i < MaxServiceTypes; i++)
+			{
+				if(maxRates[i] > 0)
+				{
+					snprintf(opt, sizeof(opt), " rate=%d:%g", i, maxRates[i]);
+					if(!appendOption(buf, size, opt)) return false;
+				}
+			}
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Parses a single handshake option. Returns false if the option is not a policy option.
+		inline bool parseOption(const char* opt)
+		{
+			if(strncmp(opt, "rate=", 5) != 0) return false;
+
+			const char* sep = strchr(opt, ':');
+			if(sep == NULL) setMaxRate((float)atof(&opt[5]));
+			else setMaxRate((unsigned int)atoi(&opt[5]), (float)atof(sep + 1));
+			return true;
+		}
+	};
+#endif
+
+#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+#ifndef OMICRON_SHAREDEVENTRING_DEFINED
+#define OMICRON_SHAREDEVENTRING_DEFINED
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! A ring of event datagrams in shared memory (/dev/shm), written by the server and read by 
+	//! clients running on the same machine, without any system call per event. There is a single
+	//! writer and any number of readers. Readers never block the writer: each slot is protected 
+	//! by a sequence number, and readers falling behind by more than the ring size lose the 
+	//! overwritten events (counted as overruns).
+	class SharedEventRing
+	{
+	public:
+		// Marks a valid ring ('OSHM').
+		static const unsigned int Tag = 0x4D48534F;
+		static const unsigned int Version = 1;
+		// Size of each slot, large enough for a single event datagram.
+		static const int SlotSize = 576;
+
+		struct Header
+		{
+			unsigned int tag;
+			unsigned int version;
+			unsigned int slotSize;
+			unsigned int numSlots;
+			// Number of datagrams written so far.
+			volatile unsigned int writeSequence;
+			char padding[44];
+		};
+
+		// A slot is being written when its sequence is odd. When a datagram 
+		// has been written at position n, the slot sequence is 2n + 2.
+		struct Slot
+		{
+			volatile unsigned int sequence;
+			unsigned int length;
+			char data[SlotSize - 8];
+		};
+
+		SharedEventRing(): header(NULL), slots(NULL), mappedSize(0), readSequence(0), overruns(0) {}
+		~SharedEventRing() { close(); }
+
+		bool isOpen() { return header != NULL; }
+		//! Number of datagrams the reader lost because the writer overwrote them.
+		unsigned int getOverruns() { return overruns; }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Creates the ring (writer side). name is the file name in /dev/shm.
+		inline bool create(const char* name, int numSlots)
+		{
+			close();
+			char path[128];
+			snprintf(path, sizeof(path), "/dev/shm/%s", name);
+			int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if(fd < 0) return false;
+
+			size_t size = sizeof(Header) + (size_t)numSlots * sizeof(Slot);
+			if(ftruncate(fd, size) != 0 || !map(fd, size, true))
+			{
+				::close(fd);
+				return false;
+			}
+			::close(fd);
+
+			memset(header, 0, sizeof(Header));
+			header->slotSize = SlotSize;
+			header->numSlots = numSlots;
+			header->version = Version;
+			__sync_synchronize();
+			header->tag = Tag;
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Attaches to a ring created by the server (reader side). Only datagrams written after
+		//! this call are read.
+		inline bool open(const char* name)
+		{
+			close();
+			char path[128];
+			snprintf(path, sizeof(path), "/dev/shm/%s", name);
+			int fd = ::open(path, O_RDONLY);
+			if(fd < 0) return false;
+
+			struct stat st;
+			bool ok = fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Header) && map(fd, st.st_size, false);
+			::close(fd);
+			if(!ok) return false;
+
+			if(header->tag != Tag || header->version != Version || header->slotSize != SlotSize ||
+				sizeof(Header) + (size_t)header->numSlots * sizeof(Slot) > mappedSize)
+			{
+				close();
+				return false;
+			}
+			readSequence = header->writeSequence;
+			overruns = 0;
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline void close()
+		{
+			if(header != NULL) munmap((void*)header, mappedSize);
+			header = NULL;
+			slots = NULL;
+			mappedSize = 0;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Writes a datagram (writer side).
+		inline void write(const char* data, int length)
+		{
+			if(length > (int)sizeof(slots[0].data)) length = sizeof(slots[0].data);
+			unsigned int n = header->writeSequence;
+			Slot& slot = slots[n % header->numSlots];
+			slot.sequence = 2 * n + 1;
+			__sync_synchronize();
+			memcpy(slot.data, data, length);
+			slot.length = length;
+			__sync_synchronize();
+			slot.sequence = 2 * n + 2;
+			header->writeSequence = n + 1;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Reads the next datagram (reader side). Returns its length, or 0 if no datagram is 
+		//! available.
+		inline int read(char* data, int size)
+		{
+			while(true)
+			{
+				unsigned int w = header->writeSequence;
+				__sync_synchronize();
+				int available = (int)(w - readSequence);
+				if(available <= 0) return 0;
+
+				// Skip the datagrams that have been (or are about to be) overwritten.
+				int maxAvailable = (int)header->numSlots - 1;
+				if(available > maxAvailable)
+				{
+					overruns += available - maxAvailable;
+					readSequence = w - maxAvailable;
+				}
+
+				Slot& slot = slots[readSequence % header->numSlots];
+				unsigned int sequence = slot.sequence;
+				__sync_synchronize();
+				int length = (int)slot.length;
+				if(length > size) length = size;
+				if(length > (int)sizeof(slot.data)) length = sizeof(slot.data);
+				if(sequence == 2 * readSequence + 2) memcpy(data, slot.data, length);
+				__sync_synchronize();
+
+				// The slot was overwritten while we were reading it.
+				bool valid = sequence == 2 * readSequence + 2 && slot.sequence == sequence;
+				readSequence++;
+				if(valid) return length;
+				overruns++;
+			}
+		}
+
+	private:
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline bool map(int fd, size_t size, bool writable)
+		{
+			void* ptr = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+			if(ptr == MAP_FAILED) return false;
+			header = (Header*)ptr;
+			slots = (Slot*)((char*)ptr + sizeof(Header));
+			mappedSize = size;
+			return true;
+		}
+
+	private:
+		Header* header;
+		Slot* slots;
+		size_t mappedSize;
+		// Reader position.
+		unsigned int readSequence;
+		unsigned int overruns;
+	};
+#endif
+#endif
+
+// if OMICRON_CONNECTOR_LEAN_AND_MEAN, only define the omicron::EventBase and omicronConnector::EventData classes.
+// Skip the OmicronConnectorClient class and all socket functionality.
+#ifndef OMICRON_CONNECTOR_LEAN_AND_MEAN
+#ifndef OMICRON_CONNECTORCLIENT_DEFINED
+#define OMICRON_CONNECTORCLIENT_DEFINED
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! Copies an event, skipping the unused part of the extra data buffer.
+	inline void copyEventData(EventData& dst, const EventData& src)
+	{
+		int extraDataSize = src.getExtraDataSize();
+		if(extraDataSize < 0 || extraDataSize > EventData::ExtraDataSize) extraDataSize = EventData::ExtraDataSize;
+		memcpy(&dst, &src, (const char*)src.extraData - (const char*)&src + extraDataSize);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! The latest event of each (service type, source id) pair. There is a single writer, and any 
+	//! number of readers that never block it: each entry is protected by a sequence number 
+	//! (seqlock), odd while the entry is being written. Readers retry when the sequence changes 
+	//! during their copy. Entries are never removed.
+	class EventStateTable
+	{
+	public:
+		//! Maximum number of (service type, source id) pairs. Must be a power of two.
+		static const int Capacity = 128;
+
+		EventStateTable(): overflows(0) { memset(entries, 0, sizeof(entries)); }
+
+		//! Number of events dropped because the table was full.
+		unsigned int getOverflows() { return overflows; }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Stores an event (writer side).
+		inline bool write(const EventData& ed)
+		{
+			Entry* entry = find(ed.serviceType, ed.sourceId, true);
+			if(entry == NULL)
+			{
+				overflows++;
+				return false;
+			}
+			entry->sequence++;
+			OMICRON_CONNECTOR_BARRIER();
+			copyEventData(entry->data, ed);
+			OMICRON_CONNECTOR_BARRIER();
+			entry->sequence++;
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Copies the latest event of a source to ed. Returns false if no event has been received
+		//! from the source.
+		inline bool read(unsigned int serviceType, unsigned int sourceId, EventData& ed)
+		{
+			Entry* entry = find(serviceType, sourceId, false);
+			if(entry == NULL) return false;
+			while(true)
+			{
+				unsigned int sequence = entry->sequence;
+				OMICRON_CONNECTOR_BARRIER();
+				if((sequence & 1) == 0)
+				{
+					copyEventData(ed, entry->data);
+					OMICRON_CONNECTOR_BARRIER();
+					if(entry->sequence == sequence) return true;
+				}
+			}
+		}
+
+	private:
+		struct Entry
+		{
+			volatile unsigned int sequence;
+			// Set once the key is written.
+			volatile unsigned int used;
+			unsigned int serviceType;
+			unsigned int sourceId;
+			EventData data;
+		};
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		// Open addressing with linear probing. Only the writer inserts entries.
+		inline Entry* find(unsigned int serviceType, unsigned int sourceId, bool insert)
+		{
+			unsigned int hash = serviceType * 2654435761u + sourceId;
+			for(int i = 0; i < Capacity; i++)
+			{
+				Entry* entry = &entries[(hash + i) & (Capacity - 1)];
+				if(!entry->used)
+				{
+					if(!insert) return NULL;
+					entry->serviceType = serviceType;
+					entry->sourceId = sourceId;
+					OMICRON_CONNECTOR_BARRIER();
+					entry->used = 1;
+					return entry;
+				}
+				OMICRON_CONNECTOR_BARRIER();
+				if(entry->serviceType == serviceType && entry->sourceId == sourceId) return entry;
+			}
+			return NULL;
+		}
+
+	private:
+		Entry entries[Capacity];
+		unsigned int overflows;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! A bounded event queue, with a single writer thread and a single reader thread. When the 
+	//! queue is full new events are dropped, and counted as overruns.
+	class EventQueue
+	{
+	public:
+		static const int Capacity = 128;
+
+		EventQueue(): head(0), tail(0), overruns(0) {}
+
+		unsigned int getOverruns() { return overruns; }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Adds an event to the queue (writer side).
+		inline bool push(const EventData& ed)
+		{
+			unsigned int position = head;
+			if(position - tail == (unsigned int)Capacity)
+			{
+				overruns++;
+				return false;
+			}
+			copyEventData(events[position % Capacity], ed);
+			OMICRON_CONNECTOR_BARRIER();
+			head = position + 1;
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns the oldest queued events (reader side), as a contiguous span of at most count 
+		//! events. The events stay valid until they are released by pop.
+		inline const EventData* peek(int& count)
+		{
+			unsigned int position = tail;
+			count = (int)(head - position);
+			OMICRON_CONNECTOR_BARRIER();
+			int end = Capacity - (int)(position % Capacity);
+			if(count > end) count = end;
+			return &events[position % Capacity];
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Releases the count oldest events (reader side).
+		inline void pop(int count)
+		{
+			OMICRON_CONNECTOR_BARRIER();
+			tail = tail + count;
+		}
+
+	private:
+		EventData events[Capacity];
+		// Number of events written and read so far.
+		volatile unsigned int head;
+		volatile unsigned int tail;
+		unsigned int overruns;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! A pose sample: position and orientation (w, x, y, z) at a local time (microseconds, see 
+	//! OmicronConnectorClient::getTime).
+	struct Pose
+	{
+		unsigned long long time;
+		float position[3];
+		float orientation[4];
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! Smooths the poses of tracked sources (head, wand, mocap bodies) for rendering. Events are 
+	//! added with their capture time on the local clock, and kept in a short history per (service 
+	//! type, source id). getPose returns the pose at the query time minus a playout delay, 
+	//! interpolated between the two closest samples (lerp for positions, slerp for orientations),
+	//! so that poses move smoothly and all sources are sampled at the same time, regardless of 
+	//! the network jitter. Typical use, with a polled client:
+	//!		void onEvent(const EventData& ed) { jitter.add(ed, client.getEventLocalTime(ed), OmicronConnectorClient::getTime()); }
+	//!		...
+	//!		client.poll();
+	//!		jitter.getPose(EventData::ServiceTypeMocap, headId, OmicronConnectorClient::getTime(), headPose);
+	//! The playout delay adapts to the observed jitter: it is the time a sample takes to become 
+	//! interpolable (the time between its capture and the arrival of the next sample), averaged
+	//! with its mean deviation like a TCP retransmission timeout. The delay grows at once and 
+	//! shrinks slowly, and is the same for all sources. Not thread safe.
+	class PoseJitterBuffer
+	{
+	public:
+		//! Maximum number of (service type, source id) pairs, and samples kept for each one.
+		static const int MaxSources = 64;
+		static const int MaxSamples = 32;
+		//! Sources not updated for this long do not affect the playout delay (microseconds).
+		static const int SourceTimeout = 1000000;
+
+		PoseJitterBuffer(): numSources(0), minDelay(2000), maxDelay(100000), playoutDelay(2000) {}
+
+		//! Sets the range of the playout delay, in milliseconds. Setting the same minimum and 
+		//! maximum delay disables adaptation. The default range is 2 to 100 milliseconds.
+		void setPlayoutDelay(float minMs, float maxMs = -1)
+		{
+			minDelay = minMs * 1000;
+			maxDelay = maxMs < minMs ? minDelay : maxMs * 1000;
+			playoutDelay = minDelay;
+		}
+		//! Returns the current playout delay, in milliseconds.
+		float getPlayoutDelay() { return (float)(playoutDelay / 1000); }
+		int getNumSources() { return numSources; }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Adds the pose of an event. captureTime is the event creation time on the local clock 
+		//! (see OmicronConnectorClient::getEventLocalTime), arrivalTime the current local time.
+		inline void add(const EventData& ed, unsigned long long captureTime, unsigned long long arrivalTime)
+		{
+			Source* source = find(ed.serviceType, ed.sourceId, true);
+			if(source == NULL) return;
+
+			// Keep samples sorted by capture time. Samples older than the 
+			// whole history are dropped.
+			int count = source->count < MaxSamples ? source->count : MaxSamples;
+			int i = 0;
+			while(i < count && getSample(source, i).time > captureTime) i++;
+			if(i < count && getSample(source, i).time == captureTime) return;
+			if(i == MaxSamples) return;
+
+			if(i == 0 && count > 0)
+			{
+				// In order sample: the previous one became interpolable now.
+				updateDelay(source, (double)(long long)(arrivalTime - getSample(source, 0).time), arrivalTime);
+			}
+
+			// Shift the newer samples to make room.
+			source->head = (source->head + 1) % MaxSamples;
+			if(source->count < MaxSamples) source->count++;
+			for(int j = 0; j < i; j++) getSample(source, j) = getSample(source, j + 1);
+
+			Pose& pose = getSample(source, i);
+			pose.time = captureTime;
+			pose.position[0] = ed.posx;
+			pose.position[1] = ed.posy;
+			pose.position[2] = ed.posz;
+			pose.orientation[0] = ed.orw;
+			pose.orientation[1] = ed.orx;
+			pose.orientation[2] = ed.ory;
+			pose.orientation[3] = ed.orz;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns the pose of a source at localTime minus the playout delay. Returns false if no
+		//! pose has been added for the source.
+		inline bool getPose(unsigned int serviceType, unsigned int sourceId, unsigned long long localTime, Pose& pose)
+		{
+			return getPoseAt(serviceType, sourceId, localTime - (unsigned long long)playoutDelay, pose);
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Returns the pose of a source at the specified local time, without playout delay. Poses
+		//! are not extrapolated: times past the newest sample return the newest sample, and times
+		//! before the oldest sample the oldest one.
+		inline bool getPoseAt(unsigned int serviceType, unsigned int sourceId, unsigned long long time, Pose& pose)
+		{
+			Source* source = find(serviceType, sourceId, false);
+			if(source == NULL || source->count == 0) return false;
+
+			int count = source->count < MaxSamples ? source->count : MaxSamples;
+			int i = 0;
+			while(i < count && getSample(source, i).time > time) i++;
+			if(i == 0 || i == count)
+			{
+				pose = getSample(source, i == 0 ? 0 : count - 1);
+				pose.time = time;
+				return true;
+			}
+
+			const Pose& p0 = getSample(source, i);
+			const Pose& p1 = getSample(source, i - 1);
+			float t = (float)(time - p0.time) / (float)(p1.time - p0.time);
+			for(int k = 0; k < 3; k++) pose.position[k] = p0.position[k] + (p1.position[k] - p0.position[k]) * t;
+			slerp(p0.orientation, p1.orientation, t, pose.orientation);
+			pose.time = time;
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		//! Spherical linear interpolation of the unit quaternions a and b (w, x, y, z).
+		static inline void slerp(const float* a, const float* b, float t, float* out)
+		{
+			// Take the shortest path.
+			double cosom = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+			double sign = 1;
+			if(cosom < 0)
+			{
+				cosom = -cosom;
+				sign = -1;
+			}
+			double s0, s1;
+			if(cosom > 0.9995)
+			{
+				// Nearly identical orientations: normalized lerp.
+				s0 = 1 - t;
+				s1 = t;
+			}
+			else
+			{
+				double omega = acos(cosom);
+				double sinom = sin(omega);
+				s0 = sin((1 - t) * omega) / sinom;
+				s1 = sin(t * omega) / sinom;
+			}
+			s1 *= sign;
+			double q[4];
+			double norm = 0;
+			for(int k = 0; k < 4; k++)
+			{
+				q[k] = s0 * a[k] + s1 * b[k];
+				norm += q[k] * q[k];
+			}
+			norm = norm > 0 ? 1 / sqrt(norm) : 0;
+			for(int k = 0; k < 4; k++) out[k] = (float)(q[k] * norm);
+		}
+
+	private:
+		struct Source
+		{
+			unsigned int serviceType;
+			unsigned int sourceId;
+			// Sample history: a ring with the newest sample at head.
+			Pose samples[MaxSamples];
+			int head;
+			int count;
+			// Time between the capture of a sample and the arrival of the 
+			// next one: smoothed value and mean deviation (microseconds).
+			double hold;
+			double holdDeviation;
+			unsigned long long lastArrival;
+		};
+
+		// Returns the index-th newest sample of a source.
+		inline Pose& getSample(Source* source, int index) 
+		{ return source->samples[(source->head - index + MaxSamples) % MaxSamples]; }
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline Source* find(unsigned int serviceType, unsigned int sourceId, bool insert)
+		{
+			for(int i = 0; i < numSources; i++)
+			{
+				if(sources[i].serviceType == serviceType && sources[i].sourceId == sourceId) return &sources[i];
+			}
+			if(!insert || numSources == MaxSources) return NULL;
+			Source* source = &sources[numSources++];
+			memset(source, 0, sizeof(Source));
+			source->serviceType = serviceType;
+			source->sourceId = sourceId;
+			source->hold = -1;
+			return source;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////
+		inline void updateDelay(Source* source, double hold, unsigned long long now)
+		{
+			source->lastArrival = now;
+			if(source->hold < 0)
+			{
+				source->hold = hold;
+				source->holdDeviation = hold / 2;
+			}
+			else
+			{
+				double deviation = hold > source->hold ? hold - source->hold : source->hold - hold;
+				source->holdDeviation += (deviation - source->holdDeviation) / 4;
+				source->hold += (hold - source->hold) / 8;
+			}
+			if(minDelay == maxDelay) return;
+
+			// The delay covers the slowest active source.
+			double target = 0;
+			for(int i = 0; i < numSources; i++)
+			{
+				Source& s = sources[i];
+				if(s.hold < 0 || now - s.lastArrival > (unsigned long long)SourceTimeout) continue;
+				double sourceTarget = s.hold + 4 * s.holdDeviation;
+				if(sourceTarget > target) target = sourceTarget;
+			}
+			if(target < minDelay) target = minDelay;
+			if(target > maxDelay) target = maxDelay;
+
+			// Grow at once to avoid starving, shrink slowly to avoid jumps.
+			if(target > playoutDelay) playoutDelay = target;
+			else playoutDelay += (target - playoutDelay) / 64;
+		}
+
+	private:
+		Source sources[MaxSources];
+		int numSources;
+		// Playout delay and its range (microseconds).
+		double minDelay;
+		double maxDelay;
+		double playoutDelay;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	class IOmicronConnectorClientListener
+	{
+	public:
+		virtual ~IOmicronConnectorClientListener() {}
+		virtual void onEvent(const EventData& e) = 0;
+		//! Called with each event in the standard encoding (see EventLayout), before it is decoded.
+		//! Returning true consumes the event: onEvent is not called. Used to relay events without
+		//! decoding and encoding them again. Compact events are always decoded.
+		virtual bool onEventPacket(const char* /*packet*/, int /*size*/) { return false; }
+		//! Called with the events decoded by a OmicronConnectorClient::poll call, in order, in 
+		//! batches of up to OmicronConnectorClient::EventBatchSize events. The default 
+		//! implementation calls onEvent for each event. Events consumed by onEventPacket are not
+		//! batched, and can be handled before events of the pending batch.
+		virtual void onEvents(const EventData* events, int count) 
+		{
+			for(int i = 0; i < count; i++) onEvent(events[i]);
+		}
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//! Datagram statistics, computed by the client from the frame sequence numbers.
+	struct PacketStats
+	{
+		//! Number of frames received, duplicates excluded.
+		unsigned int received;
+		//! Number of frames that did not arrive. Frames arriving late are not counted as lost.
+		unsigned int lost;
+		//! Number of frames received after a frame with a higher sequence number.
+		unsigned int reordered;
+		//! Number of frames received more than once. Duplicates are discarded.
+		unsigned int duplicated;
+		//! Number of reliable frames received after a retransmission.
+		unsigned int recovered;
+		//! Number of reliable frames that were given up on (see OmicronConnectorClient::setReliableMode).
+		unsigned int abandoned;
+		//! Number of compact events dropped because their keyframe was not received.
+		unsigned int undecodable;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	class OmicronConnectorClient
+	{
+	public:
+		OmicronConnectorClient(IOmicronConnectorClientListener* clistener): 
+			RecvSocket(INVALID_SOCKET), readyToReceive(false), batchMode(true), multicastMode(false), 
+			sequenceMode(true), reliableMode(true), sharedMemoryMode(false), compactMode(false), 
+			compactActive(false), predictionLead(0), predictionLeadActive(0), timeSyncMode(true), 
+			timeSyncActive(false), eventBatchLength(0), stateTable(NULL), discreteQueue(NULL), 
+			receiverRunning(false), receiverStop(false), listener(clistener)
+		{
+			memset(&lastFrameHeader, 0, sizeof(lastFrameHeader));
+			handshakeAck[0] = '\0';
+			multicastGroup[0] = '\0';
+			resetPacketStats();
+			eventBatch = new EventData[EventBatchSize];
+		#ifdef OMICRON_CONNECTOR_RECVMMSG
+			recvBatch = new char[RecvBatchSize * FrameHeader::MaxFrameSize];
+			memset(recvBatchHeaders, 0, sizeof(recvBatchHeaders));
+			for(int i = 0; i < RecvBatchSize; i++)
+			{
+				recvBatchVectors[i].iov_base = &recvBatch[i * FrameHeader::MaxFrameSize];
+				recvBatchVectors[i].iov_len = FrameHeader::MaxFrameSize;
+				recvBatchHeaders[i].msg_hdr.msg_iov = &recvBatchVectors[i];
+				recvBatchHeaders[i].msg_hdr.msg_iovlen = 1;
+			}
+		#endif
+		}
+
+		~OmicronConnectorClient()
+		{
+			stopReceiver();
+			delete stateTable;
+			delete discreteQueue;
+			delete[] eventBatch;
+		#ifdef OMICRON_CONNECTOR_RECVMMSG
+			delete[] recvBatch;
+		#endif
+		}
+
+		void connect(const char* server, int port = 27000, int dataPort = 7000);
+		void poll();
+		void dispose();
+
+		//! Starts a thread that receives events continuously, so that the latest event of each
+		//! source can be read at any time with getLatestEvent, without calling poll (i.e. once
+		//! per frame from a render loop). While the receiver runs, poll does not read from the 
+		//! network: it delivers the discrete events (see OutputPolicy::isContinuous) queued by 
+		//! the receiver thread to the listener. Continuous events only update the latest event 
+		//! table. onEventPacket is called on the receiver thread. Clock and statistics accessors
+		//! return values updated by the receiver thread. Must be called after connect.
+		bool startReceiver();
+		void stopReceiver();
+		bool isReceiverRunning() { return receiverRunning; }
+		//! Copies the latest event received from a source to ed. Can be called from any thread
+		//! while the receiver runs. Returns false if no event has been received from the source,
+		//! or if the receiver is not running.
+		bool getLatestEvent(unsigned int serviceType, unsigned int sourceId, EventData& ed)
+		{ return stateTable != NULL && stateTable->read(serviceType, sourceId, ed); }
+		//! Returns the number of discrete events dropped because poll was not called often 
+		//! enough while the receiver runs.
+		unsigned int getReceiverOverruns() { return discreteQueue != NULL ? discreteQueue->getOverruns() : 0; }
+		void setDataport(int);
+		//! Returns the socket event data is received on, or INVALID_SOCKET if
+		//! the client is not connected. Can be used to wait for incoming 
+		//! data with select, epoll and the like, and call poll only when needed.
+		SOCKET getDataSocket() { return readyToReceive ? RecvSocket : INVALID_SOCKET; }
+		//! When enabled (the default), asks the server to pack multiple events
+		//! in each datagram. Servers that do not support batch mode keep 
+		//! sending one event per datagram. Must be called before connect.
+		void setBatchMode(bool value) { batchMode = value; }
+		bool isBatchMode() { return batchMode; }
+		//! Returns the header of the last event frame received (reliable frames excluded).
+		const FrameHeader& getLastFrameHeader() { return lastFrameHeader; }
+		//! When enabled, asks the server to send events through its multicast
+		//! group, and joins the group. If the server does not support 
+		//! multicast, events are received on the data port as usual. Must be
+		//! called before connect.
+		void setMulticastMode(bool value) { multicastMode = value; }
+		//! Returns true if the client joined the server multicast group.
+		bool isMulticastJoined() { return multicastGroup[0] != '\0'; }
+		//! Returns the client subscription. The server only sends events 
+		//! accepted by the filter. Must be modified before connect. 
+		//! Servers that do not support subscriptions send all events, and so
+		//! does the multicast group.
+		EventFilter& getEventFilter() { return eventFilter; }
+		//! Returns the client output policy, used to ask the server for a 
+		//! lower event rate (i.e. on slow wireless links). Must be modified 
+		//! before connect. Ignored by multicast groups.
+		OutputPolicy& getOutputPolicy() { return outputPolicy; }
+		//! When enabled (the default), asks the server to send sequence 
+		//! numbers in single event mode too: each event is sent as a frame
+		//! containing a single event. Batch mode frames always have sequence
+		//! numbers. Must be called before connect.
+		void setSequenceMode(bool value) { sequenceMode = value; }
+		//! When enabled (the default), asks the server to send discrete 
+		//! events (Down, Up, Trace, Untrace, pointer info) on the reliable 
+		//! lane: the client acknowledges them through the server connection,
+		//! and the server retransmits lost ones. Discrete events are delivered
+		//! in order. Missing events block the following discrete events (never
+		//! continuous ones) until they arrive, or for at most 
+		//! ReliableGiveUpTime microseconds. Must be called before connect.
+		void setReliableMode(bool value) { reliableMode = value; }
+		//! Returns true if the server acknowledged the reliable lane.
+		bool isReliable() { return reliableActive; }
+		//! When enabled, clients running on the same machine as the server
+		//! read events from the server shared memory ring instead of 
+		//! receiving datagrams, without any system call per event. Clients
+		//! on other machines, or that can't open the ring, use the network 
+		//! as usual. In shared memory mode getDataSocket returns 
+		//! INVALID_SOCKET: the client should be polled periodically. 
+		//! Only available on linux. Must be called before connect.
+		void setSharedMemoryMode(bool value) { sharedMemoryMode = value; }
+		//! Returns true if events are read from shared memory.
+		bool isSharedMemoryAttached() 
+		{ 
+		#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+			return sharedRing.isOpen(); 
+		#else
+			return false;
+		#endif
+		}
+		//! When enabled, asks the server to use the compact encoding for 
+		//! continuous events (see CompactCodec): quantized positions and
+		//! orientations, sent as deltas against per source keyframes. Cuts
+		//! the bandwidth of mocap and skeleton streams, at the cost of
+		//! fixed point precision (1mm by default). Requires the reliable 
+		//! lane, used to send keyframes. Must be called before connect.
+		void setCompactMode(bool value) { compactMode = value; }
+		//! Returns true if the server acknowledged the compact encoding.
+		bool isCompact() { return compactActive; }
+		//! Asks the server to extrapolate the pose of mocap and wand events
+		//! leadMs milliseconds past the time they are sent, to compensate the
+		//! network and rendering latency. Predicted events still carry the 
+		//! measured pose (see EventData::predictionLead). 0 (the default) 
+		//! disables prediction. Predicted clients do not use the compact 
+		//! encoding. Must be called before connect.
+		void setPredictionLead(float leadMs) { predictionLead = (int)(leadMs * 1000); }
+		//! Returns the prediction lead time accepted by the server, in 
+		//! microseconds. The server may reduce the requested lead time.
+		int getPredictionLead() { return predictionLeadActive; }
+		//! When enabled (the default), the client estimates the offset and
+		//! drift between its clock and the server clock, exchanging time
+		//! stamps with the server through the server connection (see 
+		//! getEventAge). Must be called before connect.
+		void setTimeSyncMode(bool value) { timeSyncMode = value; }
+		//! Returns true once the clock offset has been estimated.
+		bool isTimeSynchronized() { return timeSyncSamples > 0; }
+		//! Returns the estimated server clock - local clock offset, in 
+		//! microseconds, at the specified local time (see getTime).
+		long long getClockOffset(unsigned long long localTime);
+		//! Returns the estimated server clock drift, in microseconds per second.
+		double getClockDrift() { return clockDrift * 1000000; }
+		//! Returns the round trip time of the best recent time sync exchange, in microseconds.
+		long long getRoundTripTime() { return clockDelay; }
+		//! Converts a server time (i.e. EventData::time) to local time (see getTime).
+		unsigned long long serverToLocalTime(unsigned long long serverTime);
+		//! Returns the time elapsed since the event was created on the server, in microseconds.
+		//! Returns 0 if the clocks are not synchronized yet, or the server did not send the 
+		//! event time.
+		long long getEventAge(const EventData& evt);
+		//! Returns the time the event was created on the server, on the local clock (see getTime),
+		//! or the current time if the clocks are not synchronized yet or the server did not send 
+		//! the event time. Used to add events to a PoseJitterBuffer.
+		unsigned long long getEventLocalTime(const EventData& evt)
+		{ return isTimeSynchronized() && evt.time != 0 ? serverToLocalTime(evt.time) : getTime(); }
+		//! Local clock used by the client, in microseconds. Monotonic: not affected by wall clock
+		//! changes.
+		static unsigned long long getTime();
+		//! Returns the datagram statistics, computed from frame sequence 
+		//! numbers. Single event datagrams from servers that do not support
+		//! sequence numbers are not counted.
+		const PacketStats& getPacketStats() { return packetStats; }
+		void resetPacketStats() 
+		{ 
+			memset(&packetStats, 0, sizeof(packetStats)); 
+			hasSequence = false;
+			highestSequence = 0;
+			sequenceWindow = 0;
+		}
+
+		// Size of the reliable frame reorder window, and size of each frame slot.
+		static const int ReliableWindow = 64;
+		static const int ReliableSlotSize = 640;
+		// Time after which missing reliable frames are given up on (microseconds).
+		static const int ReliableGiveUpTime = 2000000;
+		// Number of time sync exchanges used for the clock estimate, and 
+		// time between exchanges (microseconds). The first TimeSyncWindow / 2
+		// exchanges are done TimeSyncStartInterval apart, to get a first 
+		// estimate quickly.
+		static const int TimeSyncWindow = 16;
+		static const int TimeSyncInterval = 1000000;
+		static const int TimeSyncStartInterval = 50000;
+		// Minimum time span of the samples used to estimate the drift (microseconds).
+		static const int TimeSyncDriftSpan = 8000000;
+		// Maximum number of events passed to IOmicronConnectorClientListener::onEvents at once.
+		static const int EventBatchSize = 32;
+		// Maximum number of datagrams read by each recvmmsg call.
+		static const int RecvBatchSize = 16;
+		// Maximum time the receiver thread waits for data, so that time sync and the reliable 
+		// lane keep running (microseconds).
+		static const int ReceiverWaitTime = 10000;
+	private:
+		// Clients own buffers and can't be copied.
+		OmicronConnectorClient(const OmicronConnectorClient&);
+		OmicronConnectorClient& operator=(const OmicronConnectorClient&);
+
+		void initHandshake();
+		void openDataSocket(int port);
+		bool readHandshakeAck();
+		bool getHandshakeAckOption(const char* name, char* value, int size);
+		void receive();
+		void parseDGram(int);
+		void receiveBatch();
+		void parseDatagram(const char* buf, int size);
+		EventData& addBatchEvent();
+		void flushEvents();
+		void runReceiver();
+		void waitForData();
+	#ifdef OMICRON_OS_WIN
+		static DWORD WINAPI receiverMain(LPVOID client) { ((OmicronConnectorClient*)client)->runReceiver(); return 0; }
+	#else
+		static void* receiverMain(void* client) { ((OmicronConnectorClient*)client)->runReceiver(); return NULL; }
+	#endif
+		void pollSharedMemory();
+		void parseFrame(const char* buf, int size);
+		bool updateSequence(unsigned int sequence);
+		void parseReliableFrame(const char* buf, int size, unsigned int sequence);
+		void deliverReliableFrames();
+		void skipReliableFrames(unsigned int sequence);
+		void sendReliableMessage(const char* msg, unsigned int sequence, int count);
+		void sendMessage(const char* msg);
+		void updateTimeSync();
+		void readServerMessages();
+		void addTimeSample(unsigned long long t0, unsigned long long t1, unsigned long long t2, unsigned long long t3);
+		void parseEvent(const char* buf, int size);
+		void parseCompactEvent(const char* buf, int size);
+
+	private:
+		//typedef ListenerType Listener;
+
+	#ifdef OMICRON_OS_WIN	
+		WSADATA wsaData;
+	#endif
+
+		SOCKET ConnectSocket;
+		SOCKET RecvSocket;
+		struct timeval timeout;
+		sockaddr_in SenderAddr;
+
+		const char* serverAddress;
+		int serverPort;
+		int dataPort;
+
+		// Large enough for single event datagrams and batch mode frames.
+		char recvbuf[FrameHeader::MaxFrameSize];
+		int iResult, iSendResult;
+
+		int SenderAddrSize;
+		int recvbuflen;
+		bool readyToReceive;
+
+		bool batchMode;
+		FrameHeader lastFrameHeader;
+		bool multicastMode;
+		char multicastGroup[64];
+		EventFilter eventFilter;
+		OutputPolicy outputPolicy;
+
+		// Sequence tracking. Bit n of sequenceWindow is set when frame
+		// highestSequence - n has been received.
+		bool sequenceMode;
+		bool hasSequence;
+		unsigned int highestSequence;
+		unsigned long long sequenceWindow;
+		PacketStats packetStats;
+
+		// Reliable lane. reliableNext is the sequence number of the next 
+		// discrete event to deliver. Frames received ahead of it are kept in
+		// reliableFrames until the missing ones arrive.
+		bool reliableMode;
+		bool reliableActive;
+		bool hasReliableSequence;
+		unsigned int reliableNext;
+		unsigned int reliableAcked;
+		unsigned long long reliableGapTime;
+		char reliableFrames[ReliableWindow][ReliableSlotSize];
+		int reliableLengths[ReliableWindow];
+		unsigned int reliableHighest;
+
+		bool sharedMemoryMode;
+	#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+		SharedEventRing sharedRing;
+	#endif
+
+		// Compact encoding. compactEvent is the decoding buffer.
+		bool compactMode;
+		bool compactActive;
+		CompactCodec compactCodec;
+		CompactKeyTable compactKeys;
+		CompactEvent compactEvent;
+
+		// Requested and acknowledged prediction lead time (microseconds).
+		int predictionLead;
+		int predictionLeadActive;
+
+		// Time sync. Each exchange gives a sample of the clock offset, and 
+		// the round trip delay. The estimate uses the sample with the lowest
+		// delay (clockOffset, measured at clockOffsetTime) and the drift 
+		// computed from all the samples (clockDrift, in us per us).
+		bool timeSyncMode;
+		bool timeSyncActive;
+		unsigned long long timeSyncNext;
+		int timeSyncSamples;
+		long long sampleOffsets[TimeSyncWindow];
+		long long sampleDelays[TimeSyncWindow];
+		unsigned long long sampleTimes[TimeSyncWindow];
+		long long clockOffset;
+		long long clockDelay;
+		unsigned long long clockOffsetTime;
+		double clockDrift;
+		// Server messages received so far.
+		char messageBuffer[256];
+		int messageLength;
+
+		// Handshake options acknowledged by the server.
+		char handshakeAck[256];
+
+		// Events decoded by the current poll call, not delivered yet.
+		EventData* eventBatch;
+		int eventBatchLength;
+	#ifdef OMICRON_CONNECTOR_RECVMMSG
+		// Datagram buffers filled by recvmmsg, MaxFrameSize bytes each.
+		char* recvBatch;
+		struct iovec recvBatchVectors[RecvBatchSize];
+		struct mmsghdr recvBatchHeaders[RecvBatchSize];
+	#endif
+
+		// Receiver thread. Events decoded by the thread go to stateTable, discrete events are 
+		// also queued to discreteQueue until poll delivers them.
+		EventStateTable* stateTable;
+		EventQueue* discreteQueue;
+		volatile bool receiverRunning;
+		volatile bool receiverStop;
+	#ifdef OMICRON_OS_WIN
+		HANDLE receiverThread;
+	#else
+		pthread_t receiverThread;
+	#endif
+
+		IOmicronConnectorClientListener* listener;
+	};
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::connect(const char* server, int port, int pdataPort) 
+	{
+		serverAddress = server;
+		serverPort = port;
+		dataPort = pdataPort;
+		resetPacketStats();
+		reliableActive = false;
+		hasReliableSequence = false;
+		reliableGapTime = 0;
+		memset(reliableLengths, 0, sizeof(reliableLengths));
+		compactActive = false;
+		compactKeys.clear();
+		predictionLeadActive = 0;
+		timeSyncActive = false;
+		timeSyncNext = 0;
+		timeSyncSamples = 0;
+		clockOffset = 0;
+		clockDelay = 0;
+		clockOffsetTime = 0;
+		clockDrift = 0;
+		messageLength = 0;
+
+		char srvPortChr[256];
+		sprintf(srvPortChr, "%d", serverPort);
+
+		SOCKET_INIT();
+
+		struct addrinfo hints, *res;
+
+		// First, load up address structs with getaddrinfo():
+		memset(&hints, 0, sizeof hints);
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		// Get the server address
+		getaddrinfo(serverAddress, srvPortChr, &hints, &res);
+		if(res == NULL)
+		{
+			printf("omicronConnectorClient: Unable to connect to server '%s' on port '%d'", serverAddress, serverPort);
+			PRINT_SOCKET_ERROR("");
+			SOCKET_CLEANUP();
+			return;
+		}
+
+		// Generate the socket
+		ConnectSocket = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+
+		// Connect to server
+		int result = ::connect(ConnectSocket, res->ai_addr, res->ai_addrlen);
+
+		if (result == -1) 
+		{
+			printf("omicronConnectorClient: Unable to connect to server '%s' on port '%d'", serverAddress, serverPort);
+			PRINT_SOCKET_ERROR("");
+			SOCKET_CLEANUP();
+			return;
+		}
+		else
+		{
+			printf("NetService: Connected to server '%s' on port '%d'!\n", serverAddress, serverPort);
+		}
+		initHandshake();
+
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::initHandshake() 
+	{
+		// Handshake options are appended to the data port, separated by spaces: 
+		// older servers read the port with atoi and ignore them.
+		char sendbuf[512];
+		char filterbuf[EventFilter::MaxStringLength];
+		sprintf(sendbuf, "omicron_data_on,%d", dataPort);
+		if(batchMode) strcat(sendbuf, " batch");
+		if(sequenceMode) strcat(sendbuf, " seq");
+		if(reliableMode) strcat(sendbuf, " reliable");
+		if(reliableMode && compactMode) strcat(sendbuf, " compact");
+		if(timeSyncMode) strcat(sendbuf, " time");
+		if(predictionLead > 0) sprintf(&sendbuf[strlen(sendbuf)], " lead=%d", predictionLead);
+	#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+		if(sharedMemoryMode) strcat(sendbuf, " shm");
+	#endif
+		if(multicastMode) strcat(sendbuf, " multicast");
+		eventFilter.toString(filterbuf, sizeof(filterbuf));
+		appendOption(sendbuf, sizeof(sendbuf), filterbuf);
+		outputPolicy.toString(filterbuf, sizeof(filterbuf));
+		appendOption(sendbuf, sizeof(sendbuf), filterbuf);
+		printf("NetService: Sending handshake: '%s'\n", sendbuf);
+
+		// Bind the data socket before sending the handshake: the server sends
+		// events (i.e. the first compact keyframes) as soon as it accepts it.
+		// Multicast clients get their port from the acknowledgement.
+		RecvSocket = INVALID_SOCKET;
+		multicastGroup[0] = '\0';
+		if(!multicastMode) openDataSocket(dataPort);
+
+		iResult = send(ConnectSocket, sendbuf, (int) strlen(sendbuf), 0);
+
+		if (iResult == -1) 
+		{
+			PRINT_SOCKET_ERROR("NetService: Send failed");
+			if(RecvSocket != INVALID_SOCKET) SOCKET_CLOSE(RecvSocket);
+			SOCKET_CLOSE(ConnectSocket);
+			SOCKET_CLEANUP()
+			return;
+		}
+
+		// Get the multicast group address from the server acknowledgement.
+		// Servers that do not support it never answer: after the timeout
+		// events are received on the data port.
+		int recvPort = dataPort;
+		char multicastOption[64];
+		bool acknowledged = (multicastMode || reliableMode || sharedMemoryMode || timeSyncMode || predictionLead > 0) && 
+			readHandshakeAck();
+		char timeOption[4];
+		timeSyncActive = acknowledged && getHandshakeAckOption("time", timeOption, sizeof(timeOption));
+		char leadOption[16];
+		if(acknowledged && getHandshakeAckOption("lead", leadOption, sizeof(leadOption))) 
+			predictionLeadActive = atoi(leadOption);
+
+	#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+		// The server accepted to publish events to us through its shared 
+		// memory ring: no data socket needed.
+		char sharedMemoryOption[64];
+		sharedRing.close();
+		if(sharedMemoryMode && acknowledged &&
+			getHandshakeAckOption("shm", sharedMemoryOption, sizeof(sharedMemoryOption)))
+		{
+			if(RecvSocket != INVALID_SOCKET) 
+			{
+				SOCKET_CLOSE(RecvSocket);
+				RecvSocket = INVALID_SOCKET;
+			}
+			if(sharedRing.open(sharedMemoryOption))
+			{
+				printf("NetService: Reading events from shared memory '%s'\n", sharedMemoryOption);
+				readyToReceive = true;
+				return;
+			}
+
+			// Ask again for network data.
+			printf("NetService: Could not open shared memory '%s', reconnecting\n", sharedMemoryOption);
+			SOCKET_CLOSE(ConnectSocket);
+			sharedMemoryMode = false;
+			connect(serverAddress, serverPort, dataPort);
+			sharedMemoryMode = true;
+			return;
+		}
+	#endif
+
+		// The server sends the sequence number of its next reliable frame.
+		char reliableOption[16];
+		if(acknowledged && getHandshakeAckOption("reliable", reliableOption, sizeof(reliableOption)))
+		{
+			reliableActive = true;
+			hasReliableSequence = true;
+			reliableNext = (unsigned int)strtoul(reliableOption, NULL, 10);
+			reliableAcked = reliableNext;
+			reliableHighest = reliableNext;
+		}
+
+		// The server sends the fixed point scale of compact events.
+		char compactOption[16];
+		if(reliableActive && getHandshakeAckOption("compact", compactOption, sizeof(compactOption)))
+		{
+			compactActive = true;
+			compactCodec.setScale(atoi(compactOption));
+		}
+
+		if(multicastMode && acknowledged &&
+			getHandshakeAckOption("multicast", multicastOption, sizeof(multicastOption)))
+		{
+			char* portSeparator = strchr(multicastOption, ':');
+			if(portSeparator != NULL)
+			{
+				*portSeparator = '\0';
+				strcpy(multicastGroup, multicastOption);
+				recvPort = atoi(portSeparator + 1);
+			}
+		}
+
+		if(RecvSocket == INVALID_SOCKET) openDataSocket(recvPort);
+
+		if(multicastGroup[0] != '\0')
+		{
+			struct ip_mreq mreq;
+			mreq.imr_multiaddr.s_addr = inet_addr(multicastGroup);
+			mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+			if(setsockopt(RecvSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&mreq, sizeof(mreq)) == 0)
+			{
+				printf("NetService: Joined multicast group %s:%d\n", multicastGroup, recvPort);
+			}
+			else
+			{
+				PRINT_SOCKET_ERROR("NetService: Could not join multicast group");
+				multicastGroup[0] = '\0';
+			}
+		}
+		readyToReceive = true;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::openDataSocket(int port) 
+	{
+		sockaddr_in RecvAddr;
+		SenderAddrSize = sizeof(SenderAddr);
+		RecvSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+		// Other clients on this machine may be listening to the same group.
+		if(multicastGroup[0] != '\0')
+		{
+			int reuse = 1;
+			setsockopt(RecvSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+		}
+
+		// Bind the socket to any address and the specified port.
+		RecvAddr.sin_family = AF_INET;
+		RecvAddr.sin_port = htons(port);
+		RecvAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+		::bind(RecvSocket, (const sockaddr*) &RecvAddr, sizeof(RecvAddr));
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline bool OmicronConnectorClient::readHandshakeAck() 
+	{
+		// Wait for the server to acknowledge the handshake options. The 
+		// acknowledgement is a single line: 'omicron_data_ack' followed by the
+		// accepted options, separated by spaces.
+		fd_set ReadFDs;
+		FD_ZERO(&ReadFDs);
+		FD_SET(ConnectSocket, &ReadFDs);
+		timeout.tv_sec  = 1;
+		timeout.tv_usec = 0;
+
+		int len = 0;
+		while(len < (int)sizeof(handshakeAck) - 1 && 
+			select(ConnectSocket + 1, &ReadFDs, NULL, NULL, &timeout) > 0)
+		{
+			int result = recv(ConnectSocket, &handshakeAck[len], 1, 0);
+			if(result <= 0 || handshakeAck[len] == '\n') break;
+			len++;
+		}
+		handshakeAck[len] = '\0';
+
+		if(strncmp(handshakeAck, "omicron_data_ack", 16) != 0)
+		{
+			printf("NetService: Server did not acknowledge handshake options\n");
+			handshakeAck[0] = '\0';
+			return false;
+		}
+		return true;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline bool OmicronConnectorClient::getHandshakeAckOption(const char* name, char* value, int size) 
+	{
+		// Options are in the 'name' or 'name=value' form.
+		int nameLen = (int)strlen(name);
+		const char* opt = strchr(handshakeAck, ' ');
+		while(opt != NULL)
+		{
+			opt++;
+			if(strncmp(opt, name, nameLen) == 0 && 
+				(opt[nameLen] == '=' || opt[nameLen] == ' ' || opt[nameLen] == '\0'))
+			{
+				int len = 0;
+				if(opt[nameLen] == '=')
+				{
+					const char* val = &opt[nameLen + 1];
+					while(val[len] != ' ' && val[len] != '\0' && len < size - 1) 
+					{
+						value[len] = val[len];
+						len++;
+					}
+				}
+				value[len] = '\0';
+				return true;
+			}
+			opt = strchr(opt, ' ');
+		}
+		return false;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::poll()
+	{
+		if(receiverRunning)
+		{
+			// Deliver the discrete events queued by the receiver thread.
+			while(true)
+			{
+				int count;
+				const EventData* events = discreteQueue->peek(count);
+				if(count == 0) break;
+				listener->onEvents(events, count);
+				discreteQueue->pop(count);
+			}
+			return;
+		}
+		receive();
+		flushEvents();
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::receive()
+	{
+		if(readyToReceive && timeSyncActive) updateTimeSync();
+	#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+		if(readyToReceive && sharedRing.isOpen())
+		{
+			pollSharedMemory();
+			return;
+		}
+	#endif
+		if(readyToReceive)
+		{
+		#ifdef OMICRON_CONNECTOR_RECVMMSG
+			receiveBatch();
+		#else
+			int result;
+
+			// Create a set of fd_set to store sockets
+			fd_set ReadFDs, WriteFDs, ExceptFDs;
+
+			// Set collections to null
+			FD_ZERO(&ReadFDs);
+			FD_ZERO(&WriteFDs);
+			FD_ZERO(&ExceptFDs);
+
+			FD_SET(RecvSocket, &ReadFDs);
+			FD_SET(RecvSocket, &ExceptFDs);
+
+			timeout.tv_sec  = 0;
+			timeout.tv_usec = 0;
+
+			do
+			{
+				// Check if UDP socket has data waiting to be read before socket blocks to attempt to read.
+				result = select(RecvSocket+1, &ReadFDs, &WriteFDs, &ExceptFDs, &timeout);
+				if( result > 0 ) parseDGram(result);
+			} while(result > 0);
+		#endif
+
+			if(reliableActive)
+			{
+				if(!timeSyncActive) readServerMessages();
+				// Give up on missing reliable frames after a while, so a
+				// lost frame does not block discrete events forever.
+				if(reliableGapTime != 0 && getTime() - reliableGapTime > ReliableGiveUpTime)
+				{
+					printf("NetService: Reliable frame %u lost\n", reliableNext);
+					// Skip at least enough frames to buffer the latest one seen.
+					unsigned int skipTo = reliableNext + 1;
+					if((int)(reliableHighest - reliableNext) >= ReliableWindow) 
+						skipTo = reliableHighest - ReliableWindow + 1;
+					skipReliableFrames(skipTo);
+					deliverReliableFrames();
+				}
+				// Acknowledge the discrete events delivered so far.
+				if(reliableAcked != reliableNext)
+				{
+					sendReliableMessage("omicron_ack", reliableNext, 1);
+					reliableAcked = reliableNext;
+				}
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline bool OmicronConnectorClient::startReceiver()
+	{
+		if(receiverRunning) return true;
+		if(!readyToReceive) return false;
+
+		if(stateTable == NULL) stateTable = new EventStateTable();
+		if(discreteQueue == NULL) discreteQueue = new EventQueue();
+		// Events decoded by the last poll have been delivered already.
+		receiverStop = false;
+		receiverRunning = true;
+	#ifdef OMICRON_OS_WIN
+		receiverThread = CreateThread(NULL, 0, receiverMain, this, 0, NULL);
+		if(receiverThread == NULL)
+	#else
+		if(pthread_create(&receiverThread, NULL, receiverMain, this) != 0)
+	#endif
+		{
+			printf("NetService: Could not start the receiver thread\n");
+			receiverRunning = false;
+			return false;
+		}
+		return true;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::stopReceiver()
+	{
+		if(!receiverRunning) return;
+		receiverStop = true;
+	#ifdef OMICRON_OS_WIN
+		WaitForSingleObject(receiverThread, INFINITE);
+		CloseHandle(receiverThread);
+	#else
+		pthread_join(receiverThread, NULL);
+	#endif
+		// Deliver the discrete events still queued.
+		poll();
+		receiverRunning = false;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::runReceiver()
+	{
+		while(!receiverStop)
+		{
+			waitForData();
+			receive();
+			flushEvents();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::waitForData()
+	{
+	#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+		// The shared memory ring can't be waited on.
+		if(sharedRing.isOpen())
+		{
+			usleep(1000);
+			return;
+		}
+	#endif
+		fd_set ReadFDs;
+		FD_ZERO(&ReadFDs);
+		FD_SET(RecvSocket, &ReadFDs);
+		struct timeval wait;
+		wait.tv_sec = 0;
+		wait.tv_usec = ReceiverWaitTime;
+		select(RecvSocket + 1, &ReadFDs, NULL, NULL, &wait);
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::dispose() 
+	{
+		stopReceiver();
+	#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+		if(sharedRing.isOpen())
+		{
+			printf("NetService: Finished reading from shared memory.\n");
+			sharedRing.close();
+			readyToReceive = false;
+			return;
+		}
+	#endif
+		// Close the socket when finished receiving datagrams
+		printf("NetService: Finished receiving. Closing socket.\n");
+		iResult = SOCKET_CLOSE(RecvSocket);
+		if (iResult == -1) 
+		{
+			PRINT_SOCKET_ERROR("NetService: Closesocket failed");
+			return;
+		}
+		SOCKET_CLEANUP();
+		printf("NetService: Shutting down.");
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::pollSharedMemory()
+	{
+	#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+		// The ring contains single event datagrams for all the events: the 
+		// subscription is applied here.
+		int length;
+		while((length = sharedRing.read(recvbuf, sizeof(recvbuf))) > 0)
+		{
+			packetStats.received++;
+			if(length < EventLayout::HeaderSize) continue;
+			if(!eventFilter.isEmpty())
+			{
+				EventView view(recvbuf, length);
+				unsigned int sourceId = view.getSourceId();
+				unsigned int serviceType = view.getServiceType();
+				unsigned int type = view.getType();
+				if(!eventFilter.accepts(serviceType, type, sourceId)) continue;
+			}
+			parseEvent(recvbuf, length);
+		}
+		packetStats.lost = sharedRing.getOverruns();
+	#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::parseDGram(int result)
+	{
+		result = recvfrom(RecvSocket, 
+			recvbuf,
+			FrameHeader::MaxFrameSize,
+			0,
+			(sockaddr *)&SenderAddr, 
+			(socklen_t*)&SenderAddrSize);
+		if(result > 0)
+		{
+			parseDatagram(recvbuf, result);
+		} 
+		else 
+		{
+			PRINT_SOCKET_ERROR("recvfrom failed");
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::receiveBatch()
+	{
+	#ifdef OMICRON_CONNECTOR_RECVMMSG
+		// Drain the socket, reading up to RecvBatchSize datagrams per system
+		// call, without waiting for data.
+		int count;
+		do
+		{
+			count = recvmmsg(RecvSocket, recvBatchHeaders, RecvBatchSize, MSG_DONTWAIT, NULL);
+			for(int i = 0; i < count; i++)
+			{
+				parseDatagram(&recvBatch[i * FrameHeader::MaxFrameSize], recvBatchHeaders[i].msg_len);
+			}
+		} while(count == RecvBatchSize);
+
+		if(count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			PRINT_SOCKET_ERROR("recvmmsg failed");
+		}
+	#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::parseDatagram(const char* buf, int size)
+	{
+		// Batch mode frames start with the frame tag, single event 
+		// datagrams with the event timestamp.
+		if(size >= FrameHeader::Size && FrameLayout::Tag::read(buf) == FrameHeader::Tag)
+		{
+			parseFrame(buf, size);
+		}
+		else
+		{
+			parseEvent(buf, size);
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::parseFrame(const char* buf, int size)
+	{
+		FrameHeader header;
+		FrameLayout::read(buf, header);
+		int offset = FrameLayout::Size;
+
+		if(header.flags & FrameHeader::FlagReliable)
+		{
+			parseReliableFrame(buf, size, header.sequence);
+			return;
+		}
+
+		if(!updateSequence(header.sequence)) return;
+		lastFrameHeader = header;
+		bool compact = (header.flags & FrameHeader::FlagCompact) != 0;
+
+		for(int i = 0; i < header.eventCount; i++)
+		{
+			if(offset + FrameLayout::EventSize::End > size) break;
+			unsigned short eventSize = FrameLayout::EventSize::read(&buf[offset]);
+			offset += FrameLayout::EventSize::End;
+			// Discard truncated frames.
+			if(offset + eventSize > size) break;
+			if(compact) parseCompactEvent(&buf[offset], eventSize);
+			else parseEvent(&buf[offset], eventSize);
+			offset += eventSize;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline bool OmicronConnectorClient::updateSequence(unsigned int sequence)
+	{
+		// Sequence jumps larger than this are considered a stream restart 
+		// (i.e. the server restarted, or the client handshake changed).
+		const int maxSequenceGap = 4096;
+
+		int delta = (int)(sequence - highestSequence);
+		if(!hasSequence || delta > maxSequenceGap || delta < -maxSequenceGap)
+		{
+			hasSequence = true;
+			highestSequence = sequence;
+			sequenceWindow = 1;
+		}
+		else if(delta > 0)
+		{
+			// Frames between the last one and this one are missing.
+			packetStats.lost += delta - 1;
+			sequenceWindow = delta < 64 ? (sequenceWindow << delta) | 1 : 1;
+			highestSequence = sequence;
+		}
+		else
+		{
+			// An old frame: either a duplicate or a frame arriving late.
+			int age = -delta;
+			if(age < 64)
+			{
+				unsigned long long bit = 1ULL << age;
+				if(sequenceWindow & bit)
+				{
+					packetStats.duplicated++;
+					return false;
+				}
+				sequenceWindow |= bit;
+				if(packetStats.lost > 0) packetStats.lost--;
+			}
+			packetStats.reordered++;
+		}
+		packetStats.received++;
+		return true;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::parseReliableFrame(const char* buf, int size, unsigned int sequence)
+	{
+		if(!hasReliableSequence)
+		{
+			hasReliableSequence = true;
+			reliableNext = sequence;
+			reliableHighest = sequence;
+		}
+
+		int delta = (int)(sequence - reliableNext);
+		// Already delivered.
+		if(delta < 0) return;
+
+		// Clients that did not ask for the reliable lane (i.e. sharing a 
+		// multicast group with reliable clients) do not wait for missing
+		// frames.
+		if(!reliableActive)
+		{
+			if(delta > 0) packetStats.abandoned += delta;
+			reliableNext = sequence;
+		}
+		// Too far ahead to be buffered (i.e. a burst of keyframes sent before
+		// the data socket was open): drop the frame and ask for the missing 
+		// ones. The server retransmits unacknowledged frames, dropped ones 
+		// included, and the give up timer skips the frames really lost.
+		else if(delta >= ReliableWindow)
+		{
+			if((int)(sequence - reliableHighest) > 0) reliableHighest = sequence;
+			if(reliableGapTime == 0)
+			{
+				reliableGapTime = getTime();
+				sendReliableMessage("omicron_nack", reliableNext, ReliableWindow);
+			}
+			return;
+		}
+
+		if(size > ReliableSlotSize) return;
+		int slot = sequence % ReliableWindow;
+		if(reliableLengths[slot] != 0) return;
+		memcpy(reliableFrames[slot], buf, size);
+		reliableLengths[slot] = size;
+
+		// Frames arriving after later ones have been retransmitted (or 
+		// reordered by the network).
+		if((int)(sequence - reliableHighest) < 0) packetStats.recovered++;
+		else reliableHighest = sequence;
+
+		if(sequence != reliableNext)
+		{
+			// Frames are missing: ask the server for them right away. The
+			// server also retransmits unacknowledged frames on its own.
+			if(reliableGapTime == 0)
+			{
+				reliableGapTime = getTime();
+				sendReliableMessage("omicron_nack", reliableNext, (int)(sequence - reliableNext));
+			}
+			return;
+		}
+		deliverReliableFrames();
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::skipReliableFrames(unsigned int sequence)
+	{
+		// Deliver the frames received before sequence, skipping the missing ones. Delivering
+		// stops at the first missing frame, which may be past sequence.
+		while((int)(sequence - reliableNext) > 0)
+		{
+			int slot = reliableNext % ReliableWindow;
+			if(reliableLengths[slot] != 0) deliverReliableFrames();
+			else
+			{
+				packetStats.abandoned++;
+				reliableNext++;
+			}
+		}
+		reliableGapTime = 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::deliverReliableFrames()
+	{
+		// Deliver the frames received in order, up to the first missing one.
+		int slot = reliableNext % ReliableWindow;
+		while(reliableLengths[slot] != 0)
+		{
+			const char* frame = reliableFrames[slot];
+			int size = reliableLengths[slot];
+			if(size > FrameHeader::Size + 2)
+			{
+				unsigned short eventSize = FrameLayout::EventSize::read(&frame[FrameHeader::Size]);
+				if(FrameHeader::Size + 2 + eventSize <= size)
+				{
+					// Compact reliable frames carry keyframes.
+					const char* event = &frame[FrameHeader::Size + 2];
+					if(FrameLayout::Flags::read(frame) & FrameHeader::FlagCompact) parseCompactEvent(event, eventSize);
+					else parseEvent(event, eventSize);
+				}
+			}
+			reliableLengths[slot] = 0;
+			reliableNext++;
+			slot = reliableNext % ReliableWindow;
+		}
+
+		// Restart the give up timer if more frames are missing.
+		reliableGapTime = 0;
+		for(int i = 1; i < ReliableWindow; i++)
+		{
+			if(reliableLengths[(reliableNext + i) % ReliableWindow] != 0)
+			{
+				reliableGapTime = getTime();
+				break;
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::sendReliableMessage(const char* msg, unsigned int sequence, int count)
+	{
+		// Reliable lane messages are sent through the server connection, one
+		// per line: 'omicron_ack <next sequence>' acknowledges all the frames
+		// before the specified one, 'omicron_nack <sequence> <count>' asks for
+		// a range of missing frames. The server answers 'omicron_lost <sequence>
+		// <count>' for the frames it does not have anymore.
+		char buf[64];
+		if(count > 1) sprintf(buf, "%s %u %d\n", msg, sequence, count);
+		else sprintf(buf, "%s %u\n", msg, sequence);
+		sendMessage(buf);
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::sendMessage(const char* msg)
+	{
+		int flags = 0;
+	#ifdef MSG_NOSIGNAL
+		flags = MSG_NOSIGNAL;
+	#endif
+		if(send(ConnectSocket, msg, (int)strlen(msg), flags) == -1)
+		{
+			PRINT_SOCKET_ERROR("NetService: Could not send message to server");
+			reliableActive = false;
+			timeSyncActive = false;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::updateTimeSync()
+	{
+		readServerMessages();
+
+		// Send a time request: 'omicron_time <local time>'. The server 
+		// answers with the request time, and its own receive and send times.
+		unsigned long long now = getTime();
+		if(now >= timeSyncNext)
+		{
+			char buf[64];
+			sprintf(buf, "omicron_time %llu\n", now);
+			sendMessage(buf);
+			timeSyncNext = now + (timeSyncSamples < TimeSyncWindow / 2 ? TimeSyncStartInterval : TimeSyncInterval);
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::readServerMessages()
+	{
+		// Read the messages available on the server connection, without blocking.
+		while(true)
+		{
+			fd_set ReadFDs;
+			FD_ZERO(&ReadFDs);
+			FD_SET(ConnectSocket, &ReadFDs);
+			struct timeval noWait;
+			noWait.tv_sec = 0;
+			noWait.tv_usec = 0;
+			if(select(ConnectSocket + 1, &ReadFDs, NULL, NULL, &noWait) <= 0) return;
+
+			int result = recv(ConnectSocket, &messageBuffer[messageLength], sizeof(messageBuffer) - 1 - messageLength, 0);
+			if(result <= 0)
+			{
+				timeSyncActive = false;
+				reliableActive = false;
+				return;
+			}
+			unsigned long long receiveTime = getTime();
+			messageLength += result;
+			messageBuffer[messageLength] = '\0';
+
+			char* line = messageBuffer;
+			char* end;
+			while((end = strchr(line, '\n')) != NULL)
+			{
+				*end = '\0';
+				unsigned long long t0, t1, t2;
+				unsigned int sequence;
+				int count;
+				if(sscanf(line, "omicron_time %llu %llu %llu", &t0, &t1, &t2) == 3) addTimeSample(t0, t1, t2, receiveTime);
+				// 'omicron_lost <sequence> <count>': reliable frames the server
+				// cannot retransmit anymore. Stop waiting for them.
+				else if(sscanf(line, "omicron_lost %u %d", &sequence, &count) == 2 && reliableActive && 
+					hasReliableSequence && (int)(sequence + count - reliableNext) > 0)
+				{
+					skipReliableFrames(sequence + count);
+					deliverReliableFrames();
+				}
+				line = end + 1;
+			}
+			messageLength -= (int)(line - messageBuffer);
+			memmove(messageBuffer, line, messageLength);
+			// Drop overlong lines.
+			if(messageLength == sizeof(messageBuffer) - 1) messageLength = 0;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::addTimeSample(unsigned long long t0, unsigned long long t1, 
+		unsigned long long t2, unsigned long long t3)
+	{
+		// NTP style estimate: the offset assumes the request and the answer
+		// took the same time to travel. The error is at most delay / 2.
+		long long delay = (long long)(t3 - t0) - (long long)(t2 - t1);
+		if(delay < 0) delay = 0;
+		long long offset = ((long long)(t1 - t0) + (long long)(t2 - t3)) / 2;
+
+		int slot = timeSyncSamples % TimeSyncWindow;
+		sampleOffsets[slot] = offset;
+		sampleDelays[slot] = delay;
+		sampleTimes[slot] = t0 + (t3 - t0) / 2;
+		timeSyncSamples++;
+		int samples = timeSyncSamples < TimeSyncWindow ? timeSyncSamples : TimeSyncWindow;
+
+		// Samples with the lowest delay are the most accurate ones.
+		int best = 0;
+		for(int i = 1; i < samples; i++) if(sampleDelays[i] < sampleDelays[best]) best = i;
+		clockOffset = sampleOffsets[best];
+		clockDelay = sampleDelays[best];
+		clockOffsetTime = sampleTimes[best];
+
+		// Drift: least squares fit of the offsets over time, ignoring the
+		// samples delayed much more than the best one. Offset errors are up 
+		// to delay / 2, so samples must be spread over a few seconds for the
+		// drift to be meaningful.
+		long long maxDelay = clockDelay + clockDelay / 4 + 100;
+		double n = 0, st = 0, so = 0, stt = 0, sto = 0;
+		unsigned long long first = sampleTimes[best], last = sampleTimes[best];
+		for(int i = 0; i < samples; i++)
+		{
+			if(sampleDelays[i] > maxDelay) continue;
+			double t = (double)(long long)(sampleTimes[i] - clockOffsetTime);
+			double o = (double)(sampleOffsets[i] - clockOffset);
+			n++; st += t; so += o; stt += t * t; sto += t * o;
+			if(sampleTimes[i] < first) first = sampleTimes[i];
+			if(sampleTimes[i] > last) last = sampleTimes[i];
+		}
+		double d = n * stt - st * st;
+		if(n >= 3 && last - first >= TimeSyncDriftSpan && d > 0)
+		{
+			clockDrift = (n * sto - st * so) / d;
+			// Quartz clocks drift by a few tens of ppm: larger values come 
+			// from noise or clock adjustments.
+			if(clockDrift > 0.0005) clockDrift = 0.0005;
+			if(clockDrift < -0.0005) clockDrift = -0.0005;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline long long OmicronConnectorClient::getClockOffset(unsigned long long localTime)
+	{
+		return clockOffset + (long long)(clockDrift * (double)(long long)(localTime - clockOffsetTime));
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline unsigned long long OmicronConnectorClient::serverToLocalTime(unsigned long long serverTime)
+	{
+		// The offset changes slowly: evaluating it at the approximate local 
+		// time is accurate enough.
+		unsigned long long localTime = serverTime - clockOffset;
+		return serverTime - getClockOffset(localTime);
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline long long OmicronConnectorClient::getEventAge(const EventData& evt)
+	{
+		if(!isTimeSynchronized() || evt.time == 0) return 0;
+		return (long long)(getTime() - serverToLocalTime(evt.time));
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline unsigned long long OmicronConnectorClient::getTime()
+	{
+		// Local time in microseconds, used for reliable lane timeouts and
+		// time sync. A monotonic clock, like omicron::otimestamp, so that
+		// wall clock adjustments do not disturb the clock estimate.
+	#ifdef OMICRON_OS_WIN
+		LARGE_INTEGER frequency, counter;
+		QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&counter);
+		return (unsigned long long)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+			(unsigned long long)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+	#elif defined(__APPLE__)
+		static mach_timebase_info_data_t timebase = { 0, 0 };
+		if(timebase.denom == 0) mach_timebase_info(&timebase);
+		return mach_absolute_time() * timebase.numer / timebase.denom / 1000;
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::parseEvent(const char* buf, int size)
+	{
+		EventView view(buf, size);
+		// Discard datagrams too short to contain an event.
+		if(!view.isValid()) return;
+
+		if(listener->onEventPacket(buf, size)) return;
+
+		view.toEventData(addBatchEvent());
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline EventData& OmicronConnectorClient::addBatchEvent()
+	{
+		if(eventBatchLength == EventBatchSize) flushEvents();
+		return eventBatch[eventBatchLength++];
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::flushEvents()
+	{
+		if(eventBatchLength == 0) return;
+		int count = eventBatchLength;
+		eventBatchLength = 0;
+		if(receiverRunning)
+		{
+			// Receiver thread: keep the latest state, queue discrete events.
+			for(int i = 0; i < count; i++)
+			{
+				const EventData& ed = eventBatch[i];
+				stateTable->write(ed);
+				if(!OutputPolicy::isContinuous(ed.type, ed.extraDataType)) discreteQueue->push(ed);
+			}
+			return;
+		}
+		listener->onEvents(eventBatch, count);
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//template<typename ListenerType>
+	inline void OmicronConnectorClient::parseCompactEvent(const char* buf, int size)
+	{
+		int fields;
+		unsigned char keyId;
+		int serviceId;
+		unsigned int sourceId;
+		int offset = CompactCodec::decodeHeader(buf, size, fields, keyId, serviceId, sourceId);
+		if(offset == 0) return;
+
+		int kind = fields & CompactCodec::KindMask;
+		const CompactEvent* key = NULL;
+		if(kind == CompactCodec::Delta)
+		{
+			// The keyframe is missing if the client gave up on its reliable
+			// frame: events are dropped until the next keyframe.
+			key = compactKeys.find(serviceId, sourceId, keyId);
+			if(key == NULL) 
+			{
+				packetStats.undecodable++;
+				return;
+			}
+		}
+		if(!compactCodec.decode(buf, size, offset, fields, key, compactEvent)) return;
+		compactEvent.keyId = keyId;
+		compactEvent.serviceId = serviceId;
+		compactEvent.sourceId = sourceId;
+
+		if(kind == CompactCodec::Keyframe)
+		{
+			compactKeys.store(compactEvent);
+			return;
+		}
+
+		compactCodec.toEventData(compactEvent, addBatchEvent());
 	}
 #endif
 #endif
@@ -0,0 +1,133 @@
+/******************************************************************************
+ * THE OMICRON PROJECT
+ *-----------------------------------------------------------------------------
+ * Copyright 2010-2014		Electronic Visualization Laboratory,
+ *							University of Illinois at Chicago
+ * Authors:
+ *  Alessandro Febretti		febret@gmail.com
+ *-----------------------------------------------------------------------------
+ * Copyright (c) 2010-2013, Electronic Visualization Laboratory,
+ * University of Illinois at Chicago
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer. Redistributions in binary
+ * form must reproduce the above copyright notice, this list of conditions and
+ * the following disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE  GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-----------------------------------------------------------------------------
+ * What's in this file:
+ *	Minimal set of atomic operations on 32 bit unsigned integers, used by the
+ *  lock-free structures in omicron (i.e. the ServiceManager event ring).
+ ******************************************************************************/
+#ifndef __ATOMIC_H__
+#define __ATOMIC_H__
+
+#include "osystem.h"
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+	#pragma intrinsic(_InterlockedCompareExchange)
+	#pragma intrinsic(_InterlockedExchangeAdd)
+	#pragma intrinsic(_ReadWriteBarrier)
+#endif
+
+// Use the C++11 style __atomic builtins when available (gcc 4.7+, clang),
+// fall back to the older __sync builtins otherwise.
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+	#define OMICRON_ATOMIC_BUILTINS
+#endif
+
+namespace omicron
+{
+	///////////////////////////////////////////////////////////////////////////
+	//! Atomically loads a value. Memory operations after the load will not be
+	//! reordered before it (acquire semantics).
+	inline uint oatomicload(const volatile uint* ptr)
+	{
+	#if defined(OMICRON_ATOMIC_BUILTINS)
+		return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+	#elif defined(__GNUC__)
+		uint val = *ptr;
+		__sync_synchronize();
+		return val;
+	#else
+		// On x86, MSVC volatile reads already have acquire semantics.
+		uint val = *ptr;
+		_ReadWriteBarrier();
+		return val;
+	#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	//! Atomically stores a value. Memory operations before the store will not
+	//! be reordered after it (release semantics).
+	inline void oatomicstore(volatile uint* ptr, uint val)
+	{
+	#if defined(OMICRON_ATOMIC_BUILTINS)
+		__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+	#elif defined(__GNUC__)
+		__sync_synchronize();
+		*ptr = val;
+	#else
+		_ReadWriteBarrier();
+		*ptr = val;
+	#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	//! Full memory barrier: memory operations before the fence will not be
+	//! reordered after it, and vice versa. Unlike the acquire/release 
+	//! semantics of oatomicload and oatomicstore, this also orders a store 
+	//! followed by a load.
+	inline void oatomicfence()
+	{
+	#if defined(OMICRON_ATOMIC_BUILTINS)
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	#elif defined(__GNUC__)
+		__sync_synchronize();
+	#else
+		_ReadWriteBarrier();
+		_mm_mfence();
+		_ReadWriteBarrier();
+	#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	//! Atomically adds delta to the value pointed by ptr. Returns the new value.
+	inline uint oatomicadd(volatile uint* ptr, uint delta)
+	{
+	#if defined(__GNUC__)
+		return __sync_add_and_fetch(ptr, delta);
+	#else
+		return (uint)_InterlockedExchangeAdd((volatile long*)ptr, (long)delta) + delta;
+	#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	//! Atomically replaces the value pointed by ptr with newval if it is
+	//! equal to oldval. Returns true if the swap took place.
+	inline bool oatomiccas(volatile uint* ptr, uint oldval, uint newval)
+	{
+	#if defined(__GNUC__)
+		return __sync_bool_compare_and_swap(ptr, oldval, newval);
+	#else
+		return (uint)_InterlockedCompareExchange((volatile long*)ptr, (long)newval, (long)oldval) == oldval;
+	#endif
+	}
+}; // namespace omicron
+
+#endif
@@ -57,18 +57,32 @@ namespace omicron
 {
     ///////////////////////////////////////////////////////////////////////////
     //! Events are generated by Service instances. 
+    //! Event data is split in a compact header (ids, type, flags, position)
+    //! and an extra data section. Extra data up to InlineExtraDataSize bytes
+    //! is stored inside the event. Bigger payloads (i.e. skeleton joint 
+    //! arrays or speech strings) are stored in an external extra data block:
+    //! events in the ServiceManager event ring use blocks from a shared 
+    //! arena, standalone events allocate their block when first needed.
     class Event: public ReferenceType, public EventBase
     {
     // Friend the class that implements methods used for event serialization by equalizer.
     friend class EventUtils; 
     friend class Service; 
+    friend class ServiceManager; 
     public:
+        //! Maximum size of the extra data section.
         static const int ExtraDataSize = 1024;
+        //! Size of the extra data section stored inside the event.
+        static const int InlineExtraDataSize = 64;
         static const int MaxExtraDataItems = 32;
         static Event::Flags parseButtonName(const String& name);
 
     public:
         Event();
+        virtual ~Event();
+
+        //! Copies the event header and extra data. The copy cost depends on
+        //! the extra data size.
 
         void copyFrom(const Event& e);
 
@@ -92,8 +106,18 @@ namespace omicron
         //! The event type.
         Type getType() const;
 
-        //! Gets the event timestamp. The timestamp is updated everytime the Event::reset is called.
+        //! Gets the event timestamp in milliseconds. The timestamp is updated everytime the Event::reset is called.
+        //! @remarks this is the legacy wall clock timestamp, wrapping every ~12 days. Use getTime for 
+        //! high resolution event timing.
         unsigned int getTimestamp() const;
+        //! Gets the event creation time, in microseconds (see otimestamp). The time is updated every 
+        //! time Event::reset is called.
+        uint64 getTime() const;
+        void setTime(uint64 value);
+        //! Gets the time the event data has been captured by the device, in microseconds, on the same
+        //! clock used by getTime. Returns 0 if the device did not provide a capture time.
+        uint64 getDeviceTime() const;
+        void setDeviceTime(uint64 value);
 
         //! Set to true if this event has been processed already.
         //float getPosition(int component) const;
@@ -158,21 +182,38 @@ namespace omicron
         void* getExtraDataBuffer() const;
 
     private:
+        // Returns the number of bytes used to store the extra data. Same as
+        // getExtraDataSize, plus the string terminator for string data.
+        int getExtraDataStorageSize() const;
+        // Makes sure the extra data buffer can store size bytes, moving the
+        // inline extra data to the external block if needed.
+        void reserveExtraData(int size);
+        char* getExtraDataBlock();
+        // Used by ServiceManager to assign event ring slots a block from the
+        // extra data arena.
+        void setExtraDataBlock(char* block);
+
+    private:
+        // Event header
         unsigned int mySourceId;
-        enum Service::ServiceType myServiceType;
         int myServiceId;
+        enum Service::ServiceType myServiceType;
         enum Type myType;
-
-        Vector3f myPosition;
-        Quaternion myOrientation;
-        int myTimestamp;
-
         mutable unsigned int myFlags;
-
         ExtraDataType myExtraDataType;
         int myExtraDataItems;
         int myExtraDataValidMask;
-        char myExtraData[ExtraDataSize];
+        uint64 myTime;
+        uint64 myDeviceTime;
+        Vector3f myPosition;
+        Quaternion myOrientation;
+
+        // Extra data. When myExternalExtraData is true the extra data is
+        // stored in myExtraDataBlock, otherwise it is stored in myExtraData.
+        char* myExtraDataBlock;
+        bool myOwnsExtraDataBlock;
+        bool myExternalExtraData;
+        char myExtraData[InlineExtraDataSize];
     };
 
     ///////////////////////////////////////////////////////////////////////////
@@ -197,9 +238,21 @@ namespace omicron
     inline Event::Event():
         myFlags(0),
         myExtraDataType(ExtraDataNull),
-        myExtraDataValidMask(0)
+        myExtraDataItems(0),
+        myExtraDataValidMask(0),
+        myTime(0),
+        myDeviceTime(0),
+        myExtraDataBlock(NULL),
+        myOwnsExtraDataBlock(false),
+        myExternalExtraData(false)
     {}
 
+    ///////////////////////////////////////////////////////////////////////////
+    inline Event::~Event()
+    {
+        if(myOwnsExtraDataBlock) delete[] myExtraDataBlock;
+    }
+
     ///////////////////////////////////////////////////////////////////////////
     inline void Event::reset(Type type, Service::ServiceType serviceType, uint sourceId, int serviceId)
     {
@@ -210,21 +263,47 @@ namespace omicron
         myExtraDataItems = 0;
         myExtraDataValidMask = 0;
         myExtraDataType = ExtraDataNull;
+        myExternalExtraData = false;
         if(serviceId != -1) myServiceId = serviceId;
 
-        timeb tb;
-        ftime( &tb );
-        int curTime = tb.millitm + (tb.time & 0xfffff) * 1000; // Millisecond timer
-        myTimestamp = curTime;
+        myTime = otimestamp();
+        myDeviceTime = 0;
     }
 
     ///////////////////////////////////////////////////////////////////////////
     inline void Event::copyFrom(const Event& e)
-    { memcpy(this, &e, sizeof(Event)); }
+    {
+        mySourceId = e.mySourceId;
+        myServiceId = e.myServiceId;
+        myServiceType = e.myServiceType;
+        myType = e.myType;
+        myFlags = e.myFlags;
+        myTime = e.myTime;
+        myDeviceTime = e.myDeviceTime;
+        myPosition = e.myPosition;
+        myOrientation = e.myOrientation;
+        setExtraData(e.myExtraDataType, e.myExtraDataItems, e.myExtraDataValidMask, e.getExtraDataBuffer());
+    }
 
     ///////////////////////////////////////////////////////////////////////////
     inline unsigned int Event::getTimestamp() const
-    { return myTimestamp; }
+    { return otimestampms(myTime); }
+
+    ///////////////////////////////////////////////////////////////////////////
+    inline uint64 Event::getTime() const
+    { return myTime; }
+
+    ///////////////////////////////////////////////////////////////////////////
+    inline void Event::setTime(uint64 value)
+    { myTime = value; }
+
+    ///////////////////////////////////////////////////////////////////////////
+    inline uint64 Event::getDeviceTime() const
+    { return myDeviceTime; }
+
+    ///////////////////////////////////////////////////////////////////////////
+    inline void Event::setDeviceTime(uint64 value)
+    { myDeviceTime = value; }
 
     ///////////////////////////////////////////////////////////////////////////
     inline unsigned int Event::getSourceId() const
@@ -373,7 +452,8 @@ namespace omicron
     {
         oassert(myExtraDataType == ExtraDataFloatArray);
         oassert(!isExtraDataNull(index));
-        return FLOAT_PTR(myExtraData[index * 4]);
+        const char* data = (const char*)getExtraDataBuffer();
+        return FLOAT_PTR(data[index * 4]);
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -381,10 +461,15 @@ namespace omicron
     {
         oassert(myExtraDataType == ExtraDataFloatArray);
         oassert(index < MaxExtraDataItems);
-        if(index >= myExtraDataItems) myExtraDataItems = index + 1;
+        if(index >= myExtraDataItems)
+        {
+            reserveExtraData((index + 1) * 4);
+            myExtraDataItems = index + 1;
+        }
         // Mark this entry bit as valid in the extra data validity mask
         myExtraDataValidMask |= (1 << index);
-        FLOAT_PTR(myExtraData[index * 4]) = value;
+        char* data = (char*)getExtraDataBuffer();
+        FLOAT_PTR(data[index * 4]) = value;
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -392,7 +477,8 @@ namespace omicron
     {
         oassert(myExtraDataType == ExtraDataIntArray);
         oassert(!isExtraDataNull(index));
-        return INT_PTR(myExtraData[index * 4]);
+        const char* data = (const char*)getExtraDataBuffer();
+        return INT_PTR(data[index * 4]);
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -400,10 +486,15 @@ namespace omicron
     {
         oassert(myExtraDataType == ExtraDataIntArray);
         oassert(index < MaxExtraDataItems);
-        if(index >= myExtraDataItems) myExtraDataItems = index + 1;
+        if(index >= myExtraDataItems)
+        {
+            reserveExtraData((index + 1) * 4);
+            myExtraDataItems = index + 1;
+        }
         // Mark this entry bit as valid in the extra data validity mask
         myExtraDataValidMask |= (1 << index);
-        INT_PTR(myExtraData[index * 4]) = value;
+        char* data = (char*)getExtraDataBuffer();
+        INT_PTR(data[index * 4]) = value;
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -412,9 +503,10 @@ namespace omicron
         oassert(myExtraDataType == ExtraDataVector3Array);
         oassert(!isExtraDataNull(index));
         int offset = index * 3 * 4;
-        float x = FLOAT_PTR(myExtraData[offset]);
-        float y = FLOAT_PTR(myExtraData[offset + 4]);
-        float z = FLOAT_PTR(myExtraData[offset + 8]);
+        const char* data = (const char*)getExtraDataBuffer();
+        float x = FLOAT_PTR(data[offset]);
+        float y = FLOAT_PTR(data[offset + 4]);
+        float z = FLOAT_PTR(data[offset + 8]);
         return Vector3f(x, y, z);
     }
 
@@ -423,25 +515,31 @@ namespace omicron
     {
         oassert(myExtraDataType == ExtraDataVector3Array);
         oassert(index < MaxExtraDataItems);
-        if(index >= myExtraDataItems) myExtraDataItems = index + 1;
+        if(index >= myExtraDataItems)
+        {
+            reserveExtraData((index + 1) * 3 * 4);
+            myExtraDataItems = index + 1;
+        }
         // Mark this entry bit as valid in the extra data validity mask
         myExtraDataValidMask |= (1 << index);
         int offset = index * 3 * 4;
-        FLOAT_PTR(myExtraData[offset]) = value[0];
-        FLOAT_PTR(myExtraData[offset + 4]) = value[1];
-        FLOAT_PTR(myExtraData[offset + 8]) = value[2];
+        char* data = (char*)getExtraDataBuffer();
+        FLOAT_PTR(data[offset]) = value[0];
+        FLOAT_PTR(data[offset + 4]) = value[1];
+        FLOAT_PTR(data[offset + 8]) = value[2];
     }
 
     ///////////////////////////////////////////////////////////////////////////
     inline const char* Event::getExtraDataString() const
     {
         oassert(myExtraDataType == ExtraDataString);
-        return (const char*)myExtraData;
+        return (const char*)getExtraDataBuffer();
     }
 
     ///////////////////////////////////////////////////////////////////////////
     inline void* Event::getExtraDataBuffer() const
     {
+        if(myExternalExtraData) return (void*)myExtraDataBlock;
         return (void*)myExtraData;
     }
 
@@ -451,16 +549,23 @@ namespace omicron
         myExtraDataType = type;
         myExtraDataItems = items;
         myExtraDataValidMask = mask;
-        memcpy(myExtraData, data, getExtraDataSize());
+
+        // Only copy the used part of the extra data. NOTE: data may point to
+        // this event extra data buffer, so do not move existing data around.
+        int size = getExtraDataStorageSize();
+        oassert(size <= ExtraDataSize);
+        char* dst = myExtraData;
+        myExternalExtraData = (size > InlineExtraDataSize);
+        if(myExternalExtraData) dst = getExtraDataBlock();
+        if(size > 0 && dst != data) memmove(dst, data, size);
+        if(type == ExtraDataString) dst[items] = '\0';
     }
 
     ///////////////////////////////////////////////////////////////////////////
     inline void Event::setExtraDataString(const String& value)
     {
         oassert(myExtraDataType == ExtraDataString);
-        strcpy((char*)myExtraData, value.c_str());
-        myExtraDataItems = value.size();
-        myExtraData[myExtraDataItems] = '\0';
+        setExtraData(ExtraDataString, value.size(), myExtraDataValidMask, (void*)value.c_str());
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -469,6 +574,38 @@ namespace omicron
         myExtraDataValidMask = 0; 
         myExtraDataType = ExtraDataNull;
         myExtraDataItems = 0;
+        myExternalExtraData = false;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    inline char* Event::getExtraDataBlock()
+    {
+        if(myExtraDataBlock == NULL)
+        {
+            myExtraDataBlock = new char[ExtraDataSize];
+            myOwnsExtraDataBlock = true;
+        }
+        return myExtraDataBlock;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    inline void Event::setExtraDataBlock(char* block)
+    {
+        oassert(!myExternalExtraData);
+        if(myOwnsExtraDataBlock) delete[] myExtraDataBlock;
+        myExtraDataBlock = block;
+        myOwnsExtraDataBlock = false;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    inline void Event::reserveExtraData(int size)
+    {
+        oassert(size <= ExtraDataSize);
+        if(size > InlineExtraDataSize && !myExternalExtraData)
+        {
+            memcpy(getExtraDataBlock(), myExtraData, getExtraDataStorageSize());
+            myExternalExtraData = true;
+        }
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -502,6 +639,13 @@ namespace omicron
         return myExtraDataItems;
     }
 
+    ///////////////////////////////////////////////////////////////////////////
+    inline int Event::getExtraDataStorageSize() const
+    {
+        if(myExtraDataType == ExtraDataString) return myExtraDataItems + 1;
+        return getExtraDataSize();
+    }
+
     ///////////////////////////////////////////////////////////////////////////
     inline bool Event::getChar(char* c) const
     {
@@ -63,6 +63,7 @@
 
 #ifdef OMICRON_OS_WIN
     #define PRINT_SOCKET_ERROR(msg) printf(msg" - socket error: %d\n", WSAGetLastError());
+    #define SOCKET_WOULD_BLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
     #define SOCKET_CLOSE(sock) closesocket(sock);
     #define SOCKET_CLEANUP() WSACleanup();
     #define SOCKET_INIT() \
@@ -79,28 +80,115 @@
     #define SOCKET_INIT()
     #define SOCKET int
     #define PRINT_SOCKET_ERROR(msg) printf(msg" - socket error: %s\n", strerror(errno));
+    #define SOCKET_WOULD_BLOCK() (errno == EAGAIN || errno == EWOULDBLOCK)
     #define INVALID_SOCKET -1
     #define SOCKET_ERROR   -1
     #define ioctlsocket ioctl // Used for setting socket blocking mode
 #endif
 
+// On linux, the datagrams for all the clients are sent with a single
+// sendmmsg call.
+#if defined(OMICRON_OS_LINUX) && defined(_GNU_SOURCE)
+    #define OMICRON_USE_SENDMMSG
+#endif
+
+#include <vector>
+
 class NetClient;
+class FrameStream;
+class DatagramSender;
+class PendingConnection;
+class PosePredictor;
+namespace omicronConnector { class SharedEventRing; }
 namespace omicron {
+class ServiceManager;
 ///////////////////////////////////////////////////////////////////////////////
 class OMICRON_API InputServer
 {
 public:
+    // Size of the single event datagrams, and of the handshake buffers.
+    static const int EventPacketSize = 512;
+
     virtual void handleEvent(const Event* evt);
     virtual bool handleLegacyEvent(const Event& evt);
+    //! Sends an encoded event received from an upstream server to the 
+    //! subscribed clients, without decoding or encoding it again (see the 
+    //! NetService relay option). clockOffset is the upstream server clock 
+    //! minus the local clock (otimestamp), in microseconds: when known, it
+    //! is used to convert the event times. Must be called on the thread 
+    //! calling handleEvent and flush.
+    void relayEvent(const char* packet, int length, bool hasClockOffset = false, long long clockOffset = 0);
     void startConnection(Config* cfg);
+    //! Accepts new clients and processes their handshakes, and reads the
+    //! reliable lane acknowledgements sent by clients. Never blocks: 
+    //! should be called periodically.
     SOCKET startListening();
+    //! Returns the socket used to listen for client connections. 
+    SOCKET getListenSocket() { return listenSocket; }
+    //! Registers the listening socket and the sockets of clients waiting 
+    //! for their handshake with the service manager, so that
+    //! ServiceManager::waitForEvents returns when clients connect.
+    //! Should be called after startConnection.
+    void setServiceManager(ServiceManager* sm);
     // VRPN Server (for CalVR)
     void loop();
+    //! Sends the events queued for batch mode clients. Should be called 
+    //! after handling the events generated by each service manager poll.
+    void flush();
+
+    //! Send statistics of a client.
+    struct ClientStats
+    {
+        String address;
+        bool batch;
+        bool multicast;
+        uint datagrams;
+        uint64 bytes;
+        uint errors;
+    };
+    //! Returns the send statistics of the connected clients.
+    void getClientStats(std::vector<ClientStats>& stats);
+    //! Returns the number of datagrams waiting for the sender thread.
+    int getSendQueueDepth();
+    //! Returns the number of datagrams dropped because the send queue was full.
+    uint getSendQueueOverruns();
 
 protected:
 	char* createOmicronEventPacket(const Event*);
 	void sendToClients(char*);
-	void createClient(const char*,int, bool, SOCKET);
+	void sendToClients(const Event* evt, char* packet);
+	bool isSubscribed(const Event* evt);
+	//! Returns the number of streams subscribed to the event. stream is set to 
+	//! the last subscribed stream.
+	int getSubscribedStreams(const Event* evt, FrameStream** stream);
+	void removeDisconnectedClients();
+	void sendToStreams(const Event* evt, const char* packet, int length);
+	//! Encodes the event straight into the stream frame buffer, when no other
+	//! stream needs it. Returns false if the event has to go through the 
+	//! shared event packet.
+	bool encodeToFrame(FrameStream* stream, const Event* evt);
+	void acceptConnections();
+	SOCKET processHandshakes();
+	NetClient* handleHandshake(PendingConnection* pc);
+	NetClient* createClient(const char*,int, bool, SOCKET, const char* options = "");
+	void sendHandshakeAck(NetClient* client, SOCKET clientSocket);
+	void watchClient(NetClient* client);
+	bool isLocalClient(SOCKET clientSocket);
+	int getPredictionLead(NetClient* client);
+	void processClientMessages();
+	void sendTime(NetClient* client, unsigned long long requestTime, uint64 receiveTime);
+	void sendMessage(NetClient* client, const char* msg);
+	void retransmit(NetClient* client, unsigned int sequence, int count);
+	void attachStream(NetClient* client);
+	void detachStream(NetClient* client);
+	void sendToStream(FrameStream* stream, const char* packet, int length, bool discrete = false);
+	void addToFrame(FrameStream* stream, const char* packet, int length);
+	char* reserveFrameEvent(FrameStream* stream, int maxLength);
+	void commitFrameEvent(FrameStream* stream, int length);
+	void sendFrame(FrameStream* stream);
+	void sendCompact(FrameStream* stream, const char* packet, int length);
+	void updateStreamAck(FrameStream* stream);
+	void sendToAll(const char* packet, int length, FrameStream* stream);
 private:
     enum dataMode { omicron, omicron_legacy };
     
@@ -108,12 +196,63 @@ private:
     const char* serverPort;
     SOCKET listenSocket;    
     
-    #define DEFAULT_BUFLEN 512
-	char eventPacket[DEFAULT_BUFLEN];
+	char eventPacket[EventPacketSize];
+    int eventPacketLength;
+
+    // Clients with the same options share a stream. In batch mode, events
+    // are packed into frames of at most maxFrameSize bytes (see 
+    // omicronConnector::FrameHeader).
+    std::map<std::string, FrameStream*> frameStreams;
+    int maxFrameSize;
+
+    // Output policy of clients that do not send their own.
+    omicronConnector::OutputPolicy defaultPolicy;
+
+    // Socket shared by all clients, and datagram sender (see the 
+    // senderThread option).
+    SOCKET sendSocket;
+    DatagramSender* sender;
+    unsigned int nextStreamId;
+
+    // Multicast mode: frames for clients that joined the multicast group
+    // are sent once, to the group address.
+    const char* multicastGroup;
+    int multicastPort;
+    SOCKET multicastSocket;
+    sockaddr_in multicastAddr;
+
+    // Shared memory ring, for clients on this machine (see the 
+    // sharedMemory option).
+    omicronConnector::SharedEventRing* sharedRing;
+    char sharedRingName[64];
+
+    // Clients that connected and did not send their handshake yet.
+    std::vector<PendingConnection*> pendingConnections;
+    // Handshake timeout, in milliseconds.
+    int handshakeTimeout;
+    // Reliable lane retransmission timeout (milliseconds) and burst size.
+    int reliableTimeout;
+    int maxRetransmitFrames;
+
+    // Compact encoding (see the compactEncoding option). compactEvent and
+    // compactPacket are encoding buffers.
+    bool compactEncoding;
+    int compactKeyframeInterval;
+    omicronConnector::CompactCodec compactCodec;
+    omicronConnector::CompactEvent compactEvent;
+    char compactPacket[EventPacketSize + omicronConnector::CompactCodec::MaxOverhead];
+
+    // Pose prediction (see the posePrediction option). predictedPacket is
+    // the encoding buffer of predicted events.
+    PosePredictor* predictor;
+    int predictedStreams;
+    char predictedPacket[EventPacketSize];
+
+    // Header of the event being relayed, used to route its packet.
+    Event relayedEvent;
+    ServiceManager* serviceManager;
 
-    char recvbuf[DEFAULT_BUFLEN];
     int iResult, iSendResult;
-    int recvbuflen;
     
     // Collection of unique clients (IP/port combinations)
     std::map<char*,NetClient*> netClients;
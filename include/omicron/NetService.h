@@ -34,16 +34,26 @@
 
 namespace omicron
 {
+	class InputServer;
+	class NetUpstream;
+
 	//////////////////////////////////////////////////////////////////////////////////////////////////
-	class NetService: public Service, omicronConnector::IOmicronConnectorClientListener
+	//! Receives events from one or more input servers. The first server is set by the serverIP, 
+	//! msgPort and dataPort options, additional servers are listed in the upstreams group, each 
+	//! with its own options and data port:
+	//!		upstreams: { touch: { serverIP = "touchhost"; msgPort = 28000; dataPort = 7001; }; };
+	//! Events from multiple servers are merged by creation time (on the local clock, see the 
+	//! timeSync option), waiting at most reorderWindow milliseconds for late events.
+	class NetService: public Service
 	{
+	friend class NetUpstream;
 	public:
 		// Allocator function
 		NetService();
+		~NetService();
 		static NetService* New() { return new NetService(); }
 
 	public:
-		virtual void onEvent(const omicronConnector::EventData& ed);
 		virtual void setup(Setting& settings);
 		virtual void initialize();
 		virtual void poll();
@@ -51,16 +61,63 @@ namespace omicron
 		void setServer(const String& str, int );
 		void setDataport(int);
 
+		//! Sets the input server that relays the events received by NetService
+		//! instances in relay mode (see the relay option). In relay mode,
+		//! events are not written to the service manager: their packets are 
+		//! forwarded to the input server clients as they are, keeping the 
+		//! original service and source ids. Relay services are polled on the
+		//! service manager poll thread, which must be the input server thread.
+		static void setRelayServer(InputServer* server) { mysRelayServer = server; }
+
+		int getNumUpstreams() { return (int)myUpstreams.size(); }
+		//! Returns the statistics of the frames received from an upstream 
+		//! server. Statistics are only available when sequence numbers are
+		//! enabled (the default, see the sequence option).
+		const omicronConnector::PacketStats& getPacketStats(int upstream = 0);
+		//! Returns the number of events that arrived after the reorder window,
+		//! and were delivered out of order.
+		uint getLateEvents() { return myLateEvents; }
+
+		//! When service ids are remapped (the default with multiple upstreams,
+		//! see the remapServiceIds option), events get a service id unique to
+		//! their upstream server and original service. Ids are allocated in a 
+		//! range reserved to this service, and never collide with local ids.
+		//! Returns the upstream index and original service id of a remapped
+		//! service id, or false if the id is unknown.
+		bool getUpstreamServiceId(int serviceId, int* upstream, int* originalServiceId);
+
 	private:
-		static NetService* mysInstance;
+		void onUpstreamEvent(NetUpstream* upstream, const omicronConnector::EventData& ed);
+		bool onUpstreamPacket(NetUpstream* upstream, const char* packet, int size);
+		int remapServiceId(NetUpstream* upstream, int serviceId);
+		void writeEvent(const omicronConnector::EventData& ed, int serviceId, uint64 time);
+		void mergeEvents(uint64 horizon);
 
-		omicronConnector::OmicronConnectorClient* myClient;
+	private:
+		static InputServer* mysRelayServer;
 
-		String serverAddress;
-		int serverPort;
-		int dataPort;
-	};
+		Vector<NetUpstream*> myUpstreams;
+
+		bool sequence;
+		bool reliable;
+		bool sharedMemory;
+		bool compact;
+		bool timeSync;
+		float predictionLead;
+		bool relay;
+		uint64 myLastStatsTime;
 
+		// Merge of multiple upstreams (microseconds).
+		bool myMerge;
+		int myReorderWindow;
+		uint64 myLastMergedTime;
+		uint myLateEvents;
+
+		// Remapped service ids, by upstream index and original service id.
+		bool myRemapServiceIds;
+		Dictionary<uint64, int> myServiceIds;
+		int myNextServiceId;
+	};
 };
 
 #endif
@@ -93,6 +93,13 @@ private:
 	static int lastIncomingEventTime;
 	static int eventCount;
 
+	// Capture time of the touch frame being processed, converted to the 
+	// local timestamp clock (see otimestamp)
+	static uint64 frameTime;
+	// Offset between the PQ frame time stamps and the local timestamp clock.
+	static long long frameTimeOffset;
+	static bool hasFrameTimeOffset;
+
 	std::map<int,Touch> touchlist; // Internal touch list to generate custom gestures
 	
 	TouchGestureManager* touchGestureManager;
@@ -51,7 +51,9 @@ namespace omicron
 	///////////////////////////////////////////////////////////////////////////
 	// Forward declarations
 	class Event;
+	class EventCursor;
 	class ServiceManager;
+	class ServicePollThread;
 
 	///////////////////////////////////////////////////////////////////////////
 	//! The base class for Services: a Service has code that is executed periodically
@@ -79,7 +81,9 @@ namespace omicron
 
 	public:
 		// Class constructor
-		Service(): myManager(NULL), myPriority(PollNormal), myDebug(false), myInitialized(false) {}
+		Service(): myManager(NULL), myEventCursor(NULL), myPriority(PollNormal), 
+			myPollRate(0), myPollThreaded(false), myLastPollTime(0), myPollThread(NULL), myWaitSockets(0),
+			myDebug(false), myInitialized(false) {}
 
 		int getServiceId() { return myId; }
 
@@ -97,6 +101,29 @@ namespace omicron
 		ServicePollPriority getPollPriority();
 		void setPollPriority(ServicePollPriority value);
 
+		//! Sets the maximum number of times per second this service gets
+		//! polled. When set to 0 (the default) the service is polled every 
+		//! time ServiceManager::poll is called or, for threaded services, 
+		//! about 1000 times per second.
+		//! Can be set using the pollRate option in the service configuration.
+		void setPollRate(float value);
+		float getPollRate();
+		//! When set to true, this service is polled on a dedicated worker 
+		//! thread instead of the ServiceManager::poll caller thread. Must be
+		//! called before ServiceManager::start. Services with PollLast
+		//! priority (event filters) can't be threaded.
+		//! Can be set using the pollThread option in the service configuration.
+		void setPollThreaded(bool value);
+		bool isPollThreaded();
+
+		//! Registers a socket this service reads data from with the service 
+		//! manager: ServiceManager::waitForEvents will return when the socket
+		//! has data. Services that register all their input sockets do not get
+		//! polled continuously while the manager is waiting for events.
+		//! Invalid (negative) sockets are ignored.
+		void addWaitSocket(int socket);
+		void removeWaitSocket(int socket);
+
 		virtual void setup(Setting& settings) {}
 		virtual void initialize() {}
 		virtual void start() {}
@@ -107,9 +134,19 @@ namespace omicron
 		void lockEvents();
 		void unlockEvents();
 		Event* writeHead();
-		Event* readHead();
-		Event* readTail();
+		void commitEvent();
+
+		//! Event reading. Each service reads events through its own event 
+		//! cursor, created the first time one of these methods is called 
+		//! (when the service manager starts, for event filters).
+		//! See the relative EventCursor methods.
+		//@{
+		EventCursor* getEventCursor();
+		int getAvailableEvents();
 		Event* getEvent(int index);
+		void clearEvents();
+		Event* readTail();
+		//@}
 
 	public:
 		//! @internal
@@ -119,8 +156,14 @@ namespace omicron
 
 	private:
 		ServiceManager* myManager;
+		EventCursor* myEventCursor;
 		String myName;
 		ServicePollPriority myPriority;
+		float myPollRate;
+		bool myPollThreaded;
+		uint64 myLastPollTime;
+		ServicePollThread* myPollThread;
+		int myWaitSockets;
 		int myId;
 		bool myDebug;
 		bool myInitialized;
@@ -142,6 +185,22 @@ namespace omicron
 	inline void Service::setPollPriority(Service::ServicePollPriority value)
 	{ myPriority = value; }
 
+	///////////////////////////////////////////////////////////////////////////
+	inline void Service::setPollRate(float value)
+	{ myPollRate = value; }
+
+	///////////////////////////////////////////////////////////////////////////
+	inline float Service::getPollRate()
+	{ return myPollRate; }
+
+	///////////////////////////////////////////////////////////////////////////
+	inline void Service::setPollThreaded(bool value)
+	{ myPollThreaded = value; }
+
+	///////////////////////////////////////////////////////////////////////////
+	inline bool Service::isPollThreaded()
+	{ return myPollThreaded; }
+
 	///////////////////////////////////////////////////////////////////////////
 	inline bool Service::isDebugEnabled()
 	{ return myDebug; }
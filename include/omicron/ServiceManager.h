@@ -40,6 +40,7 @@
 #include "Config.h"
 #include "Event.h"
 #include "Thread.h"
+#include "Atomic.h"
 
 // Preprocessor macro, bleah.. Forced to use this instead of static constant as a quick workaround 
 // to a gcc 4.2 build error. Think of a better solution in the future.
@@ -47,6 +48,66 @@
 
 namespace omicron
 {
+	class ServiceManager;
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////
+	//! A reader position in the ServiceManager event ring. Each event consumer (an application, 
+	//! the input server, a filter service) owns a cursor and reads the events it has not seen yet
+	//! directly from the ring, independently of other consumers. A cursor should be used by a 
+	//! single thread at a time.
+	//! Writers never overwrite events that have not been read by all cursors: when a cursor 
+	//! falls too far behind, new events are dropped and counted as overruns on the lagging cursor.
+	//! Filter cursors are used by services that process events before other consumers (see 
+	//! ServiceManager::poll).
+	class OMICRON_API EventCursor
+	{
+	friend class ServiceManager;
+	public:
+		const String& getName() { return myName; }
+		bool isFilter() { return myFilter; }
+
+		//! Returns the number of committed events that have not been read yet.
+		int getAvailableEvents();
+		//! Returns an available event, without removing it from the buffer.
+		//! index must be lower than the value returned by getAvailableEvents.
+		Event* getEvent(int index);
+		//! Marks the events counted by the last getAvailableEvents call as 
+		//! read. Events committed after that call are kept.
+		void clearEvents();
+		//! Reads the oldest available event. The returned event stays valid 
+		//! until the next read call on this cursor.
+		Event* readTail();
+		//! Copies up to maxEvents available events to ptr and marks them as
+		//! read. Returns the number of copied events.
+		int getEvents(Event* ptr, int maxEvents);
+
+		//! Returns the number of events written to the ring and not read yet
+		//! through this cursor.
+		int getLag();
+		//! Returns the number of events that have been dropped because this
+		//! cursor was lagging behind writers.
+		int getOverruns() { return myOverruns; }
+		void resetOverruns() { myOverruns = 0; }
+
+	private:
+		EventCursor(ServiceManager* mng, const String& name, uint sequence, bool filter);
+		bool isReadable(uint sequence);
+		void releaseReadEvents();
+
+	private:
+		ServiceManager* myManager;
+		String myName;
+		bool myFilter;
+		// Next read position.
+		uint myReadSequence;
+		// Events before this position can be overwritten by writers. Read
+		// by writers to compute the ring gating sequence.
+		volatile uint myReleaseSequence;
+		// Number of events returned by the last getAvailableEvents call.
+		int myVisibleEvents;
+		volatile uint myOverruns;
+	};
+
 	typedef Service* (*ServiceAllocator)();
 	typedef Dictionary<String, ServiceAllocator> ServiceAllocatorDictionary;
 
@@ -54,6 +115,7 @@ namespace omicron
 	class OMICRON_API ServiceManager
 	{
 	friend class Service;
+	friend class EventCursor;
 
 	public:
 		// Class constructor.
@@ -69,6 +131,12 @@ namespace omicron
 		void start();
 		void stop();
 		void dispose();
+		//! Polls all the services, in priority order. Services can also be
+		//! polled on dedicated worker threads (see Service::setPollThreaded).
+		//! In this case, poll runs the remaining services and the event 
+		//! filter stages (services with PollLast priority, like WandService
+		//! or GestureService). Consumers using non-filter cursors only see 
+		//! events that went through all the filter stages.
 		void poll();
 
 		//! Service management
@@ -89,17 +157,64 @@ namespace omicron
 		//@}
 
 		//! Event management
+		//! Events are stored in a bounded lock-free ring. Any number of threads
+		//! can write events concurrently. Events are broadcast to consumers: 
+		//! each consumer reads the ring through its own EventCursor, and sees 
+		//! every event committed after the cursor creation.
 		//@{
-		int getAvailableEvents() { return myAvailableEvents; }
+		//! Creates a new cursor on the event ring. The cursor starts at the 
+		//! oldest event still stored in the ring. Filter cursors see events
+		//! before they are published to other consumers.
+		EventCursor* createEventCursor(const String& name, bool filter = false);
+		void destroyEventCursor(EventCursor* cursor);
+		//! Returns the cursor used by the legacy event access methods below.
+		//! The cursor is created the first time it is needed.
+		EventCursor* getDefaultEventCursor();
 		int getDroppedEvents() { return myDroppedEvents; }
 		void resetDroppedEvents() { myDroppedEvents = 0; }
+		//! Reserves an event slot for the calling thread. The event becomes 
+		//! visible to readers when it is committed, through commitEvent, 
+		//! unlockEvents, the next writeHead call on the same thread or at the
+		//! end of the service poll that wrote it. If the buffer is full the
+		//! returned event is discarded and counted as dropped.
+		Event* writeHead();
+		//! Commits the last event reserved by the calling thread.
+		void commitEvent();
+		//! Kept for compatibility: writers do not need to lock the buffer 
+		//! anymore. unlockEvents commits the last event written by the
+		//! calling thread.
+		void lockEvents() {}
+		void unlockEvents() { commitEvent(); }
+		//@}
+
+		//! Event waiting
+		//! Lets a consumer sleep until there is something to do instead of 
+		//! polling the service manager continuously. 
+		//@{
+		//! Blocks until new events are committed, one of the wait sockets has
+		//! data to read, a service needs to be polled or timeoutMs milliseconds
+		//! have passed. Returns false if the wait timed out. Returns immediately
+		//! if events have been committed since the last waitForEvents call. 
+		//! Services without wait sockets and without a poll rate still get 
+		//! polled every millisecond. Only one thread at a time should wait.
+		bool waitForEvents(int timeoutMs);
+		//! Wakes up the thread blocked in waitForEvents, if any.
+		void wakeUp();
+		//! Makes waitForEvents return when the specified socket has data to
+		//! read. When a socket is registered by a service, the service is 
+		//! assumed to generate events only when its sockets have data, and 
+		//! does not get polled continuously anymore.
+		void addWaitSocket(int socket, Service* svc = NULL);
+		void removeWaitSocket(int socket);
+		//@}
+
+		//! Legacy event access. These methods read events using the default
+		//! event cursor. See the relative EventCursor methods.
+		//@{
+		int getAvailableEvents();
 		int getEvents(Event* ptr, int maxEvents);
 		Event* getEvent(int index);
 		void clearEvents();
-		void lockEvents();
-		void unlockEvents();
-		Event* writeHead();
-		Event* readHead();
 		Event* readTail();
 		//@}
 
@@ -110,8 +225,12 @@ namespace omicron
 	private:
 		void registerDefaultServices();
 
-		int incrementBufferIndex(int index);
-		int decrementBufferIndex(int index);
+		bool updateGatingSequence(uint writeSequence);
+		void publishFilteredEvents();
+
+		void initializeWait();
+		void disposeWait();
+		int getWaitTimeout(int timeoutMs);
 
 	private:
 		bool myInitialized;
@@ -123,14 +242,57 @@ namespace omicron
 		int myServiceIdCounter;
 		List< Ref<Service> > myServices;
 
-		// Event buffer stuff.
-		Lock*  myEventBufferLock;
-		Event*		myEventBuffer;
-		int				myEventBufferHead;
-		int				myEventBufferTail;
+		// Event ring slot. When sequence is equal to the slot write position 
+		// + 1 the slot contains a committed event.
+		struct EventSlot
+		{
+			Event event;
+			volatile uint sequence;
+		};
+
+		// Event ring stuff.
+		EventSlot*	myEventRing;
+		// Storage for event extra data that does not fit inside events.
+		char* myExtraDataArena;
+		// Next write position, shared by all producers.
+		volatile uint myWriteSequence;
+		// Minimum release position of all the event cursors. Writers can 
+		// only use ring slots before myGatingSequence + MaxEvents.
+		volatile uint myGatingSequence;
+		// Events written when the ring is full end up in a scratch event 
+		// owned by the writer thread, and get discarded. Scratch events are
+		// allocated the first time a thread drops an event, and tagged with
+		// myId, unique to each manager.
+		uint myId;
+		List<Event*> myScratchEvents;
+
+		// Event cursors. The lock protects the cursor list and the gating
+		// sequence update.
+		Lock myCursorLock;
+		List<EventCursor*> myCursors;
+		EventCursor* myDefaultCursor;
+
+		// Threaded polling
+		List<ServicePollThread*> myPollThreads;
+		// When services are polled on worker threads, non-filter cursors
+		// only read events before myPublishedSequence.
+		bool myPublishEnabled;
+		volatile uint myPublishedSequence;
+
+		volatile uint myDroppedEvents;
 
-		int myAvailableEvents;
-		int myDroppedEvents;
+		// Event waiting. Writers increment the commit counter after each
+		// commit, and signal the wake handle when a thread is waiting.
+		volatile uint myCommitCount;
+		volatile uint myWaiting;
+		uint myWaitCommitCount;
+		// On linux, myWaitHandle is an epoll descriptor and myWakeHandle an 
+		// eventfd. On other posix systems, myWakeHandle and myWakeWriteHandle
+		// are the ends of a pipe.
+		int myWaitHandle;
+		int myWakeHandle;
+		int myWakeWriteHandle;
+		Dictionary<int, Service*> myWaitSockets;
 	};
 
 	///////////////////////////////////////////////////////////////////////////////////////////////
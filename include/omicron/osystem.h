@@ -77,6 +77,15 @@ namespace omicron
 	OMICRON_API void oabort(const char* file, int line, const char* reason);
 
 	OMICRON_API void osleep(uint msecs);
+
+	//! Returns a monotonic timestamp in microseconds. The timestamp origin is
+	//! unspecified, so timestamps are only meaningful when compared to each
+	//! other. Unlike wall clock time, timestamps are not affected by system 
+	//! clock adjustments.
+	OMICRON_API uint64 otimestamp();
+	//! Converts a timestamp returned by otimestamp to the legacy event 
+	//! timestamp format (wall clock milliseconds, wrapping every ~12 days).
+	OMICRON_API uint otimestampms(uint64 timestamp);
 };
 
 #define odbg(str) omsg(str);
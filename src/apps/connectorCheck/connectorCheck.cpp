@@ -0,0 +1,587 @@
+/**************************************************************************************************
+ * THE OMICRON SDK
+ *-------------------------------------------------------------------------------------------------
+ * Copyright 2010-2013		Electronic Visualization Laboratory, University of Illinois at Chicago
+ * Authors:
+ *  Alessandro Febretti		febret@gmail.com
+ *-------------------------------------------------------------------------------------------------
+ * Copyright (c) 2010-2013, Electronic Visualization Laboratory, University of Illinois at Chicago
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * Redistributions of source code must retain the above copyright notice, this list of conditions
+ * and the following disclaimer. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE  GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *************************************************************************************************/
+// Self check of the connector wire formats: encodes and decodes representative events with
+// EventWriter / EventView and CompactCodec, and compares them to the legacy event layout still
+// parsed by older clients (and by the Unity and Processing connectors).
+// Also checks that the longest subscription and policy handshake options fit their buffers.
+// Prints the failed checks and returns 1 if any.
+#include <connector/omicronConnectorClient.h>
+
+using namespace omicronConnector;
+
+int sChecks = 0;
+int sFailures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void check(bool condition, const char* text, int line)
+{
+	sChecks++;
+	if(!condition)
+	{
+		sFailures++;
+		printf("connectorCheck: line %d: check failed: %s\n", line, text);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The legacy event layout: the fields written in host order (OI_WRITEBUF / OI_READBUF) in a 512
+// bytes packet, followed by the extra data. Legacy servers and clients run on little endian hosts.
+static const int LegacyPacketSize = 512;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool isLittleEndian()
+{
+	unsigned int one = 1;
+	return *(unsigned char*)&one == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename T> void putLegacy(char* packet, int& offset, T value)
+{
+	memcpy(&packet[offset], &value, sizeof(T));
+	offset += sizeof(T);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename T> void getLegacy(const char* packet, int& offset, T& value)
+{
+	memcpy(&value, &packet[offset], sizeof(T));
+	offset += sizeof(T);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void writeLegacyEvent(const EventData& ed, char* packet)
+{
+	int offset = 0;
+	memset(packet, 0, LegacyPacketSize);
+	putLegacy(packet, offset, ed.timestamp);
+	putLegacy(packet, offset, ed.sourceId);
+	putLegacy(packet, offset, ed.serviceId);
+	putLegacy(packet, offset, ed.serviceType);
+	putLegacy(packet, offset, ed.type);
+	putLegacy(packet, offset, ed.flags);
+	putLegacy(packet, offset, ed.posx);
+	putLegacy(packet, offset, ed.posy);
+	putLegacy(packet, offset, ed.posz);
+	putLegacy(packet, offset, ed.orw);
+	putLegacy(packet, offset, ed.orx);
+	putLegacy(packet, offset, ed.ory);
+	putLegacy(packet, offset, ed.orz);
+	putLegacy(packet, offset, ed.extraDataType);
+	putLegacy(packet, offset, ed.extraDataItems);
+	putLegacy(packet, offset, ed.extraDataMask);
+	if(ed.extraDataType != EventData::ExtraDataNull) memcpy(&packet[offset], ed.extraData, ed.getExtraDataSize());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void readLegacyEvent(const char* packet, EventData& ed)
+{
+	int offset = 0;
+	getLegacy(packet, offset, ed.timestamp);
+	getLegacy(packet, offset, ed.sourceId);
+	getLegacy(packet, offset, ed.serviceId);
+	getLegacy(packet, offset, ed.serviceType);
+	getLegacy(packet, offset, ed.type);
+	getLegacy(packet, offset, ed.flags);
+	getLegacy(packet, offset, ed.posx);
+	getLegacy(packet, offset, ed.posy);
+	getLegacy(packet, offset, ed.posz);
+	getLegacy(packet, offset, ed.orw);
+	getLegacy(packet, offset, ed.orx);
+	getLegacy(packet, offset, ed.ory);
+	getLegacy(packet, offset, ed.orz);
+	getLegacy(packet, offset, ed.extraDataType);
+	getLegacy(packet, offset, ed.extraDataItems);
+	getLegacy(packet, offset, ed.extraDataMask);
+	memcpy(ed.extraData, &packet[offset], LegacyPacketSize - offset);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns a mocap event, with extra data items filled with a pattern.
+EventData makeEvent(unsigned int sourceId, unsigned int extraDataType, unsigned int extraDataItems)
+{
+	EventData ed;
+	memset(&ed, 0, sizeof(ed));
+	ed.timestamp = 123456789;
+	ed.sourceId = sourceId;
+	ed.serviceId = 3;
+	ed.serviceType = EventData::ServiceTypeMocap;
+	ed.type = EventData::Update;
+	ed.flags = EventData::Button1 | EventData::User;
+	ed.posx = 1.25f;
+	ed.posy = -0.5f;
+	ed.posz = 2.0f / 3.0f;
+	ed.orw = 0.5f;
+	ed.orx = -0.5f;
+	ed.ory = 0.5f;
+	ed.orz = 0.5f;
+	ed.time = 1234567890123ULL;
+	ed.deviceTime = 1234567880000ULL;
+	ed.extraDataType = extraDataType;
+	ed.extraDataItems = extraDataItems;
+	ed.extraDataMask = extraDataItems > 0 ? 0xA5 : 0;
+	int size = ed.getExtraDataSize();
+	if(extraDataType == EventData::ExtraDataString)
+	{
+		for(int i = 0; i < size; i++) ed.extraData[i] = (unsigned char)('a' + i % 26);
+	}
+	else
+	{
+		for(int i = 0; i < size / 4; i++)
+		{
+			float value = (float)i * 0.125f - 3.0f;
+			memcpy(&ed.extraData[i * 4], &value, 4);
+		}
+	}
+	ed.setRawPose();
+	return ed;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int writeEvent(const EventData& ed, char* buffer, int capacity, unsigned int& itemsWritten)
+{
+	EventWriter writer(buffer, capacity);
+	writer.setHeader(ed.timestamp, ed.sourceId, ed.serviceId, ed.serviceType, ed.type, ed.flags);
+	writer.setPosition(ed.posx, ed.posy, ed.posz);
+	writer.setOrientation(ed.orw, ed.orx, ed.ory, ed.orz);
+	itemsWritten = writer.setExtraData(ed.extraDataType, ed.extraDataItems, ed.extraDataMask, ed.extraData);
+	writer.setTimes(ed.time, ed.deviceTime);
+	if(ed.predictionLead != 0)
+	{
+		float rawPosition[3] = { ed.rawPosx, ed.rawPosy, ed.rawPosz };
+		float rawOrientation[4] = { ed.rawOrw, ed.rawOrx, ed.rawOry, ed.rawOrz };
+		writer.setPrediction(ed.predictionLead, rawPosition, rawOrientation);
+	}
+	return writer.getLength();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool sameHeader(const EventData& a, const EventData& b)
+{
+	return a.timestamp == b.timestamp && a.sourceId == b.sourceId && a.serviceId == b.serviceId &&
+		a.serviceType == b.serviceType && a.type == b.type && a.flags == b.flags &&
+		a.posx == b.posx && a.posy == b.posy && a.posz == b.posz &&
+		a.orw == b.orw && a.orx == b.orx && a.ory == b.ory && a.orz == b.orz &&
+		a.extraDataType == b.extraDataType && a.extraDataItems == b.extraDataItems &&
+		a.extraDataMask == b.extraDataMask;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Encodes an event in a legacy size packet, and checks it decodes to the same event with both
+// EventView and the legacy reader. expectedItems is the number of extra data items that fit.
+void checkWireEvent(const EventData& ed, unsigned int expectedItems, bool expectTimes)
+{
+	char packet[LegacyPacketSize];
+	unsigned int items;
+	int length = writeEvent(ed, packet, LegacyPacketSize, items);
+	CHECK(items == expectedItems);
+
+	EventData sent = ed;
+	sent.extraDataItems = items;
+	int extraDataSize = sent.getExtraDataSize();
+	bool expectPrediction = expectTimes && ed.predictionLead != 0 &&
+		EventLayout::HeaderSize + extraDataSize + EventLayout::TrailerSize + EventLayout::PredictionTrailerSize <= LegacyPacketSize;
+	CHECK(length == EventLayout::HeaderSize + extraDataSize + (expectTimes ? EventLayout::TrailerSize : 0) +
+		(expectPrediction ? EventLayout::PredictionTrailerSize : 0));
+
+	// Header and extra data are byte exact with the legacy layout, trailers follow the extra data.
+	if(isLittleEndian())
+	{
+		char legacy[LegacyPacketSize];
+		writeLegacyEvent(sent, legacy);
+		CHECK(memcmp(packet, legacy, EventLayout::HeaderSize + extraDataSize) == 0);
+	}
+	const char* trailer = &packet[EventLayout::HeaderSize + extraDataSize];
+	if(expectTimes) CHECK(memcmp(trailer, "OTIM", 4) == 0);
+	if(expectPrediction) CHECK(memcmp(&trailer[EventLayout::TrailerSize], "OPRD", 4) == 0);
+
+	EventView view(packet, length);
+	CHECK(view.isValid());
+	CHECK(view.getExtraDataSize() == extraDataSize);
+	CHECK((view.getTrailer() != NULL) == expectTimes);
+	CHECK((view.getPredictionTrailer() != NULL) == expectPrediction);
+
+	EventData decoded;
+	view.toEventData(decoded);
+	CHECK(sameHeader(decoded, sent));
+	CHECK(memcmp(decoded.extraData, sent.extraData, extraDataSize) == 0);
+	CHECK(decoded.time == (expectTimes ? ed.time : 0));
+	CHECK(decoded.deviceTime == (expectTimes ? ed.deviceTime : 0));
+	if(expectPrediction)
+	{
+		CHECK(decoded.predictionLead == ed.predictionLead);
+		CHECK(decoded.rawPosx == ed.rawPosx && decoded.rawPosy == ed.rawPosy && decoded.rawPosz == ed.rawPosz);
+		CHECK(decoded.rawOrw == ed.rawOrw && decoded.rawOrx == ed.rawOrx &&
+			decoded.rawOry == ed.rawOry && decoded.rawOrz == ed.rawOrz);
+	}
+	else
+	{
+		CHECK(decoded.predictionLead == 0);
+		CHECK(decoded.rawPosx == decoded.posx && decoded.rawOrw == decoded.orw);
+	}
+
+	// Legacy clients receive the datagram in a zeroed buffer, and read the same event.
+	if(isLittleEndian())
+	{
+		char received[LegacyPacketSize];
+		memset(received, 0, sizeof(received));
+		memcpy(received, packet, length);
+		EventData legacyDecoded;
+		readLegacyEvent(received, legacyDecoded);
+		CHECK(sameHeader(legacyDecoded, sent));
+		CHECK(memcmp(legacyDecoded.extraData, sent.extraData, extraDataSize) == 0);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void checkWireFormat()
+{
+	CHECK(EventLayout::HeaderSize == 64);
+	CHECK(EventLayout::ExtraDataType::Offset == 52 && EventLayout::OrW::Offset == 36);
+
+	// Extra data types, and the 512 bytes packet boundary: 107 floats leave exactly room for
+	// the time trailer, 112 floats fill the packet, and the items past it are dropped.
+	checkWireEvent(makeEvent(1, EventData::ExtraDataNull, 0), 0, true);
+	checkWireEvent(makeEvent(2, EventData::ExtraDataFloatArray, 4), 4, true);
+	checkWireEvent(makeEvent(3, EventData::ExtraDataIntArray, 3), 3, true);
+	checkWireEvent(makeEvent(4, EventData::ExtraDataVector3Array, 20), 20, true);
+	checkWireEvent(makeEvent(5, EventData::ExtraDataString, 11), 11, true);
+	checkWireEvent(makeEvent(6, EventData::ExtraDataFloatArray, 107), 107, true);
+	checkWireEvent(makeEvent(7, EventData::ExtraDataFloatArray, 108), 108, false);
+	checkWireEvent(makeEvent(8, EventData::ExtraDataFloatArray, 112), 112, false);
+	checkWireEvent(makeEvent(9, EventData::ExtraDataFloatArray, 113), 112, false);
+	checkWireEvent(makeEvent(10, EventData::ExtraDataVector3Array, 38), 37, false);
+
+	// Predicted events: the prediction trailer follows the time trailer, when it fits.
+	EventData predicted = makeEvent(11, EventData::ExtraDataVector3Array, 2);
+	predicted.predictionLead = 20000;
+	predicted.rawPosx = 1.0f;
+	predicted.rawOrw = 0.0f;
+	predicted.rawOrx = 1.0f;
+	checkWireEvent(predicted, 2, true);
+	predicted = makeEvent(12, EventData::ExtraDataFloatArray, 98);
+	predicted.predictionLead = 20000;
+	checkWireEvent(predicted, 98, true);
+
+	// Truncated datagrams.
+	char packet[LegacyPacketSize];
+	unsigned int items;
+	int length = writeEvent(makeEvent(13, EventData::ExtraDataFloatArray, 8), packet, LegacyPacketSize, items);
+	CHECK(!EventView(packet, EventLayout::HeaderSize - 1).isValid());
+	CHECK(EventView(packet, EventLayout::HeaderSize + 10).getExtraDataSize() == 10);
+	CHECK(EventView(packet, length - 1).getTrailer() == NULL);
+
+	// Frame headers.
+	char frame[FrameHeader::Size];
+	FrameLayout::write(frame, 7, FrameHeader::FlagReliable | FrameHeader::FlagCompact, 0xDEADBEEF, 1234567890123ULL);
+	CHECK(memcmp(frame, "OFRM", 4) == 0);
+	FrameHeader header;
+	FrameLayout::read(frame, header);
+	CHECK(header.tag == FrameHeader::Tag && header.eventCount == 7 && header.sequence == 0xDEADBEEF);
+	CHECK(header.flags == (FrameHeader::FlagReliable | FrameHeader::FlagCompact) && header.time == 1234567890123ULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool sameCompactEvent(const CompactEvent& a, const CompactEvent& b)
+{
+	if(a.timestamp != b.timestamp || a.sourceId != b.sourceId || a.serviceId != b.serviceId ||
+		a.serviceType != b.serviceType || a.type != b.type || a.flags != b.flags ||
+		a.time != b.time || a.deviceTime != b.deviceTime ||
+		memcmp(a.position, b.position, sizeof(a.position)) != 0 ||
+		memcmp(a.orientation, b.orientation, sizeof(a.orientation)) != 0 ||
+		a.extraDataType != b.extraDataType || a.extraDataItems != b.extraDataItems ||
+		a.extraDataMask != b.extraDataMask || a.extraDataSize != b.extraDataSize) return false;
+	return memcmp(a.extraData.bytes, b.extraData.bytes, a.extraDataSize) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void quantizeEvent(const CompactCodec& codec, const EventData& ed, CompactEvent& evt)
+{
+	char packet[LegacyPacketSize];
+	unsigned int items;
+	int length = writeEvent(ed, packet, LegacyPacketSize, items);
+	codec.quantize(EventView(packet, length), evt);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Encodes a compact event and decodes it as the client does, looking up delta references in the
+// key table. Checks that all the truncated encodings are rejected. Returns the encoded size.
+int checkCompactEvent(const CompactCodec& codec, CompactCodec::Kind kind, const CompactEvent& evt,
+	const CompactEvent* ref, const CompactKeyTable& keys, char* buf)
+{
+	int size = codec.encode(kind, evt, ref, buf);
+	CHECK(size > 0 && size <= EventLayout::HeaderSize + evt.extraDataSize + EventLayout::TrailerSize + CompactCodec::MaxOverhead);
+
+	int fields = 0;
+	unsigned char keyId = 0;
+	int serviceId = 0;
+	unsigned int sourceId = 0;
+	int offset = CompactCodec::decodeHeader(buf, size, fields, keyId, serviceId, sourceId);
+	CHECK(offset > 0 && (fields & CompactCodec::KindMask) == kind);
+	CHECK(serviceId == evt.serviceId && sourceId == evt.sourceId);
+	if(kind == CompactCodec::Delta)
+	{
+		CHECK(keyId == ref->keyId);
+		CHECK(keys.find(serviceId, sourceId, keyId) != NULL);
+	}
+
+	CompactEvent decoded;
+	const CompactEvent* key = kind == CompactCodec::Delta ? keys.find(serviceId, sourceId, keyId) : NULL;
+	CHECK(codec.decode(buf, size, offset, fields, key, decoded));
+	decoded.keyId = kind == CompactCodec::Absolute ? evt.keyId : keyId;
+	decoded.serviceId = serviceId;
+	decoded.sourceId = sourceId;
+	CHECK(sameCompactEvent(decoded, evt));
+
+	for(int length = 0; length < size; length++)
+	{
+		offset = CompactCodec::decodeHeader(buf, length, fields, keyId, serviceId, sourceId);
+		CHECK(offset == 0 || !codec.decode(buf, length, offset, fields, key, decoded));
+	}
+	return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void checkCompactEncoding()
+{
+	CompactCodec codec;
+	CompactKeyTable keys;
+
+	// Varint and zigzag encoding, on an absolute event with only a source, service and timestamp.
+	CompactEvent evt = CompactCodec::getZeroEvent();
+	evt.sourceId = 300;
+	evt.serviceId = -2;
+	evt.timestamp = 1;
+	char buf[LegacyPacketSize + CompactCodec::MaxOverhead];
+	int size = codec.encode(CompactCodec::Absolute, evt, NULL, buf);
+	const unsigned char expected[] = { CompactCodec::Absolute, 0xAC, 0x02, 0x03, 0x02, 0x00 };
+	CHECK(size == (int)sizeof(expected) && memcmp(buf, expected, sizeof(expected)) == 0);
+
+	// Positions are fixed point deltas: 1 mm, -1 mm and 0 are 2, 1 and 0 zigzagged.
+	evt.position[0] = 1;
+	evt.position[1] = -1;
+	size = codec.encode(CompactCodec::Absolute, evt, NULL, buf);
+	const unsigned char expectedPosition[] = { CompactCodec::Absolute | CompactCodec::HasPosition,
+		0xAC, 0x02, 0x03, 0x02, 0x00, 0x02, 0x01, 0x00 };
+	CHECK(size == (int)sizeof(expectedPosition) && memcmp(buf, expectedPosition, sizeof(expectedPosition)) == 0);
+
+	// Extreme values: 5 bytes varints, negative and 64 bit time deltas.
+	evt.sourceId = 0xFFFFFFFF;
+	evt.serviceId = -2147483647 - 1;
+	evt.timestamp = 0xFFFFFFFF;
+	evt.time = 0xFFFFFFFFFFFFULL;
+	evt.deviceTime = 1;
+	evt.position[0] = CompactCodec::MaxFixed;
+	evt.position[2] = -CompactCodec::MaxFixed;
+	checkCompactEvent(codec, CompactCodec::Absolute, evt, NULL, keys, buf);
+
+	// Smallest three quaternions: decoded within the 15 bit precision, sign kept. Non unit
+	// quaternions are sent as they are.
+	const float orientations[][4] = {
+		{ 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, -1 }, { -0.5f, 0.5f, -0.5f, 0.5f },
+		{ 0.70710678f, 0.70710678f, 0, 0 }, { 0.1825742f, 0.3651484f, 0.5477226f, 0.7302967f },
+		{ -0.9f, 0.3f, 0.3f, 0.1f }, { 0.5f, 0.5f, 0.5f, 0.5f }, { 2, 0, 0, 0 }, { 0, 0, 0, 0 } };
+	int numOrientations = (int)(sizeof(orientations) / sizeof(orientations[0]));
+	for(int i = 0; i < numOrientations; i++)
+	{
+		const float* q = orientations[i];
+		double norm = sqrt((double)q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+		EventData ed = makeEvent(20 + i, EventData::ExtraDataNull, 0);
+		ed.orw = q[0]; ed.orx = q[1]; ed.ory = q[2]; ed.orz = q[3];
+		if(norm > 0.99 && norm < 1.01)
+		{
+			// Normalize, so the check does not depend on the rounding of the table values.
+			ed.orw = (float)(q[0] / norm); ed.orx = (float)(q[1] / norm);
+			ed.ory = (float)(q[2] / norm); ed.orz = (float)(q[3] / norm);
+		}
+		quantizeEvent(codec, ed, evt);
+		checkCompactEvent(codec, CompactCodec::Absolute, evt, NULL, keys, buf);
+		const float original[4] = { ed.orw, ed.orx, ed.ory, ed.orz };
+		int largest = 0;
+		for(int j = 0; j < 4; j++)
+		{
+			CHECK(fabs(evt.orientation[j] - original[j]) < 1e-4);
+			if(fabs(original[j]) > fabs(original[largest])) largest = j;
+		}
+		int orientationFields = buf[0] & (CompactCodec::HasOrientation | CompactCodec::RawOrientation);
+		if(norm > 0.99 && norm < 1.01) 
+		{
+			CHECK(orientationFields == CompactCodec::HasOrientation);
+			CHECK(evt.orientation[largest] * original[largest] > 0);
+		}
+		else
+		{
+			CHECK(orientationFields == (CompactCodec::HasOrientation | CompactCodec::RawOrientation));
+			CHECK(memcmp(evt.orientation, original, sizeof(original)) == 0);
+		}
+	}
+
+	// Keyframes and deltas: a mocap source and a skeleton, moving a bit.
+	for(int source = 0; source < 2; source++)
+	{
+		EventData ed = source == 0 ? makeEvent(40, EventData::ExtraDataNull, 0) :
+			makeEvent(41, EventData::ExtraDataVector3Array, 20);
+		CompactEvent keyframe;
+		quantizeEvent(codec, ed, keyframe);
+		keyframe.keyId = 5;
+		checkCompactEvent(codec, CompactCodec::Keyframe, keyframe, NULL, keys, buf);
+		keys.store(keyframe);
+		const CompactEvent* key = keys.find(keyframe.serviceId, keyframe.sourceId, keyframe.keyId);
+		CHECK(key != NULL && sameCompactEvent(*key, keyframe));
+
+		// Same event: only the source, service and times are sent.
+		quantizeEvent(codec, ed, evt);
+		evt.keyId = keyframe.keyId;
+		size = checkCompactEvent(codec, CompactCodec::Delta, evt, key, keys, buf);
+		CHECK(size <= 12);
+
+		// Moved event, with a header change and a device time.
+		ed.timestamp += 16;
+		ed.time += 16000;
+		ed.deviceTime = ed.time - 5000;
+		ed.posx += 0.01f;
+		ed.posz -= 0.2f;
+		ed.orw = 0.6f; ed.orx = 0.8f; ed.ory = 0; ed.orz = 0;
+		ed.flags |= EventData::Button2;
+		for(int i = 0; i < ed.getExtraDataSize() / 4; i++)
+		{
+			float value = wire::load<float>((const char*)&ed.extraData[i * 4]) + 0.001f * i;
+			wire::store<float>((char*)&ed.extraData[i * 4], value);
+		}
+		quantizeEvent(codec, ed, evt);
+		evt.keyId = keyframe.keyId;
+		checkCompactEvent(codec, CompactCodec::Delta, evt, key, keys, buf);
+
+		// Absolute events decode the same, without keyframes.
+		checkCompactEvent(codec, CompactCodec::Absolute, evt, NULL, keys, buf);
+
+		// Decoded compact events match the standard encoding, within the fixed point precision.
+		EventData decoded;
+		codec.toEventData(evt, decoded);
+		CHECK(fabs(decoded.posx - ed.posx) <= 0.5 / codec.getScale() && fabs(decoded.posz - ed.posz) <= 0.5 / codec.getScale());
+		CHECK(decoded.time == ed.time && decoded.deviceTime == ed.deviceTime && decoded.flags == ed.flags);
+		CHECK(decoded.extraDataItems == ed.extraDataItems);
+	}
+
+	// The key table keeps the keys of any number of sources, the last two keyframes of each.
+	CompactKeyTable table;
+	CompactEvent key = CompactCodec::getZeroEvent();
+	for(int keyId = 0; keyId < 3; keyId++)
+	{
+		for(unsigned int source = 0; source < 300; source++)
+		{
+			key.sourceId = source;
+			key.serviceId = (int)(source % 3);
+			key.keyId = (unsigned char)keyId;
+			table.store(key);
+		}
+	}
+	for(unsigned int source = 0; source < 300; source++)
+	{
+		int serviceId = (int)(source % 3);
+		CHECK(table.find(serviceId, source, 0) == NULL);
+		CHECK(table.find(serviceId, source, 1) != NULL && table.find(serviceId, source, 2) != NULL);
+		CHECK(table.find(serviceId + 1, source, 2) == NULL);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Parses the options written by EventFilter::toString back into filter.
+void parseFilter(const char* str, EventFilter& filter)
+{
+	char opts[EventFilter::MaxStringLength];
+	strcpy(opts, str);
+	for(char* opt = strtok(opts, " "); opt != NULL; opt = strtok(NULL, " ")) filter.parseOption(opt);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void checkHandshakeOptions()
+{
+	// The longest filter: both masks and all the source ranges, with 10 digit ids.
+	EventFilter filter;
+	filter.serviceTypes = 0x80000001;
+	filter.eventTypes = 0x80000001;
+	for(int i = 0; i < EventFilter::MaxSourceRanges; i++) filter.addSourceRange(4294967295u - i, 4294967295u);
+	CHECK(!filter.addSourceRange(0, 0));
+
+	// Guard bytes after the buffer catch writes past the given size.
+	const int Guard = 16;
+	char buf[OutputPolicy::MaxStringLength + Guard];
+	memset(buf, 'x', sizeof(buf));
+	CHECK(filter.toString(buf, EventFilter::MaxStringLength));
+	CHECK(strlen(buf) < (size_t)EventFilter::MaxStringLength);
+	CHECK(buf[EventFilter::MaxStringLength] == 'x');
+
+	EventFilter parsed;
+	parseFilter(buf, parsed);
+	CHECK(parsed.serviceTypes == filter.serviceTypes && parsed.eventTypes == filter.eventTypes);
+	CHECK(parsed.numSourceRanges == filter.numSourceRanges);
+	for(int i = 0; i < parsed.numSourceRanges; i++)
+	{
+		CHECK(parsed.sourceRanges[i][0] == filter.sourceRanges[i][0] && parsed.sourceRanges[i][1] == filter.sourceRanges[i][1]);
+	}
+
+	// A short buffer gets the whole options that fit, and nothing past its end.
+	memset(buf, 'x', sizeof(buf));
+	CHECK(!filter.toString(buf, 256));
+	CHECK(strlen(buf) < 256 && buf[256] == 'x');
+	parsed.reset();
+	parseFilter(buf, parsed);
+	CHECK(parsed.numSourceRanges > 0 && parsed.numSourceRanges < filter.numSourceRanges);
+	CHECK(parsed.accepts(0, 0, 4294967295u));
+
+	memset(buf, 'x', sizeof(buf));
+	CHECK(!filter.toString(buf, 1));
+	CHECK(buf[0] == '\0' && buf[1] == 'x');
+
+	// The longest policy: a different rate for each service type.
+	OutputPolicy policy;
+	for(int i = 0; i < OutputPolicy::MaxServiceTypes; i++) policy.setMaxRate(i, 3.4e38f / (float)(i + 1));
+	memset(buf, 'x', sizeof(buf));
+	CHECK(policy.toString(buf, OutputPolicy::MaxStringLength));
+	CHECK(strlen(buf) < (size_t)OutputPolicy::MaxStringLength);
+	CHECK(buf[OutputPolicy::MaxStringLength] == 'x');
+
+	memset(buf, 'x', sizeof(buf));
+	CHECK(!policy.toString(buf, 256));
+	CHECK(strlen(buf) < 256 && buf[256] == 'x');
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int /*argc*/, char** /*argv*/)
+{
+	if(!isLittleEndian()) printf("connectorCheck: big endian host, skipping the legacy layout checks\n");
+
+	checkWireFormat();
+	checkCompactEncoding();
+	checkHandshakeOptions();
+
+	printf("connectorCheck: %d checks, %d failed\n", sChecks, sFailures);
+	return sFailures == 0 ? 0 : 1;
+}
@@ -80,6 +80,7 @@ int main(int argc, char** argv)
 	// Start running services and listening to events.
 	ServiceManager* sm = new ServiceManager();
 	sm->setupAndStart(cfg);
+	EventCursor* events = sm->createEventCursor("eventlogger");
 
 	omsg("eventlogger start logging events...");
 	while(true)
@@ -87,17 +88,19 @@ int main(int argc, char** argv)
 		// Poll services for new events.
 		sm->poll(); 
 
-		// Get available events
-		Event evts[OMICRON_MAX_EVENTS];
-		int av;
-		if(0 != (av = sm->getEvents(evts, ServiceManager::MaxEvents)))
+		// Log available events, reading them directly from the event ring.
+		int av = events->getAvailableEvents();
+		for( int evtNum = 0; evtNum < av; evtNum++)
 		{
-			for( int evtNum = 0; evtNum < av; evtNum++)
-			{
-				logEvent(evts[evtNum]);
-			}
-		}// if
+			logEvent(*events->getEvent(evtNum));
+		}
+		events->clearEvents();
 
+		if(events->getOverruns() != 0)
+		{
+			ofwarn("eventlogger: %1% events dropped", %events->getOverruns());
+			events->resetOverruns();
+		}
 	}// while
 	
 	delete cfg;
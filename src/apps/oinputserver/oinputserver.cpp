@@ -27,6 +27,7 @@
  *************************************************************************************************/
 #include <omicron.h>
 #include "omicron/InputServer.h"
+#include "omicron/NetService.h"
 
 using namespace omicron;
 
@@ -54,8 +55,26 @@ int main(int argc, char** argv)
     ServiceManager* sm = new ServiceManager();
     sm->setupAndStart(cfg);
 
+    // The input server reads events through its own cursor, independently
+    // of other event consumers.
+    EventCursor* events = sm->createEventCursor("oinputserver");
+
     app.startConnection(cfg);
 
+    // NetService instances in relay mode forward upstream events to our
+    // clients, from the service manager poll below.
+    NetService::setRelayServer(&app);
+
+    // Wake up when a client connects or sends its handshake.
+    app.setServiceManager(sm);
+
+#ifdef OMICRON_USE_VRPN
+    // The VRPN server connection needs to be serviced continuously.
+    const int waitTimeout = 1;
+#else
+    const int waitTimeout = 100;
+#endif
+
     omsg("oinputserver: Starting to listen for clients...");
     int i = 0;
     while(true)
@@ -63,29 +82,28 @@ int main(int argc, char** argv)
         sm->poll();
         app.loop();
 
-        // Start listening for clients (non-blocking)
+        // Accept new clients and process their handshakes (non-blocking)
         app.startListening();
 
-
-		sm->poll();
-		sm->lockEvents();
-		int numEvts = sm->getAvailableEvents();
+		int numEvts = events->getAvailableEvents();
 		for(int i = 0; i < numEvts; i++)
 		{
-			Event* evt = sm->getEvent(i);
+			Event* evt = events->getEvent(i);
 			
 			app.handleEvent(evt);
-			
-			evt->setProcessed();
 		}
-#ifdef WIN32
-        Sleep(1);
-#else
-        usleep(1000);
-#endif	
+		// Send the events queued for batch mode clients.
+		app.flush();
+		// Events have been sent: move the cursor past them.
+		events->clearEvents();
+
+        // Sleep until new events come in, a device or client socket has
+        // data or some service needs to be polled.
+        sm->waitForEvents(waitTimeout);
     }
 
     sm->stop();
+    sm->destroyEventCursor(events);
     delete sm;
     delete cfg;
     delete dm;
@@ -46,26 +46,24 @@ void GestureService::setup(Setting& settings)
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void GestureService::initialize() 
 {
-	
+	// Gestures are generated from events produced by other services: run 
+	// after them, as an event filter.
+	setPollPriority(Service::PollLast);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void GestureService::poll()
 {
 	mocapManager->poll();
-	ServiceManager* serviceManager = mysInstance->getManager();
 
-	int av = serviceManager->getAvailableEvents();
-	if(av != 0)
+	// Read events through the service cursor: no copies, and events are
+	// still delivered to the other event consumers.
+	int av = getAvailableEvents();
+	for( int evtNum = 0; evtNum < av; evtNum++ )
 	{
-		// TODO: Instead of copying the event list, we can lock the main one.
-		Event evts[OMICRON_MAX_EVENTS];
-		serviceManager->getEvents(evts, OMICRON_MAX_EVENTS);
-		for( int evtNum = 0; evtNum < av; evtNum++ )
-		{
-			mocapManager->processEvent(evts[evtNum]);
-		}
+		mocapManager->processEvent(*getEvent(evtNum));
 	}
+	clearEvents();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -26,7 +26,11 @@
  * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *************************************************************************************************/
 #include "omicron/InputServer.h"
+#include "omicron/ServiceManager.h"
 #include "omicron/StringUtils.h"
+#include "omicron/Thread.h"
+#include "omicron/Atomic.h"
+#include "tinythread/tinythread.h"
 #include <vector>
 
 #include <time.h>
@@ -35,29 +39,63 @@ using namespace omicron;
 #include <stdio.h>
 
 using namespace omicron;
+using omicronConnector::FrameLayout;
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Based on Winsock UDP Server Example:
 // http://msdn.microsoft.com/en-us/library/ms740148
 // Also based on Beej's Guide to Network Programming:
 // http://beej.us/guide/bgnet/output/html/multipage/clientserver.html
+class FrameStream;
+class SendTarget;
 class NetClient
 {
 private:
-    SOCKET sendSocket;
     SOCKET msgSocket;
     sockaddr_in recvAddr;
     bool legacyMode;
+    bool batchMode;
+    bool multicastMode;
+    bool sequenceMode;
+    bool reliableMode;
+    bool sharedMemoryMode;
+    bool compactMode;
+    bool timeSyncMode;
+    int predictionLead;
     bool connected;
+    omicronConnector::EventFilter filter;
+    omicronConnector::OutputPolicy policy;
+    FrameStream* stream;
+    SendTarget* target;
 
 public:
+    // Reliable lane: sequence number of the next reliable frame the client
+    // is waiting for, and time of the next retransmission of unacknowledged 
+    // frames (0 when all frames have been acknowledged).
+    unsigned int reliableAck;
+    uint64 retransmitTime;
+    // Reliable lane messages received so far (see readMessages).
+    char messageBuffer[256];
+    int messageLength;
+
     NetClient( const char* address, int port, SOCKET clientSocket )
     {
         legacyMode = false;
+        batchMode = false;
+        multicastMode = false;
+        sequenceMode = false;
+        reliableMode = false;
+        sharedMemoryMode = false;
+        compactMode = false;
+        timeSyncMode = false;
+        predictionLead = 0;
         connected = true;
-
-        // Create a UDP socket for sending data
-        sendSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        stream = NULL;
+        target = NULL;
+        reliableAck = 0;
+        retransmitTime = 0;
+        messageLength = 0;
 
         // Set up the RecvAddr structure with the IP address of
         // the receiver
@@ -72,10 +110,20 @@ public:
     NetClient( const char* address, int port, int legacy, SOCKET clientSocket )
     {
         legacyMode = legacy;
+        batchMode = false;
+        multicastMode = false;
+        sequenceMode = false;
+        reliableMode = false;
+        sharedMemoryMode = false;
+        compactMode = false;
+        timeSyncMode = false;
+        predictionLead = 0;
         connected = true;
-
-        // Create a UDP socket for sending data
-        sendSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        stream = NULL;
+        target = NULL;
+        reliableAck = 0;
+        retransmitTime = 0;
+        messageLength = 0;
 
         // Set up the RecvAddr structure with the IP address of
         // the receiver
@@ -95,124 +143,1789 @@ public:
         }
     }// CTOR
 
-    void sendEvent(char* eventPacket, int length)
+    void sendMsg(char* eventPacket, int length)
     {
-        // Send a datagram to the receiver
-        sendto(sendSocket, 
+        // Ping the client to see if still active
+        int result = sendto(msgSocket, 
             eventPacket, 
             length, 
             0,
             (const struct sockaddr*)&recvAddr,
             sizeof(recvAddr));
-    }// SendEvent
 
-    void sendMsg(char* eventPacket, int length)
+        if( result == SOCKET_ERROR )
+        {
+            connected = false;
+        }
+    }// SendMsg
+
+    void setLegacy(bool value)
+    {
+        legacyMode = value;
+    }// setLegacy
+
+    bool isLegacy()
+    {
+        return legacyMode;
+    }// isLegacy
+
+    // Parses the handshake options sent by the client (space separated)
+    void setOptions(const char* options)
+    {
+        batchMode = false;
+        multicastMode = false;
+        sequenceMode = false;
+        reliableMode = false;
+        sharedMemoryMode = false;
+        compactMode = false;
+        timeSyncMode = false;
+        predictionLead = 0;
+        filter.reset();
+        policy.reset();
+
+        char* opts = strdup(options);
+        for(char* opt = strtok(opts, " "); opt != NULL; opt = strtok(NULL, " "))
+        {
+            if(strcmp(opt, "batch") == 0) batchMode = true;
+            else if(strcmp(opt, "multicast") == 0) multicastMode = true;
+            else if(strcmp(opt, "seq") == 0) sequenceMode = true;
+            else if(strcmp(opt, "reliable") == 0) reliableMode = true;
+            else if(strcmp(opt, "shm") == 0) sharedMemoryMode = true;
+            else if(strcmp(opt, "compact") == 0) compactMode = true;
+            else if(strcmp(opt, "time") == 0) timeSyncMode = true;
+            else if(sscanf(opt, "lead=%d", &predictionLead) == 1) continue;
+            else if(filter.parseOption(opt)) continue;
+            else if(!policy.parseOption(opt)) printf("NetClient: unknown option '%s'\n", opt);
+        }
+        free(opts);
+
+        if( batchMode ) printf("NetClient: batch mode enabled\n");
+        if( !filter.isEmpty() )
+        {
+            char filterStr[omicronConnector::EventFilter::MaxStringLength];
+            filter.toString(filterStr, sizeof(filterStr));
+            printf("NetClient: subscription%s\n", filterStr);
+        }
+    }// setOptions
+
+    const omicronConnector::EventFilter& getFilter()
+    {
+        return filter;
+    }// getFilter
+
+    // Output rate limits. Ignored for multicast clients.
+    void setPolicy(const omicronConnector::OutputPolicy& value)
+    {
+        policy = value;
+    }// setPolicy
+
+    const omicronConnector::OutputPolicy& getPolicy()
+    {
+        return policy;
+    }// getPolicy
+
+    // The stream used to send events to this client.
+    void setStream(FrameStream* value)
+    {
+        stream = value;
+    }// setStream
+
+    FrameStream* getStream()
+    {
+        return stream;
+    }// getStream
+
+    // The send statistics and address used by the sender.
+    void setTarget(SendTarget* value)
+    {
+        target = value;
+    }// setTarget
+
+    SendTarget* getTarget()
+    {
+        return target;
+    }// getTarget
+
+    bool isBatch()
+    {
+        return batchMode;
+    }// isBatch
+
+    // Sequenced clients get frames (with a sequence number) even when not 
+    // in batch mode. Batch mode frames are always sequenced.
+    bool isSequenced()
+    {
+        return sequenceMode || batchMode;
+    }// isSequenced
+
+    // Reliable clients acknowledge discrete events through the message 
+    // socket, and get them retransmitted when lost.
+    bool isReliable()
+    {
+        return reliableMode;
+    }// isReliable
+
+    // Shared memory clients run on the server machine, and read all the 
+    // events from the server shared memory ring. Other options are ignored.
+    void setSharedMemory(bool value)
+    {
+        sharedMemoryMode = value;
+        if( value )
+        {
+            batchMode = false;
+            sequenceMode = false;
+            reliableMode = false;
+            multicastMode = false;
+            compactMode = false;
+        }
+    }// setSharedMemory
+
+    bool isSharedMemory()
+    {
+        return sharedMemoryMode;
+    }// isSharedMemory
+
+    // Compact clients get continuous events in the compact encoding. 
+    // Keyframes are sent on the reliable lane, so compact clients must be
+    // reliable. The multicast stream always uses the standard encoding.
+    void setCompact(bool value)
+    {
+        compactMode = value;
+    }// setCompact
+
+    bool isCompact()
+    {
+        return compactMode && reliableMode && !multicastMode && !sharedMemoryMode && getPredictionLead() == 0;
+    }// isCompact
+
+    // Predicted clients get mocap and wand poses extrapolated predictionLead
+    // microseconds in the future. The multicast and shared memory streams 
+    // always carry raw poses. Predicted clients use the standard encoding,
+    // which also carries the raw pose.
+    void setPredictionLead(int value)
+    {
+        predictionLead = value;
+    }// setPredictionLead
+
+    int getPredictionLead()
+    {
+        return (multicastMode || sharedMemoryMode || predictionLead < 0) ? 0 : predictionLead;
+    }// getPredictionLead
+
+    // Time sync clients estimate their clock offset from the server one,
+    // sending 'omicron_time' requests through the message socket.
+    bool isTimeSync()
+    {
+        return timeSyncMode;
+    }// isTimeSync
+
+    // Returns true if the client sends messages through the message socket.
+    bool hasMessages()
+    {
+        return reliableMode || timeSyncMode;
+    }// hasMessages
+
+    // The TCP connection the client sent its handshake on.
+    SOCKET getMessageSocket()
+    {
+        return msgSocket;
+    }// getMessageSocket
+
+    void setMessageSocket(SOCKET value)
+    {
+        msgSocket = value;
+    }// setMessageSocket
+
+    void setConnected(bool value)
+    {
+        connected = value;
+    }// setConnected
+
+    // Reads the messages sent by the client through the message socket. 
+    // Returns the number of complete lines stored in lines (separated by 
+    // null characters), or -1 if the client closed the connection.
+    int readMessages(char* lines, int size)
+    {
+        int numLines = 0;
+        int linesLength = 0;
+        while( true )
+        {
+            int result = recv(msgSocket, &messageBuffer[messageLength], sizeof(messageBuffer) - 1 - messageLength, 0);
+            if( result == 0 || (result < 0 && !SOCKET_WOULD_BLOCK()) )
+                return -1;
+            if( result < 0 )
+                break;
+            messageLength += result;
+
+            // Extract the complete lines.
+            char* line = messageBuffer;
+            char* end;
+            while( (end = (char*)memchr(line, '\n', messageLength - (line - messageBuffer))) != NULL )
+            {
+                *end = '\0';
+                int len = (int)(end - line) + 1;
+                if( linesLength + len <= size )
+                {
+                    memcpy(&lines[linesLength], line, len);
+                    linesLength += len;
+                    numLines++;
+                }
+                line = end + 1;
+            }
+            messageLength -= (int)(line - messageBuffer);
+            memmove(messageBuffer, line, messageLength);
+
+            // Drop overlong lines.
+            if( messageLength == sizeof(messageBuffer) - 1 )
+                messageLength = 0;
+        }
+        return numLines;
+    }// readMessages
+
+    // Multicast clients receive frames through the server multicast group
+    void setMulticast(bool value)
+    {
+        multicastMode = value;
+    }// setMulticast
+
+    bool isMulticast()
+    {
+        return multicastMode;
+    }// isMulticast
+
+    bool isConnected()
+    {
+        return connected;
+    }// isConnected
+
+    const sockaddr_in& getAddress()
+    {
+        return recvAddr;
+    }// getAddress
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Enforces an output policy: continuous events (Update, Move) of rate limited
+// service types are held, and only the latest one for each source is sent 
+// when the service type timer expires. Other events are never held.
+class RateLimiter
+{
+private:
+    struct PendingEvent
+    {
+        unsigned int serviceType;
+        bool pending;
+        int length;
+        char packet[InputServer::EventPacketSize];
+    };
+
+    // Minimum interval between updates, and next update time, for each
+    // service type (in microseconds).
+    unsigned long long interval[omicronConnector::OutputPolicy::MaxServiceTypes];
+    unsigned long long nextTime[omicronConnector::OutputPolicy::MaxServiceTypes];
+    int pendingCount[omicronConnector::OutputPolicy::MaxServiceTypes];
+
+    // Latest held event for each service type / source id. Entries are 
+    // allocated once and reused.
+    std::map<unsigned long long, PendingEvent*> events;
+
+public:
+    RateLimiter( const omicronConnector::OutputPolicy& policy )
+    {
+        for(int i = 0; i < omicronConnector::OutputPolicy::MaxServiceTypes; i++)
+        {
+            float rate = policy.getMaxRate(i);
+            interval[i] = rate > 0 ? (unsigned long long)(1000000.0f / rate) : 0;
+            nextTime[i] = 0;
+            pendingCount[i] = 0;
+        }
+    }// CTOR
+
+    ~RateLimiter()
+    {
+        std::map<unsigned long long, PendingEvent*>::iterator itr;
+        for( itr = events.begin(); itr != events.end(); itr++ )
+            delete itr->second;
+    }// DTOR
+
+    // Returns true if the event packet has been held, and should not be 
+    // sent now.
+    bool hold(const Event* evt, const char* packet, int length)
+    {
+        unsigned int serviceType = evt->getServiceType();
+        if( serviceType >= omicronConnector::OutputPolicy::MaxServiceTypes || interval[serviceType] == 0 )
+            return false;
+
+        unsigned long long key = ((unsigned long long)serviceType << 32) | evt->getSourceId();
+        std::map<unsigned long long, PendingEvent*>::iterator itr = events.find(key);
+
+        if( !omicronConnector::OutputPolicy::isContinuous(evt->getType(), evt->getExtraDataType()) )
+        {
+            // The event is sent right away, and is newer than the held one.
+            if( itr != events.end() && itr->second->pending )
+            {
+                itr->second->pending = false;
+                pendingCount[serviceType]--;
+            }
+            return false;
+        }
+
+        PendingEvent* pe;
+        if( itr != events.end() )
+        {
+            pe = itr->second;
+        }
+        else
+        {
+            pe = new PendingEvent();
+            pe->serviceType = serviceType;
+            pe->pending = false;
+            memset(pe->packet, 0, InputServer::EventPacketSize);
+            events[key] = pe;
+        }
+        if( !pe->pending )
+        {
+            pe->pending = true;
+            pendingCount[serviceType]++;
+        }
+        memcpy(pe->packet, packet, length);
+        pe->length = length;
+        return true;
+    }// hold
+
+    // Collects the held events whose service type timer expired.
+    void release(unsigned long long now, std::vector<const char*>& packets, std::vector<int>& lengths)
+    {
+        bool due[omicronConnector::OutputPolicy::MaxServiceTypes];
+        bool anyDue = false;
+        for(int i = 0; i < omicronConnector::OutputPolicy::MaxServiceTypes; i++)
+        {
+            due[i] = pendingCount[i] > 0 && now >= nextTime[i];
+            if( due[i] )
+            {
+                // Keep a steady rate, without bursts after idle periods.
+                nextTime[i] = (now - nextTime[i] < interval[i]) ? nextTime[i] + interval[i] : now + interval[i];
+                pendingCount[i] = 0;
+                anyDue = true;
+            }
+        }
+        if( !anyDue ) return;
+
+        std::map<unsigned long long, PendingEvent*>::iterator itr;
+        for( itr = events.begin(); itr != events.end(); itr++ )
+        {
+            PendingEvent* pe = itr->second;
+            if( pe->pending && due[pe->serviceType] )
+            {
+                pe->pending = false;
+                packets.push_back(pe->packet);
+                lengths.push_back(pe->length);
+            }
+        }
+    }// release
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Sends discrete events as reliable frames: each event gets its own frame, 
+// marked with FrameHeader::FlagReliable and numbered with a separate sequence.
+// The last frames are kept, to be retransmitted to clients that did not
+// acknowledge them.
+class ReliableLane
+{
+public:
+    static const int HistorySize = 256;
+    static const int MaxEventSize = InputServer::EventPacketSize + omicronConnector::CompactCodec::MaxOverhead;
+    static const int SlotSize = omicronConnector::FrameHeader::Size + 2 + MaxEventSize;
+
+    ReliableLane(): sequence(0)
+    {
+        frames = new char[HistorySize * SlotSize];
+    }// CTOR
+
+    ~ReliableLane()
+    {
+        delete[] frames;
+    }// DTOR
+
+    // Creates the reliable frame for an event packet. Returns the frame.
+    const char* add(const char* packet, int length, int& frameLength, 
+        unsigned short flags = omicronConnector::FrameHeader::FlagReliable)
+    {
+        if( length > MaxEventSize ) length = MaxEventSize;
+        int slot = sequence % HistorySize;
+        char* frame = &frames[slot * SlotSize];
+
+        FrameLayout::write(frame, 1, flags, sequence, otimestamp());
+        int offset = FrameLayout::Size;
+        FrameLayout::EventSize::write(&frame[offset], (unsigned short)length);
+        offset += FrameLayout::EventSize::End;
+        memcpy(&frame[offset], packet, length);
+        offset += length;
+
+        lengths[slot] = offset;
+        sequence++;
+        frameLength = offset;
+        return frame;
+    }// add
+
+    // Returns a frame sent before, or NULL if it is not available anymore.
+    const char* get(unsigned int frameSequence, int& frameLength)
+    {
+        int age = (int)(sequence - frameSequence);
+        if( age <= 0 || age > HistorySize )
+            return NULL;
+        int slot = frameSequence % HistorySize;
+        frameLength = lengths[slot];
+        return &frames[slot * SlotSize];
+    }// get
+
+    // Sequence number of the next frame.
+    unsigned int getSequence()
+    {
+        return sequence;
+    }// getSequence
+
+    // Oldest frame that can still be retransmitted.
+    unsigned int getOldestSequence()
+    {
+        return sequence > (unsigned int)HistorySize ? sequence - HistorySize : 0;
+    }// getOldestSequence
+
+private:
+    unsigned int sequence;
+    char* frames;
+    int lengths[HistorySize];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Keyframes of a source, for compact streams. keys[current] has been 
+// acknowledged by all the stream clients, and continuous events of the source
+// are sent as deltas against it. keys[pending] has been sent on the reliable 
+// lane, with sequence number pendingSequence, and is not acknowledged yet.
+struct CompactSource
+{
+    CompactSource(): current(-1), pending(-1), pendingSequence(0), keyTime(0), nextKeyId(0) {}
+
+    omicronConnector::CompactEvent keys[2];
+    int current;
+    int pending;
+    unsigned int pendingSequence;
+    // Time the last keyframe was sent (microseconds).
+    uint64 keyTime;
+    unsigned char nextKeyId;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A pose extrapolated by PosePredictor, lead microseconds past the send time.
+struct PredictedPose
+{
+    Vector3f position;
+    Quaternion orientation;
+    int lead;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Estimates the linear and angular velocity of mocap and wand sources, to 
+// send their poses extrapolated to a lead time. The motion of each source is
+// modeled as a constant twist in the source frame, and poses are extrapolated
+// along the corresponding screw motion (the SE(3) exponential): a tracked 
+// head turning while it moves follows an arc, not a straight line.
+class PosePredictor
+{
+private:
+    struct Source
+    {
+        Vector3f position;
+        Quaternion orientation;
+        // Sample time (device time when available) and server time of the
+        // last event (microseconds).
+        uint64 sampleTime;
+        uint64 time;
+        // Smoothed twist, in the source frame (units and radians per second).
+        Vector3f velocity;
+        Vector3f angularVelocity;
+    };
+
+    // Velocities are reset when a source has not been updated for this long
+    // (microseconds).
+    static const int MaxGap = 100000;
+
+    std::map<uint64, Source*> sources;
+    // Weight of the newest velocity sample, between 0 and 1.
+    double smoothing;
+    // Maximum extrapolation time (microseconds).
+    int maxLead;
+
+public:
+    PosePredictor( double velocitySmoothing, int maxLeadTime ): 
+        smoothing(velocitySmoothing), maxLead(maxLeadTime)
+    {
+    }// CTOR
+
+    ~PosePredictor()
+    {
+        std::map<uint64, Source*>::iterator itr;
+        for( itr = sources.begin(); itr != sources.end(); itr++ )
+            delete itr->second;
+    }// DTOR
+
+    int getMaxLead()
+    {
+        return maxLead;
+    }// getMaxLead
+
+    // Only continuous mocap and wand events are predicted.
+    static bool isPredictable(const Event* evt)
+    {
+        return (evt->getServiceType() == Service::Mocap || evt->getServiceType() == Service::Wand) &&
+            omicronConnector::OutputPolicy::isContinuous(evt->getType(), evt->getExtraDataType());
+    }// isPredictable
+
+    // Updates the velocity estimate of the event source.
+    void update(const Event* evt)
+    {
+        uint64 key = ((uint64)(uint)evt->getServiceId() << 32) | evt->getSourceId();
+        Source*& source = sources[key];
+        if( source == NULL )
+        {
+            source = new Source();
+            source->sampleTime = 0;
+        }
+
+        uint64 sampleTime = evt->getDeviceTime() != 0 ? evt->getDeviceTime() : evt->getTime();
+        Quaternion orientation = evt->getOrientation();
+        if( orientation.squaredNorm() < 1e-12 )
+            orientation = Quaternion::Identity();
+        orientation.normalize();
+
+        if( source->sampleTime == 0 || sampleTime < source->sampleTime || 
+            sampleTime - source->sampleTime > (uint64)MaxGap )
+        {
+            source->velocity = Vector3f::Zero();
+            source->angularVelocity = Vector3f::Zero();
+        }
+        else if( sampleTime > source->sampleTime )
+        {
+            // Twist taking the previous pose to the new one (SE(3) log of
+            // the relative pose), in the previous source frame.
+            double dt = (double)(sampleTime - source->sampleTime) / 1000000;
+            Quaternion inverse = source->orientation.conjugate();
+            Vector3f rotation = log(inverse * orientation);
+            Vector3f translation = applyInverseV(rotation, inverse * (evt->getPosition() - source->position));
+            source->velocity += smoothing * (translation / dt - source->velocity);
+            source->angularVelocity += smoothing * (rotation / dt - source->angularVelocity);
+        }
+
+        source->position = evt->getPosition();
+        source->orientation = orientation;
+        source->sampleTime = sampleTime;
+        source->time = evt->getTime();
+    }// update
+
+    // Extrapolates the pose of the event source lead microseconds past now.
+    // Returns false if the source is unknown.
+    bool predict(const Event* evt, int lead, uint64 now, PredictedPose& pose)
+    {
+        uint64 key = ((uint64)(uint)evt->getServiceId() << 32) | evt->getSourceId();
+        std::map<uint64, Source*>::iterator itr = sources.find(key);
+        if( itr == sources.end() )
+            return false;
+        Source* source = itr->second;
+
+        // The event already waited in the server for a while.
+        long long interval = (long long)(now - source->time) + lead;
+        if( interval > maxLead ) interval = maxLead;
+        if( interval < 0 ) interval = 0;
+        double t = (double)interval / 1000000;
+
+        // SE(3) exponential of the twist over the interval.
+        Vector3f rotation = source->angularVelocity * t;
+        Vector3f translation = applyV(rotation, source->velocity * t);
+        pose.position = source->position + source->orientation * translation;
+        pose.orientation = source->orientation * exp(rotation);
+        pose.orientation.normalize();
+        pose.lead = lead;
+        return true;
+    }// predict
+
+private:
+    // Rotation vector (axis * angle) of a quaternion, and its inverse.
+    static Vector3f log(const Quaternion& q)
+    {
+        // Take the shortest rotation.
+        double sign = q.w() < 0 ? -1 : 1;
+        Vector3f v(q.x() * sign, q.y() * sign, q.z() * sign);
+        double s = v.norm();
+        if( s < 1e-9 )
+            return v * 2;
+        return v * (2 * atan2(s, q.w() * sign) / s);
+    }// log
+
+    static Quaternion exp(const Vector3f& rotation)
+    {
+        double angle = rotation.norm();
+        if( angle < 1e-9 )
+            return Quaternion(1, rotation.x() / 2, rotation.y() / 2, rotation.z() / 2);
+        Vector3f v = rotation * (sin(angle / 2) / angle);
+        return Quaternion(cos(angle / 2), v.x(), v.y(), v.z());
+    }// exp
+
+    // Computes V * x, where V is the matrix coupling rotation and translation
+    // in the SE(3) exponential: V = I + B [r]x + C [r]x^2.
+    static Vector3f applyV(const Vector3f& rotation, const Vector3f& x)
+    {
+        double angle2 = rotation.squaredNorm();
+        double b, c;
+        if( angle2 < 1e-8 )
+        {
+            b = 0.5 - angle2 / 24;
+            c = 1.0 / 6 - angle2 / 120;
+        }
+        else
+        {
+            double angle = sqrt(angle2);
+            b = (1 - cos(angle)) / angle2;
+            c = (angle - sin(angle)) / (angle2 * angle);
+        }
+        Vector3f rx = rotation.cross(x);
+        return x + b * rx + c * rotation.cross(rx);
+    }// applyV
+
+    // Computes V^-1 * x (see applyV): V^-1 = I - 1/2 [r]x + D [r]x^2.
+    static Vector3f applyInverseV(const Vector3f& rotation, const Vector3f& x)
+    {
+        double angle2 = rotation.squaredNorm();
+        double d;
+        if( angle2 < 1e-8 )
+        {
+            d = 1.0 / 12 + angle2 / 720;
+        }
+        else
+        {
+            double angle = sqrt(angle2);
+            d = (1 - angle * sin(angle) / (2 * (1 - cos(angle)))) / angle2;
+        }
+        Vector3f rx = rotation.cross(x);
+        return x - 0.5 * rx + d * rotation.cross(rx);
+    }// applyInverseV
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Clients with the same options (mode, subscription and output policy) share
+// a stream: each event is filtered, rate limited and serialized once, then 
+// sent to all of them. Batch mode streams pack events into frames. Multicast
+// clients share a single unfiltered stream, sent to the multicast group.
+// Sequenced single event streams send a frame for each event. Streams of 
+// reliable clients, and multicast streams, send discrete events through a 
+// reliable lane. Shared memory clients share an unfiltered stream, written
+// to the shared memory ring. Compact streams send continuous events in the
+// compact encoding, and keyframes through the reliable lane. Predicted 
+// streams send mocap and wand poses extrapolated to the stream lead time.
+class FrameStream
+{
+public:
+    FrameStream( unsigned int streamId, const char* streamKey, const omicronConnector::EventFilter& streamFilter, 
+        const omicronConnector::OutputPolicy& policy, bool batchStream, bool singleEventStream, bool multicastStream ):
+        id(streamId), key(streamKey), filter(streamFilter), limiter(NULL), batch(batchStream), 
+        singleEvent(singleEventStream), multicast(multicastStream), sharedMemory(false),
+        multicastTarget(NULL), length(0), events(0), sequence(0), reliable(NULL), compact(false), 
+        reliableAck(0), lead(0), clients(0)
+    {
+        if( !policy.isEmpty() )
+            limiter = new RateLimiter(policy);
+    }// CTOR
+
+    ~FrameStream()
+    {
+        delete limiter;
+        delete reliable;
+        std::map<uint64, CompactSource*>::iterator itr;
+        for( itr = compactSources.begin(); itr != compactSources.end(); itr++ )
+            delete itr->second;
+    }// DTOR
+
+    // Forgets the keyframes sent so far: new keyframes are sent for all
+    // the sources. Keyframe ids keep increasing, so clients never mistake
+    // an old keyframe for a new one.
+    void resetCompactSources()
+    {
+        std::map<uint64, CompactSource*>::iterator itr;
+        for( itr = compactSources.begin(); itr != compactSources.end(); itr++ )
+        {
+            itr->second->current = -1;
+            itr->second->pending = -1;
+        }
+    }// resetCompactSources
+
+    // Forgets the pending keyframes sent in the specified reliable frames, 
+    // lost before all the clients got them: new keyframes are sent for 
+    // their sources.
+    void resetLostKeyframes(unsigned int firstSequence, int count)
+    {
+        std::map<uint64, CompactSource*>::iterator itr;
+        for( itr = compactSources.begin(); itr != compactSources.end(); itr++ )
+        {
+            CompactSource* source = itr->second;
+            if( source->pending >= 0 && (unsigned int)(source->pendingSequence - firstSequence) < (unsigned int)count )
+                source->pending = -1;
+        }
+    }// resetLostKeyframes
+
+    unsigned int id;
+    std::string key;
+    omicronConnector::EventFilter filter;
+    RateLimiter* limiter;
+    // Events are sent in frames
+    bool batch;
+    // Frames contain a single event
+    bool singleEvent;
+    bool multicast;
+    bool sharedMemory;
+    // The multicast group address, for multicast streams.
+    SendTarget* multicastTarget;
+
+    // The frame being built
+    char buffer[omicronConnector::FrameHeader::MaxFrameSize];
+    int length;
+    int events;
+    unsigned int sequence;
+
+    // Discrete events lane, for reliable streams.
+    ReliableLane* reliable;
+
+    // Compact encoding keyframes, by service and source id. reliableAck is 
+    // the reliable frame sequence acknowledged by all the stream clients.
+    bool compact;
+    std::map<uint64, CompactSource*> compactSources;
+    unsigned int reliableAck;
+
+    // Pose prediction lead time (microseconds), 0 for raw poses.
+    int lead;
+
+    // Number of clients using this stream
+    int clients;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A datagram destination: a client, or the multicast group. Statistics are 
+// updated by the sender and can be read from any thread.
+class SendTarget
+{
+public:
+    SendTarget( const sockaddr_in& targetAddr, SOCKET targetSocket, unsigned int targetStream ):
+        addr(targetAddr), socket(targetSocket), stream(targetStream), 
+        datagrams(0), bytes(0), errors(0)
+    {
+    }// CTOR
+
+    sockaddr_in addr;
+    SOCKET socket;
+    unsigned int stream;
+
+    volatile uint datagrams;
+    volatile uint64 bytes;
+    volatile uint errors;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Sends datagrams to the targets of a stream. When a queue size is specified,
+// datagrams are copied to a single producer / single consumer ring and sent 
+// by a dedicated thread. Otherwise, they are sent right away. 
+// send and the target functions should be called by a single thread.
+class DatagramSender: public Thread
+{
+public:
+    DatagramSender( SOCKET sendSocket, int maxDatagramSize, int queueSize ):
+        socket(sendSocket), slotSize(maxDatagramSize), slots(NULL), lengths(NULL), streams(NULL),
+        numSlots(0), head(0), tail(0), overruns(0), running(false), sleeping(0)
+    {
+        if( queueSize > 0 )
+        {
+            // Use a power of two number of slots, so ring positions can wrap 
+            // around safely.
+            numSlots = 1;
+            while( numSlots < queueSize ) numSlots *= 2;
+            slots = new char[numSlots * slotSize];
+            lengths = new int[numSlots];
+            streams = new unsigned int[numSlots];
+
+            running = true;
+            start();
+        }
+    }// CTOR
+
+    ~DatagramSender()
+    {
+        if( running )
+        {
+            signal.lock();
+            running = false;
+            wakeCondition.notify_one();
+            signal.unlock();
+            stop();
+        }
+        delete[] slots;
+        delete[] lengths;
+        delete[] streams;
+    }// DTOR
+
+    void addTarget(SendTarget* target)
+    {
+        targetLock.lock();
+        targets[target->stream].push_back(target);
+        targetLock.unlock();
+    }// addTarget
+
+    // After this call returns the target is not used by the sender anymore,
+    // and can be deleted.
+    void removeTarget(SendTarget* target)
+    {
+        targetLock.lock();
+        std::vector<SendTarget*>& st = targets[target->stream];
+        for( unsigned int i = 0; i < st.size(); i++ )
+        {
+            if( st[i] == target )
+            {
+                st.erase(st.begin() + i);
+                break;
+            }
+        }
+        if( st.empty() ) targets.erase(target->stream);
+        targetLock.unlock();
+    }// removeTarget
+
+    void send(unsigned int stream, const char* data, int length)
+    {
+        if( numSlots == 0 )
+        {
+            targetLock.lock();
+            sendNow(stream, data, length);
+            targetLock.unlock();
+            return;
+        }
+
+        // When the ring is full the datagram is dropped: the caller never 
+        // waits for the network.
+        uint h = head;
+        if( h - oatomicload(&tail) >= (uint)numSlots )
+        {
+            overruns++;
+            return;
+        }
+
+        int slot = h & (numSlots - 1);
+        if( length > slotSize ) length = slotSize;
+        memcpy(&slots[slot * slotSize], data, length);
+        lengths[slot] = length;
+        streams[slot] = stream;
+        oatomicstore(&head, h + 1);
+
+        // Wake up the sender thread if it is waiting for datagrams.
+        oatomicfence();
+        if( sleeping )
+        {
+            signal.lock();
+            wakeCondition.notify_one();
+            signal.unlock();
+        }
+    }// send
+
+    // Number of datagrams waiting to be sent.
+    int getQueueDepth()
+    {
+        return (int)(oatomicload(&head) - oatomicload(&tail));
+    }// getQueueDepth
+
+    // Number of datagrams dropped because the queue was full.
+    uint getOverruns()
+    {
+        return overruns;
+    }// getOverruns
+
+    virtual void threadProc()
+    {
+        while( true )
+        {
+            uint t = tail;
+            if( t == oatomicload(&head) )
+            {
+                // Nothing to send: sleep until the producer signals. The 
+                // queue is checked again after setting the sleeping flag, so
+                // datagrams queued in the meantime are not missed.
+                signal.lock();
+                sleeping = 1;
+                oatomicfence();
+                while( running && t == oatomicload(&head) )
+                    wakeCondition.wait(signal);
+                sleeping = 0;
+                bool stopped = !running;
+                signal.unlock();
+                if( stopped ) return;
+                continue;
+            }
+
+            targetLock.lock();
+            uint h = oatomicload(&head);
+            while( t != h )
+            {
+                int slot = t & (numSlots - 1);
+                sendNow(streams[slot], &slots[slot * slotSize], lengths[slot]);
+                t++;
+            }
+            targetLock.unlock();
+            oatomicstore(&tail, t);
+        }
+    }// threadProc
+
+private:
+    void sendNow(unsigned int stream, const char* data, int length)
+    {
+        std::map<unsigned int, std::vector<SendTarget*> >::iterator itr = targets.find(stream);
+        if( itr == targets.end() )
+            return;
+        std::vector<SendTarget*>& st = itr->second;
+
+#ifdef OMICRON_USE_SENDMMSG
+        if( socket != INVALID_SOCKET && st.size() > 1 )
+        {
+            // All messages point to the same datagram buffer.
+            struct iovec iov;
+            iov.iov_base = (void*)data;
+            iov.iov_len = length;
+
+            messages.resize(st.size());
+            for( unsigned int i = 0; i < st.size(); i++ )
+            {
+                struct mmsghdr& msg = messages[i];
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_hdr.msg_name = (void*)&st[i]->addr;
+                msg.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                msg.msg_hdr.msg_iov = &iov;
+                msg.msg_hdr.msg_iovlen = 1;
+            }
+
+            // sendmmsg may send less messages than requested: keep going 
+            // until all have been sent. Failing destinations are skipped.
+            int numMessages = (int)st.size();
+            int sent = 0;
+            while( sent < numMessages )
+            {
+                int result = sendmmsg(socket, &messages[sent], numMessages - sent, 0);
+                if( result <= 0 )
+                {
+                    st[sent]->errors++;
+                    sent++;
+                    continue;
+                }
+                for( int i = sent; i < sent + result; i++ )
+                {
+                    st[i]->datagrams++;
+                    st[i]->bytes += length;
+                }
+                sent += result;
+            }
+            return;
+        }
+#endif
+
+        // Portable path: one sendto call per target.
+        for( unsigned int i = 0; i < st.size(); i++ )
+        {
+            SendTarget* target = st[i];
+            int result = sendto(target->socket, 
+                data, 
+                length, 
+                0,
+                (const struct sockaddr*)&target->addr,
+                sizeof(target->addr));
+            if( result == SOCKET_ERROR )
+            {
+                target->errors++;
+            }
+            else
+            {
+                target->datagrams++;
+                target->bytes += length;
+            }
+        }
+    }// sendNow
+
+private:
+    SOCKET socket;
+
+    // Datagram ring. Written by the producer at head and read by the sender
+    // thread at tail.
+    int slotSize;
+    char* slots;
+    int* lengths;
+    unsigned int* streams;
+    int numSlots;
+    volatile uint head;
+    volatile uint tail;
+    uint overruns;
+
+    // Sender thread wakeup.
+    bool running;
+    volatile uint sleeping;
+    tthread::mutex signal;
+    tthread::condition_variable wakeCondition;
+
+    // Datagram targets, by stream id.
+    Lock targetLock;
+    std::map<unsigned int, std::vector<SendTarget*> > targets;
+#ifdef OMICRON_USE_SENDMMSG
+    std::vector<struct mmsghdr> messages;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A client connection waiting for its handshake.
+class PendingConnection
+{
+public:
+    PendingConnection( SOCKET clientSocket, const char* clientAddress, uint64 handshakeDeadline ):
+        socket(clientSocket), length(0), deadline(handshakeDeadline)
+    {
+        strncpy(address, clientAddress, sizeof(address) - 1);
+        address[sizeof(address) - 1] = '\0';
+    }// CTOR
+
+    SOCKET socket;
+    char address[32];
+    // Handshake data received so far.
+    char buffer[InputServer::EventPacketSize];
+    int length;
+    // Time after which the connection is dropped, if the handshake did not
+    // arrive (in microseconds, see otimestamp).
+    uint64 deadline;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Encodes an Omicron event into buffer. Extra data that does not fit into 
+// capacity bytes is truncated. When a predicted pose is specified, it replaces
+// the event pose, and the event pose is sent in the prediction trailer.
+// Returns the encoded event size.
+static int encodeEvent(const Event* evt, char* buffer, int capacity, const PredictedPose* prediction = NULL)
+{
+    omicronConnector::EventWriter writer(buffer, capacity);
+    writer.setHeader(evt->getTimestamp(), evt->getSourceId(), evt->getServiceId(), 
+        evt->getServiceType(), evt->getType(), evt->getFlags());
+    const Vector3f& pos = prediction != NULL ? prediction->position : evt->getPosition();
+    writer.setPosition(pos.x(), pos.y(), pos.z());
+    const Quaternion& orient = prediction != NULL ? prediction->orientation : evt->getOrientation();
+    writer.setOrientation(orient.w(), orient.x(), orient.y(), orient.z());
+    if( evt->getExtraDataType() != Event::ExtraDataNull )
+    {
+        writer.setExtraData(evt->getExtraDataType(), evt->getExtraDataItems(), 
+            evt->getExtraDataMask(), evt->getExtraDataBuffer());
+    }
+    else
+    {
+        writer.setExtraData(Event::ExtraDataNull, evt->getExtraDataItems(), evt->getExtraDataMask(), NULL);
+    }
+
+    // Append the 64 bit event creation and device capture times, marked by 
+    // a tag. Older clients ignore anything following the extra data.
+    writer.setTimes(evt->getTime(), evt->getDeviceTime());
+    if( prediction != NULL )
+    {
+        const Vector3f& rawPos = evt->getPosition();
+        const Quaternion& rawOrient = evt->getOrientation();
+        float rawPosition[3] = { (float)rawPos.x(), (float)rawPos.y(), (float)rawPos.z() };
+        float rawOrientation[4] = { (float)rawOrient.w(), (float)rawOrient.x(), (float)rawOrient.y(), (float)rawOrient.z() };
+        writer.setPrediction(prediction->lead, rawPosition, rawOrientation);
+    }
+    return writer.getLength();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copies an encoded event to buffer, replacing its pose with a predicted one.
+// The original pose is appended in the prediction trailer, unless the event 
+// already has one. Returns the event size.
+static int predictPacket(const char* packet, int length, const PredictedPose& pose, char* buffer, int capacity)
+{
+    omicronConnector::EventView view(packet, length);
+    if( length > capacity )
+        length = capacity;
+    memcpy(buffer, packet, length);
+
+    bool hasPrediction = view.getPredictionTrailer() != NULL;
+    float rawPosition[3] = { view.getPosX(), view.getPosY(), view.getPosZ() };
+    float rawOrientation[4] = { view.getOrW(), view.getOrX(), view.getOrY(), view.getOrZ() };
+
+    omicronConnector::EventLayout::PosX::write(buffer, (float)pose.position.x());
+    omicronConnector::EventLayout::PosY::write(buffer, (float)pose.position.y());
+    omicronConnector::EventLayout::PosZ::write(buffer, (float)pose.position.z());
+    omicronConnector::EventLayout::OrW::write(buffer, (float)pose.orientation.w());
+    omicronConnector::EventLayout::OrX::write(buffer, (float)pose.orientation.x());
+    omicronConnector::EventLayout::OrY::write(buffer, (float)pose.orientation.y());
+    omicronConnector::EventLayout::OrZ::write(buffer, (float)pose.orientation.z());
+
+    if( hasPrediction || length + omicronConnector::EventLayout::PredictionTrailerSize > capacity )
+        return length;
+    char* trailer = &buffer[length];
+    omicronConnector::EventLayout::PredictionTag::write(trailer, omicronConnector::EventData::PredictionTag);
+    omicronConnector::EventLayout::Lead::write(trailer, pose.lead);
+    omicronConnector::EventLayout::RawPosX::write(trailer, rawPosition[0]);
+    omicronConnector::EventLayout::RawPosY::write(trailer, rawPosition[1]);
+    omicronConnector::EventLayout::RawPosZ::write(trailer, rawPosition[2]);
+    omicronConnector::EventLayout::RawOrW::write(trailer, rawOrientation[0]);
+    omicronConnector::EventLayout::RawOrX::write(trailer, rawOrientation[1]);
+    omicronConnector::EventLayout::RawOrY::write(trailer, rawOrientation[2]);
+    omicronConnector::EventLayout::RawOrZ::write(trailer, rawOrientation[3]);
+    return length + omicronConnector::EventLayout::PredictionTrailerSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Creates an event packet from an Omicron event. Returns the packet buffer.
+char* InputServer::createOmicronEventPacket(const Event* evt)
+{
+    eventPacketLength = encodeEvent(evt, eventPacket, EventPacketSize);
+	return eventPacket;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sends an event packet to all clients, regardless of their subscriptions.
+void InputServer::sendToClients(char* eventPacket)
+{
+    sendToClients(NULL, eventPacket);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sends an event packet to the clients subscribed to the event.
+void InputServer::sendToClients(const Event* evt, char* eventPacket)
+{
+    removeDisconnectedClients();
+    sendToStreams(evt, eventPacket, eventPacketLength);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::removeDisconnectedClients()
+{
+    if( !checkForDisconnectedClients )
+        return;
+
+    std::map<char*,NetClient*> activeClients;
+    std::map<char*,NetClient*>::iterator itr = netClients.begin();
+    while( itr != netClients.end() )
+    {
+        NetClient* client = itr->second;
+        // Send an empty message to check if the client is still here.
+        //client->sendMsg("",1);
+
+        // If client is still connected add to active list
+        if( client->isConnected() )
+        {
+            activeClients[itr->first] = client;
+        }
+        else // Client disconnected, remove from list
+        {
+            ofmsg("OInputServer: Client '%1%' Disconnected.", %itr->first);
+            if( client->hasMessages() && serviceManager != NULL )
+                serviceManager->removeWaitSocket((int)client->getMessageSocket());
+            detachStream(client);
+            delete client;
+        }
+        itr++;
+    }
+    netClients = activeClients;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::sendToStreams(const Event* evt, const char* packet, int length)
+{
+    // The event packet is shared by all the streams. Rate limited streams 
+    // may hold it and send it later, if no newer event replaces it.
+    bool discrete = evt != NULL && 
+        !omicronConnector::OutputPolicy::isContinuous(evt->getType(), evt->getExtraDataType());
+    bool predictable = evt != NULL && predictedStreams > 0 && PosePredictor::isPredictable(evt);
+    std::map<std::string, FrameStream*>::iterator sitr;
+    for( sitr = frameStreams.begin(); sitr != frameStreams.end(); sitr++ )
+    {
+        FrameStream* stream = sitr->second;
+        const char* streamPacket = packet;
+        int streamLength = length;
+        if( evt != NULL )
+        {
+            if( !stream->filter.accepts(evt->getServiceType(), evt->getType(), evt->getSourceId()) )
+                continue;
+            // Predicted streams get their own copy of the packet.
+            PredictedPose pose;
+            if( predictable && stream->lead > 0 && predictor->predict(evt, stream->lead, otimestamp(), pose) )
+            {
+                streamLength = predictPacket(packet, length, pose, predictedPacket, EventPacketSize);
+                streamPacket = predictedPacket;
+            }
+            if( stream->limiter != NULL && stream->limiter->hold(evt, streamPacket, streamLength) )
+                continue;
+        }
+        sendToStream(stream, streamPacket, streamLength, discrete);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int InputServer::getSubscribedStreams(const Event* evt, FrameStream** stream)
+{
+    int count = 0;
+    std::map<std::string, FrameStream*>::iterator itr;
+    for( itr = frameStreams.begin(); itr != frameStreams.end(); itr++ )
+    {
+        if( itr->second->filter.accepts(evt->getServiceType(), evt->getType(), evt->getSourceId()) )
+        {
+            *stream = itr->second;
+            count++;
+        }
+    }
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns true if at least one client subscribed to the event.
+bool InputServer::isSubscribed(const Event* evt)
+{
+    std::map<std::string, FrameStream*>::iterator itr;
+    for( itr = frameStreams.begin(); itr != frameStreams.end(); itr++ )
+    {
+        if( itr->second->filter.accepts(evt->getServiceType(), evt->getType(), evt->getSourceId()) )
+            return true;
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::sendToStream(FrameStream* stream, const char* packet, int length, bool discrete)
+{
+#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+    // Local clients read events straight from shared memory.
+    if( stream->sharedMemory )
+    {
+        sharedRing->write(packet, length);
+        return;
+    }
+#endif
+
+    // Discrete events get their own reliable frame. Events queued before 
+    // it are sent first, to keep the event order.
+    if( discrete && stream->reliable != NULL )
+    {
+        sendFrame(stream);
+        int frameLength;
+        const char* frame = stream->reliable->add(packet, length, frameLength);
+        sendToAll(frame, frameLength, stream);
+        return;
+    }
+
+    if( stream->compact )
+    {
+        sendCompact(stream, packet, length);
+        return;
+    }
+
+    // Batch streams get the event with their next frame. Other clients get
+    // a datagram per event.
+    if( stream->batch )
+    {
+        addToFrame(stream, packet, length);
+        if( stream->singleEvent )
+            sendFrame(stream);
+    }
+    else
+    {
+        sendToAll(packet, EventPacketSize, stream);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::attachStream(NetClient* client)
+{
+    detachStream(client);
+
+    // Legacy clients do not use streams.
+    if( client->isLegacy() )
+        return;
+
+    // Streams are identified by the client mode, subscription and policy.
+    omicronConnector::EventFilter filter;
+    omicronConnector::OutputPolicy policy;
+    char key[64 + omicronConnector::EventFilter::MaxStringLength + omicronConnector::OutputPolicy::MaxStringLength];
+    if( client->isSharedMemory() )
+    {
+        strcpy( key, "shm" );
+    }
+    else if( client->isMulticast() )
+    {
+        strcpy( key, "multicast" );
+    }
+    else
+    {
+        filter = client->getFilter();
+        policy = client->getPolicy();
+        strcpy( key, client->isBatch() ? "batch" : (client->isSequenced() ? "seq" : "single") );
+        if( client->isReliable() )
+            strcat( key, " reliable" );
+        if( client->isCompact() )
+            strcat( key, " compact" );
+        if( client->getPredictionLead() > 0 )
+            sprintf( &key[strlen(key)], " lead=%d", client->getPredictionLead() );
+        filter.toString( &key[strlen(key)], sizeof(key) - strlen(key) );
+        policy.toString( &key[strlen(key)], sizeof(key) - strlen(key) );
+    }
+
+    FrameStream* stream;
+    std::map<std::string, FrameStream*>::iterator itr = frameStreams.find(key);
+    if( itr != frameStreams.end() )
+    {
+        stream = itr->second;
+    }
+    else
+    {
+        bool frames = client->isMulticast() || client->isSequenced() || client->isReliable();
+        stream = new FrameStream( nextStreamId++, key, filter, policy, 
+            frames, frames && !client->isBatch() && !client->isMulticast(), client->isMulticast() );
+        stream->sharedMemory = client->isSharedMemory();
+        stream->compact = client->isCompact();
+        stream->lead = client->getPredictionLead();
+        if( stream->lead > 0 )
+            predictedStreams++;
+        frameStreams[key] = stream;
+
+        // The multicast stream is shared by reliable and non reliable 
+        // clients, so it always uses the reliable lane.
+        if( client->isReliable() || client->isMulticast() )
+            stream->reliable = new ReliableLane();
+
+        // Multicast frames are sent once, to the group.
+        if( stream->multicast )
+        {
+            stream->multicastTarget = new SendTarget(multicastAddr, multicastSocket, stream->id);
+            sender->addTarget(stream->multicastTarget);
+        }
+    }
+    stream->clients++;
+    client->setStream(stream);
+
+    // Reliable clients start waiting from the next reliable frame.
+    if( client->isReliable() && stream->reliable != NULL )
+    {
+        client->reliableAck = stream->reliable->getSequence();
+        client->retransmitTime = 0;
+    }
+
+    // The new client does not have the keyframes sent so far.
+    if( stream->compact )
+    {
+        stream->resetCompactSources();
+        updateStreamAck(stream);
+    }
+
+    if( !stream->multicast && !stream->sharedMemory )
+    {
+        SendTarget* target = new SendTarget(client->getAddress(), sendSocket, stream->id);
+        sender->addTarget(target);
+        client->setTarget(target);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::detachStream(NetClient* client)
+{
+    FrameStream* stream = client->getStream();
+    if( stream == NULL )
+        return;
+
+    SendTarget* target = client->getTarget();
+    if( target != NULL )
+    {
+        sender->removeTarget(target);
+        client->setTarget(NULL);
+        delete target;
+    }
+
+    client->setStream(NULL);
+    stream->clients--;
+    if( stream->clients == 0 )
+    {
+        if( stream->multicastTarget != NULL )
+        {
+            sender->removeTarget(stream->multicastTarget);
+            delete stream->multicastTarget;
+        }
+        if( stream->lead > 0 )
+            predictedStreams--;
+        frameStreams.erase(stream->key);
+        delete stream;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::addToFrame(FrameStream* stream, const char* packet, int length)
+{
+    char* event = reserveFrameEvent(stream, length);
+    memcpy(event, packet, length);
+    commitFrameEvent(stream, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns the frame buffer position for an event of at most maxLength bytes.
+// The event is added to the frame by commitFrameEvent.
+char* InputServer::reserveFrameEvent(FrameStream* stream, int maxLength)
+{
+    // Each event is prefixed by its size. Send the current frame if the 
+    // event does not fit.
+    if( stream->events > 0 && 
+        (stream->length + FrameLayout::EventSize::End + maxLength > maxFrameSize || stream->events == 0xFFFF) )
+        sendFrame(stream);
+
+    // Leave room for the frame header, written when the frame is sent.
+    if( stream->events == 0 )
+        stream->length = FrameLayout::Size;
+
+    return &stream->buffer[stream->length + FrameLayout::EventSize::End];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::commitFrameEvent(FrameStream* stream, int length)
+{
+    FrameLayout::EventSize::write(&stream->buffer[stream->length], (unsigned short)length);
+    stream->length += FrameLayout::EventSize::End + length;
+    stream->events++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool InputServer::encodeToFrame(FrameStream* stream, const Event* evt)
+{
+    // Rate limited streams may hold the packet, shared memory and legacy 
+    // streams send whole datagrams and discrete events may need their own 
+    // reliable frame.
+    if( !stream->batch || stream->sharedMemory || stream->compact || stream->limiter != NULL )
+        return false;
+    if( stream->reliable != NULL && 
+        !omicronConnector::OutputPolicy::isContinuous(evt->getType(), evt->getExtraDataType()) )
+        return false;
+
+    PredictedPose pose;
+    bool predicted = stream->lead > 0 && PosePredictor::isPredictable(evt) && 
+        predictor->predict(evt, stream->lead, otimestamp(), pose);
+    int maxLength = omicronConnector::EventWriter::getMaxLength(
+        evt->getExtraDataType(), evt->getExtraDataItems(), EventPacketSize, predicted);
+    char* event = reserveFrameEvent(stream, maxLength);
+    commitFrameEvent(stream, encodeEvent(evt, event, maxLength, predicted ? &pose : NULL));
+    if( stream->singleEvent )
+        sendFrame(stream);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sends a continuous event to a compact stream, as a delta against the last
+// keyframe of its source acknowledged by all the clients. Sends a new 
+// keyframe on the reliable lane every compactKeyframeInterval milliseconds.
+void InputServer::sendCompact(FrameStream* stream, const char* packet, int length)
+{
+    omicronConnector::EventView view(packet, length);
+    if( !view.isValid() )
+        return;
+
+    uint64 sourceKey = ((uint64)(uint)view.getServiceId() << 32) | view.getSourceId();
+    CompactSource*& source = stream->compactSources[sourceKey];
+    if( source == NULL )
+        source = new CompactSource();
+
+    // The pending keyframe becomes the reference once all the clients got it.
+    if( source->pending >= 0 && (int)(stream->reliableAck - source->pendingSequence) > 0 )
+    {
+        source->current = source->pending;
+        source->pending = -1;
+    }
+
+    uint64 now = otimestamp();
+    if( source->pending < 0 && 
+        (source->current < 0 || now - source->keyTime >= (uint64)compactKeyframeInterval * 1000) )
+    {
+        int slot = source->current == 0 ? 1 : 0;
+        omicronConnector::CompactEvent& keyframe = source->keys[slot];
+        compactCodec.quantize(view, keyframe);
+        keyframe.keyId = source->nextKeyId++;
+        int keyLength = compactCodec.encode(omicronConnector::CompactCodec::Keyframe, keyframe, NULL, compactPacket);
+
+        int frameLength;
+        source->pendingSequence = stream->reliable->getSequence();
+        const char* frame = stream->reliable->add(compactPacket, keyLength, frameLength, 
+            omicronConnector::FrameHeader::FlagReliable | omicronConnector::FrameHeader::FlagCompact);
+        sendToAll(frame, frameLength, stream);
+        source->pending = slot;
+        source->keyTime = now;
+    }
+
+    // Events are sent as absolute values until a keyframe is acknowledged.
+    const omicronConnector::CompactEvent* ref = NULL;
+    omicronConnector::CompactCodec::Kind kind = omicronConnector::CompactCodec::Absolute;
+    compactCodec.quantize(view, compactEvent);
+    if( source->current >= 0 )
+    {
+        ref = &source->keys[source->current];
+        kind = omicronConnector::CompactCodec::Delta;
+        compactEvent.keyId = ref->keyId;
+    }
+
+    char* event = reserveFrameEvent(stream, length + omicronConnector::CompactCodec::MaxOverhead);
+    commitFrameEvent(stream, compactCodec.encode(kind, compactEvent, ref, event));
+    if( stream->singleEvent )
+        sendFrame(stream);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Computes the reliable frame sequence acknowledged by all the clients of a
+// stream.
+void InputServer::updateStreamAck(FrameStream* stream)
+{
+    bool first = true;
+    std::map<char*,NetClient*>::iterator itr;
+    for( itr = netClients.begin(); itr != netClients.end(); itr++ )
+    {
+        NetClient* client = itr->second;
+        if( client->getStream() != stream || !client->isConnected() )
+            continue;
+        if( first || (int)(client->reliableAck - stream->reliableAck) < 0 )
+            stream->reliableAck = client->reliableAck;
+        first = false;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::sendFrame(FrameStream* stream)
+{
+    if( stream->events == 0 )
+        return;
+
+    unsigned short flags = stream->compact ? omicronConnector::FrameHeader::FlagCompact : 0;
+    FrameLayout::write(stream->buffer, (unsigned short)stream->events, flags, stream->sequence, otimestamp());
+
+    sendToAll(stream->buffer, stream->length, stream);
+
+    stream->sequence++;
+    stream->events = 0;
+    stream->length = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sends the same datagram to all the clients using the specified stream.
+void InputServer::sendToAll(const char* packet, int length, FrameStream* stream)
+{
+    sender->send(stream->id, packet, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int InputServer::getSendQueueDepth()
+{
+    return sender != NULL ? sender->getQueueDepth() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint InputServer::getSendQueueOverruns()
+{
+    return sender != NULL ? sender->getOverruns() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::getClientStats(std::vector<ClientStats>& stats)
+{
+    stats.clear();
+    std::map<char*,NetClient*>::iterator itr;
+    for( itr = netClients.begin(); itr != netClients.end(); itr++ )
     {
-        // Ping the client to see if still active
-        int result = sendto(msgSocket, 
-            eventPacket, 
-            length, 
-            0,
-            (const struct sockaddr*)&recvAddr,
-            sizeof(recvAddr));
-
-        if( result == SOCKET_ERROR )
+        NetClient* client = itr->second;
+        ClientStats cs;
+        cs.address = itr->first;
+        cs.batch = client->isBatch();
+        cs.multicast = client->isMulticast();
+        cs.datagrams = 0;
+        cs.bytes = 0;
+        cs.errors = 0;
+        // Multicast clients share the group statistics.
+        SendTarget* target = client->getTarget();
+        if( target == NULL && client->getStream() != NULL )
+            target = client->getStream()->multicastTarget;
+        if( target != NULL )
         {
-            connected = false;
+            cs.datagrams = target->datagrams;
+            cs.bytes = target->bytes;
+            cs.errors = target->errors;
         }
-    }// SendMsg
+        stats.push_back(cs);
+    }
+}
 
-    void setLegacy(bool value)
-    {
-        legacyMode = value;
-    }// setLegacy
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::flush()
+{
+    unsigned long long now = otimestamp();
+    std::vector<const char*> packets;
+    std::vector<int> lengths;
 
-    bool isLegacy()
+    std::map<std::string, FrameStream*>::iterator itr;
+    for( itr = frameStreams.begin(); itr != frameStreams.end(); itr++ )
     {
-        return legacyMode;
-    }// isLegacy
+        FrameStream* stream = itr->second;
 
-    bool isConnected()
-    {
-        return connected;
-    }// isConnected
-};
+        // Send the latest held events of the rate limited streams when 
+        // their timers expire.
+        if( stream->limiter != NULL )
+        {
+            packets.clear();
+            lengths.clear();
+            stream->limiter->release(now, packets, lengths);
+            for( unsigned int i = 0; i < packets.size(); i++ )
+                sendToStream(stream, packets[i], lengths[i]);
+        }
 
-#define OI_WRITEBUF(type, buf, offset, val) *((type*)&buf[offset]) = val; offset += sizeof(type);
+        if( stream->batch )
+            sendFrame(stream);
+    }
 
-///////////////////////////////////////////////////////////////////////////////
-// Creates an event packet from an Omicron event. Returns the buffer offset.
-char* InputServer::createOmicronEventPacket(const Event* evt)
-{
-	int offset = 0;
-    
-    OI_WRITEBUF(unsigned int, eventPacket, offset, evt->getTimestamp()); 
-    OI_WRITEBUF(unsigned int, eventPacket, offset, evt->getSourceId()); 
-    OI_WRITEBUF(int, eventPacket, offset, evt->getServiceId()); 
-    OI_WRITEBUF(unsigned int, eventPacket, offset, evt->getServiceType()); 
-    OI_WRITEBUF(unsigned int, eventPacket, offset, evt->getType()); 
-    OI_WRITEBUF(unsigned int, eventPacket, offset, evt->getFlags()); 
-    OI_WRITEBUF(float, eventPacket, offset, evt->getPosition().x()); 
-    OI_WRITEBUF(float, eventPacket, offset, evt->getPosition().y()); 
-    OI_WRITEBUF(float, eventPacket, offset, evt->getPosition().z()); 
-    OI_WRITEBUF(float, eventPacket, offset, evt->getOrientation().w()); 
-    OI_WRITEBUF(float, eventPacket, offset, evt->getOrientation().x()); 
-    OI_WRITEBUF(float, eventPacket, offset, evt->getOrientation().y()); 
-    OI_WRITEBUF(float, eventPacket, offset, evt->getOrientation().z()); 
-        
-    OI_WRITEBUF(unsigned int, eventPacket, offset, evt->getExtraDataType()); 
-    OI_WRITEBUF(unsigned int, eventPacket, offset, evt->getExtraDataItems()); 
-    OI_WRITEBUF(unsigned int, eventPacket, offset, evt->getExtraDataMask());
-        
-    if(evt->getExtraDataType() != Event::ExtraDataNull)
+    // Retransmit the reliable frames clients did not acknowledge in time.
+    std::map<char*,NetClient*>::iterator citr;
+    for( citr = netClients.begin(); citr != netClients.end(); citr++ )
     {
-        memcpy(&eventPacket[offset], evt->getExtraDataBuffer(), evt->getExtraDataSize());
-    }
-    offset += evt->getExtraDataSize();
+        NetClient* client = citr->second;
+        FrameStream* stream = client->getStream();
+        if( !client->isReliable() || !client->isConnected() || stream == NULL || stream->reliable == NULL )
+            continue;
 
-	return eventPacket;
+        int unacknowledged = (int)(stream->reliable->getSequence() - client->reliableAck);
+        if( unacknowledged <= 0 )
+        {
+            client->retransmitTime = 0;
+        }
+        else if( client->retransmitTime == 0 )
+        {
+            client->retransmitTime = now + (uint64)reliableTimeout * 1000;
+        }
+        else if( now >= client->retransmitTime )
+        {
+            retransmit(client, client->reliableAck, unacknowledged);
+            client->retransmitTime = now + (uint64)reliableTimeout * 1000;
+        }
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-//
-void InputServer::sendToClients(char* eventPacket)
+// Reads the messages sent by clients. Reliable lane messages: 'omicron_ack 
+// <sequence>' acknowledges the reliable frames before sequence, 'omicron_nack
+// <sequence> [count]' asks for the retransmission of missing frames. Time 
+// sync requests: 'omicron_time <t0>' gets the 'omicron_time <t0> <t1> <t2>'
+// answer, where t0 is the client request time, t1 and t2 the server receive
+// and send times (see otimestamp).
+void InputServer::processClientMessages()
 {
-	std::map<char*,NetClient*> activeClients;
-
-    std::map<char*,NetClient*>::iterator itr = netClients.begin();
-    while( itr != netClients.end() )
+    char lines[1024];
+    std::map<char*,NetClient*>::iterator itr;
+    for( itr = netClients.begin(); itr != netClients.end(); itr++ )
     {
         NetClient* client = itr->second;
-            
-        if( client->isLegacy() )
-        {
-            //client->sendEvent(legacyPacket, 512);
-        }
-        else
+        FrameStream* stream = client->getStream();
+        if( !client->hasMessages() || !client->isConnected() || stream == NULL )
+            continue;
+        bool reliable = client->isReliable() && stream->reliable != NULL;
+
+        int numLines = client->readMessages(lines, sizeof(lines));
+        if( numLines < 0 )
         {
-            // Send an empty message to check if the client is still here.
-            //client->sendMsg("",1);
-            client->sendEvent(eventPacket, DEFAULT_BUFLEN);
+            // The client is gone: stop listening to it. It will be removed
+            // if checkForDisconnectedClients is enabled.
+            printf("OInputServer: Client '%s' closed the connection\n", itr->first);
+            if( serviceManager != NULL )
+                serviceManager->removeWaitSocket((int)client->getMessageSocket());
+            client->setConnected(false);
+            continue;
         }
-            
-        if( checkForDisconnectedClients )
+
+        uint64 receiveTime = otimestamp();
+        const char* line = lines;
+        for( int i = 0; i < numLines; i++ )
         {
-            // If client is still connected add to active list
-            if( client->isConnected() )
+            unsigned int sequence;
+            int count = 1;
+            unsigned long long requestTime;
+            if( sscanf(line, "omicron_time %llu", &requestTime) == 1 )
+            {
+                if( client->isTimeSync() )
+                    sendTime(client, requestTime, receiveTime);
+            }
+            else if( reliable && sscanf(line, "omicron_ack %u", &sequence) == 1 )
             {
-                activeClients[itr->first] = client;
+                // Ignore acknowledgements older than the last one, or for 
+                // frames that have not been sent yet.
+                if( (int)(sequence - client->reliableAck) > 0 && 
+                    (int)(sequence - stream->reliable->getSequence()) <= 0 )
+                {
+                    client->reliableAck = sequence;
+                    client->retransmitTime = 0;
+                    if( stream->compact )
+                        updateStreamAck(stream);
+                }
             }
-            else // Client disconnected, remove from list
+            else if( reliable && sscanf(line, "omicron_nack %u %d", &sequence, &count) >= 1 )
             {
-                ofmsg("OInputServer: Client '%1%' Disconnected.", %itr->first);
-                delete client;
+                retransmit(client, sequence, count);
             }
+            line += strlen(line) + 1;
         }
-        itr++;
     }
+}
 
-    if( checkForDisconnectedClients )
-        netClients = activeClients;
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::sendTime(NetClient* client, unsigned long long requestTime, uint64 receiveTime)
+{
+    char msg[96];
+    sprintf( msg, "omicron_time %llu %llu %llu\n", requestTime, 
+        (unsigned long long)receiveTime, (unsigned long long)otimestamp() );
+    sendMessage(client, msg);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::sendMessage(NetClient* client, const char* msg)
+{
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+    send( client->getMessageSocket(), msg, (int)strlen(msg), flags );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::retransmit(NetClient* client, unsigned int sequence, int count)
+{
+    FrameStream* stream = client->getStream();
+    ReliableLane* lane = stream->reliable;
+
+    // Frames no longer in the history are lost: tell the client to stop 
+    // waiting for them. Lost keyframes cannot be used as delta references, 
+    // so new ones are sent for their sources.
+    if( (int)(sequence - lane->getOldestSequence()) < 0 )
+    {
+        printf("OInputServer: reliable frames %u to %u not available anymore\n", 
+            sequence, lane->getOldestSequence() - 1);
+        int lost = (int)(lane->getOldestSequence() - sequence);
+        char msg[64];
+        sprintf( msg, "omicron_lost %u %d\n", sequence, lost );
+        sendMessage(client, msg);
+        if( stream->compact )
+            stream->resetLostKeyframes(sequence, lost);
+        count -= lost;
+        sequence = lane->getOldestSequence();
+        if( (int)(client->reliableAck - sequence) < 0 )
+            client->reliableAck = sequence;
+    }
+
+    // Frames are sent to the whole stream: other clients discard duplicates.
+    if( count > maxRetransmitFrames ) count = maxRetransmitFrames;
+    for( int i = 0; i < count; i++ )
+    {
+        int frameLength;
+        const char* frame = lane->get(sequence + i, frameLength);
+        if( frame == NULL ) break;
+        sendToAll(frame, frameLength, stream);
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -222,23 +1935,30 @@ void InputServer::handleEvent(const Event* evt)
     // If the event has been processed locally (i.e. by a filter event service)
     if(evt->isProcessed()) return;
 
-	timeb tb;
-    ftime( &tb );
-    int timestamp = tb.millitm + (tb.time & 0xfffff) * 1000;
-
 #ifdef OMICRON_USE_VRPN
     vrpnDevice->update(evt);
 #endif
 
-    char* eventPacket = createOmicronEventPacket(evt);
+    removeDisconnectedClients();
+
+    // Events no client subscribed to are not serialized at all.
+    FrameStream* stream = NULL;
+    int streams = getSubscribedStreams(evt, &stream);
+    if( streams == 0 ) return;
+
+    // Track the motion of mocap and wand sources, for predicted streams.
+    if( predictedStreams > 0 && PosePredictor::isPredictable(evt) )
+        predictor->update(evt);
     //handleLegacyEvent(evt);
         
     if( showStreamSpeed )
     {
+        int timestamp = (int)(otimestamp() / 1000);
         if( (timestamp - lastOutgoingEventTime) >= 1000 )
         {
             lastOutgoingEventTime = timestamp;
             ofmsg("oinputserver: Outgoing event stream %1% event(s)/sec", %eventCount );
+            ofmsg("oinputserver: Send queue depth %1% overruns %2%", %getSendQueueDepth() %getSendQueueOverruns() );
             eventCount = 0;
         }
         else
@@ -250,13 +1970,74 @@ void InputServer::handleEvent(const Event* evt)
     if( showEventStream )
         printf("oinputserver: Event %d type: %d sent at pos %f %f\n", evt->getSourceId(), evt->getType(), evt->getPosition().x(), evt->getPosition().y() );
 
-	sendToClients(eventPacket);
+    // When a single batch stream gets the event, it is encoded straight
+    // into the stream frame. Otherwise the event packet is shared by all
+    // the subscribed streams.
+    if( streams == 1 && encodeToFrame(stream, evt) )
+        return;
+
+    createOmicronEventPacket(evt);
+    sendToStreams(evt, eventPacket, eventPacketLength);
 }
     
+///////////////////////////////////////////////////////////////////////////////
+// Sends an event received from an upstream server to the subscribed clients.
+// The packet is forwarded as is: it keeps its service and source ids, and is
+// not decoded except for its header. Only the event times are converted to 
+// the local clock, when the upstream clock offset is known.
+void InputServer::relayEvent(const char* packet, int length, bool hasClockOffset, long long clockOffset)
+{
+    omicronConnector::EventView view(packet, length);
+    if( !view.isValid() || length > EventPacketSize )
+        return;
+
+    removeDisconnectedClients();
+
+    // Subscriptions, rate limits and prediction only need the event header.
+    relayedEvent.reset((Event::Type)view.getType(), (Service::ServiceType)view.getServiceType(), 
+        view.getSourceId(), view.getServiceId());
+    relayedEvent.setFlags(view.getFlags());
+    relayedEvent.setPosition(view.getPosX(), view.getPosY(), view.getPosZ());
+    relayedEvent.setOrientation(view.getOrW(), view.getOrX(), view.getOrY(), view.getOrZ());
+    relayedEvent.setExtraDataType((Event::ExtraDataType)view.getExtraDataType());
+
+    FrameStream* stream = NULL;
+    if( getSubscribedStreams(&relayedEvent, &stream) == 0 )
+        return;
+
+    // Single event clients get whole EventPacketSize datagrams.
+    memcpy(eventPacket, packet, length);
+    eventPacketLength = length;
+
+    // Without the clock offset, the event time is the local receive time,
+    // and the device time is unknown.
+    const char* trailer = view.getTrailer();
+    if( trailer != NULL )
+    {
+        char* times = &eventPacket[trailer - packet];
+        uint64 time = relayedEvent.getTime();
+        uint64 deviceTime = 0;
+        if( hasClockOffset )
+        {
+            time = view.getTime() - clockOffset;
+            deviceTime = view.getDeviceTime() != 0 ? view.getDeviceTime() - clockOffset : 0;
+        }
+        omicronConnector::EventLayout::Time::write(times, time);
+        omicronConnector::EventLayout::DeviceTime::write(times, deviceTime);
+        relayedEvent.setTime(time);
+        relayedEvent.setDeviceTime(deviceTime);
+    }
+
+    if( predictedStreams > 0 && PosePredictor::isPredictable(&relayedEvent) )
+        predictor->update(&relayedEvent);
+
+    sendToStreams(&relayedEvent, eventPacket, eventPacketLength);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 bool InputServer::handleLegacyEvent(const Event& evt)
 {
-	char legacyPacket[DEFAULT_BUFLEN];
+	char legacyPacket[EventPacketSize];
 
     //itoa(evt.getServiceType(), eventPacket, 10); // Append input type
     sprintf(legacyPacket, "%d", evt.getServiceType());
@@ -470,6 +2251,8 @@ void InputServer::startConnection(Config* cfg)
     lastOutgoingEventTime = 0;
     eventCount = 0;
 
+    eventPacketLength = 0;
+
     Setting& sCfg = cfg->lookup("config");
     serverPort = strdup(Config::getStringValue("serverPort", sCfg, "27000").c_str());
 
@@ -477,13 +2260,52 @@ void InputServer::startConnection(Config* cfg)
     showEventStream = Config::getBoolValue("showEventStream", sCfg, false );
     showStreamSpeed = Config::getBoolValue("showStreamSpeed", sCfg, false );
 
+    // Maximum size of the datagrams sent to batch mode clients. The default
+    // fits a 1500 bytes ethernet MTU.
+    maxFrameSize = Config::getIntValue("maxDatagramSize", sCfg, 1472);
+    if( maxFrameSize > omicronConnector::FrameHeader::MaxFrameSize )
+        maxFrameSize = omicronConnector::FrameHeader::MaxFrameSize;
+    // Frames need to fit at least one event.
+    if( maxFrameSize < omicronConnector::FrameHeader::Size + 2 + ReliableLane::MaxEventSize )
+        maxFrameSize = omicronConnector::FrameHeader::Size + 2 + ReliableLane::MaxEventSize;
+
+    // Default output rate limit, for clients that do not ask for one.
+    defaultPolicy.setMaxRate(Config::getFloatValue("maxClientRate", sCfg, 0));
+
     if( checkForDisconnectedClients )
         omsg("Check for disconnected clients enabled.");
 
     listenSocket = INVALID_SOCKET;
-    recvbuflen = DEFAULT_BUFLEN;
+    serviceManager = NULL;
     int iResult;
 
+    // Maximum time clients have to send their handshake after connecting.
+    handshakeTimeout = Config::getIntValue("handshakeTimeout", sCfg, 500);
+
+    // Reliable lane: time after which unacknowledged discrete events are
+    // sent again, in milliseconds, and maximum number of frames sent again
+    // at once.
+    reliableTimeout = Config::getIntValue("reliableTimeout", sCfg, 100);
+    maxRetransmitFrames = Config::getIntValue("maxRetransmitFrames", sCfg, 32);
+
+    // Compact encoding, for clients that ask for it: fixed point scale of 
+    // positions (1000 = millimeters for positions in meters) and interval
+    // between keyframes of each source, in milliseconds.
+    compactEncoding = Config::getBoolValue("compactEncoding", sCfg, true);
+    compactCodec.setScale(Config::getIntValue("compactScale", sCfg, omicronConnector::CompactCodec::DefaultScale));
+    compactKeyframeInterval = Config::getIntValue("compactKeyframeInterval", sCfg, 500);
+
+    // Pose prediction, for clients that ask for it: maximum extrapolation
+    // time in milliseconds, and weight of the newest sample in the velocity
+    // estimates (1 = no smoothing).
+    predictor = NULL;
+    predictedStreams = 0;
+    if( Config::getBoolValue("posePrediction", sCfg, true) )
+    {
+        predictor = new PosePredictor(Config::getFloatValue("predictionSmoothing", sCfg, 0.5f),
+            Config::getIntValue("predictionMaxLead", sCfg, 100) * 1000);
+    }
+
 #ifdef OMICRON_USE_VRPN
     // VRPN Server Test ///////////////////////////////////////////////
     TRACKER_NAME = strdup(Config::getStringValue("vrpnTrackerName", sCfg, "Device0").c_str());
@@ -500,6 +2322,75 @@ void InputServer::startConnection(Config* cfg)
     // Initialize Winsock
     SOCKET_INIT();
 
+    // Create the UDP socket shared by all clients.
+    sendSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if( sendSocket == INVALID_SOCKET )
+        PRINT_SOCKET_ERROR("OInputServer::startConnection: could not create send socket");
+
+    // Datagrams are sent to clients by a dedicated thread, unless disabled.
+    // The main thread only serializes events and queues datagrams, so slow
+    // sends never delay device polling.
+    bool senderThread = Config::getBoolValue("senderThread", sCfg, true);
+    int sendQueueSize = Config::getIntValue("sendQueueSize", sCfg, 256);
+    sender = new DatagramSender(sendSocket, maxFrameSize, senderThread ? sendQueueSize : 0);
+    nextStreamId = 0;
+
+    // Shared memory ring, for clients running on this machine. The ring is 
+    // named after the server port.
+    sharedRing = NULL;
+    sharedRingName[0] = '\0';
+#ifdef OMICRON_CONNECTOR_SHARED_MEMORY
+    if( Config::getBoolValue("sharedMemory", sCfg, true) )
+    {
+        snprintf(sharedRingName, sizeof(sharedRingName), "omicron-%s", serverPort);
+        sharedRing = new omicronConnector::SharedEventRing();
+        if( sharedRing->create(sharedRingName, Config::getIntValue("sharedMemorySize", sCfg, 4096)) )
+        {
+            ofmsg("OInputServer: Shared memory ring /dev/shm/%1%", %sharedRingName);
+        }
+        else
+        {
+            PRINT_SOCKET_ERROR("OInputServer::startConnection: could not create shared memory ring");
+            delete sharedRing;
+            sharedRing = NULL;
+        }
+    }
+#endif
+
+    // Multicast mode: enabled when a multicast group is specified. Clients
+    // joining the group all get the same datagrams, so the server outgoing
+    // traffic does not depend on the number of clients.
+    multicastGroup = strdup(Config::getStringValue("multicastGroup", sCfg, "").c_str());
+    multicastPort = Config::getIntValue("multicastPort", sCfg, 7010);
+    multicastSocket = INVALID_SOCKET;
+    if( multicastGroup[0] != '\0' )
+    {
+        multicastSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if( multicastSocket == INVALID_SOCKET )
+        {
+            PRINT_SOCKET_ERROR("OInputServer::startConnection: could not create multicast socket");
+        }
+        else
+        {
+            int ttl = Config::getIntValue("multicastTTL", sCfg, 1);
+            setsockopt(multicastSocket, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl, sizeof(ttl));
+
+            // Optionally select the interface used to send multicast datagrams.
+            String multicastInterface = Config::getStringValue("multicastInterface", sCfg, "");
+            if( multicastInterface != "" )
+            {
+                struct in_addr iface;
+                iface.s_addr = inet_addr(multicastInterface.c_str());
+                setsockopt(multicastSocket, IPPROTO_IP, IP_MULTICAST_IF, (const char*)&iface, sizeof(iface));
+            }
+
+            multicastAddr.sin_family = AF_INET;
+            multicastAddr.sin_port = htons(multicastPort);
+            multicastAddr.sin_addr.s_addr = inet_addr(multicastGroup);
+            ofmsg("OInputServer: Multicast group %1%:%2% (ttl %3%)", %multicastGroup %multicastPort %ttl);
+        }
+    }
+
     struct addrinfo *result = NULL, *ptr = NULL, hints;
 
     memset(&hints, 0, sizeof hints);
@@ -542,159 +2433,309 @@ void InputServer::startConnection(Config* cfg)
 
     // Setup the TCP listening socket
     iResult = bind( listenSocket, result->ai_addr, (int)result->ai_addrlen);
+    freeaddrinfo(result);
     if (iResult == SOCKET_ERROR) 
     {
         PRINT_SOCKET_ERROR("OInputServer::startConnection: bind failed");
-        freeaddrinfo(result);
 
         SOCKET_CLOSE(listenSocket);
+        listenSocket = INVALID_SOCKET;
         SOCKET_CLEANUP();
         return;
     }
-}
-
-///////////////////////////////////////////////////////////////////////////////
-SOCKET InputServer::startListening()
-{
-    SOCKET clientSocket;
 
-    // Listen on socket
+    // Listen on socket. Connections are accepted by startListening.
     if ( listen( listenSocket, SOMAXCONN ) == SOCKET_ERROR )
     {
-        PRINT_SOCKET_ERROR("OInputServer::startListening: bind failed");
+        PRINT_SOCKET_ERROR("OInputServer::startConnection: listen failed");
         SOCKET_CLOSE(listenSocket);
+        listenSocket = INVALID_SOCKET;
         SOCKET_CLEANUP();
-        return 0;
-    } 
-    else
-    {
-        //printf("NetService: Listening on socket.\n");
+        return;
     }
+}
 
-    clientSocket = INVALID_SOCKET;
-    sockaddr_in clientInfo;
-    int addrSize = sizeof(struct sockaddr);
-    const char* clientAddress;
-
-    // Accept a client socket
-    clientSocket = accept(listenSocket, (struct sockaddr *)&clientInfo, (socklen_t*)&addrSize);
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::setServiceManager(ServiceManager* sm)
+{
+    serviceManager = sm;
+    if( serviceManager != NULL && listenSocket != INVALID_SOCKET )
+        serviceManager->addWaitSocket((int)listenSocket);
+}
 
-    if (clientSocket == INVALID_SOCKET) 
-    {
-        //printf("NetService: accept failed: %d\n", WSAGetLastError());
-        // Commented out: We do not want to close the listen socket
-        // since we are using a non-blocking socket until we are done listening for clients.
-        //closesocket(listenSocket);
-        //WSACleanup();
-        //return NULL;
+///////////////////////////////////////////////////////////////////////////////
+// Accepts new clients and processes the handshakes received so far. Never 
+// blocks: connections waiting for their handshake are kept until it arrives
+// or their deadline expires. Returns the socket of the last client that 
+// completed the handshake, or 0.
+SOCKET InputServer::startListening()
+{
+    if( listenSocket == INVALID_SOCKET )
         return 0;
-    } 
-    else 
+
+    acceptConnections();
+    SOCKET lastClientSocket = processHandshakes();
+    processClientMessages();
+    return lastClientSocket;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::acceptConnections()
+{
+    // Accept all the pending connections (up to a limit, so a connection
+    // storm does not delay event forwarding too much).
+    for( int i = 0; i < 64; i++ )
     {
-        // Gets the clientInfo and extracts the IP address
-        clientAddress = inet_ntoa(clientInfo.sin_addr);
+        sockaddr_in clientInfo;
+        socklen_t addrSize = sizeof(clientInfo);
+        SOCKET clientSocket = accept(listenSocket, (struct sockaddr *)&clientInfo, &addrSize);
+        if( clientSocket == INVALID_SOCKET )
+            return;
+
+        // Handshakes are read without blocking.
+        u_long iMode = 1;
+        ioctlsocket(clientSocket, FIONBIO, &iMode);
+
+        const char* clientAddress = inet_ntoa(clientInfo.sin_addr);
         printf("OInputServer: Client '%s' Accepted.\n", clientAddress);
+
+        PendingConnection* pc = new PendingConnection( clientSocket, clientAddress, 
+            otimestamp() + (uint64)handshakeTimeout * 1000 );
+        pendingConnections.push_back(pc);
+
+        // Wake up when the handshake arrives.
+        if( serviceManager != NULL )
+            serviceManager->addWaitSocket((int)clientSocket);
     }
-    
-    // Wait for client handshake
-    // Here we constantly loop until data is received.
-    // Because we're using a non-blocking socket, it is possible to attempt to receive before data is
-    // sent, resulting in the 'recv failed' error that is commented out.
-    bool gotData = false;
-    float timer = 0.0f;
-    float timeout = 500.0f; // milliseconds
-    time_t startTime = time (NULL);
-
-    printf("OInputServer: Waiting for client handshake\n");
-    do 
-    {
-        iResult = recv(clientSocket, recvbuf, recvbuflen, 0);
-        if (iResult > 0)
-        {
-            //printf("Service: Bytes received: %d\n", iResult);
-            char* inMessage;
-            char* portCStr;
-            inMessage = new char[iResult];
-            portCStr = new char[iResult];
-
-            // Iterate through message string and
-            // separate 'data_on,' from the port number
-            int portIndex = iResult;
-            for( int i = 0; i < iResult; i++ )
-            {
-                if( recvbuf[i] == ',' )
-                {
-                    portIndex = i + 1;
-                    inMessage[i] = '\n';
-                }
-                else if( i < portIndex )
-                {
-                    inMessage[i] = recvbuf[i];
-                } 
-                else 
-                {
-                    portCStr[i-portIndex] = recvbuf[i];
-                }
-            }
+}
 
-            // Make sure handshake is correct
-            char* handshake = "data_on";
-            char* omicronHandshake = "omicron_data_on";
-            char* legacyHandshake = "omicron_legacy_data_on";
-            int dataPort = 7000; // default port
+///////////////////////////////////////////////////////////////////////////////
+SOCKET InputServer::processHandshakes()
+{
+    SOCKET lastClientSocket = 0;
+    uint64 now = otimestamp();
 
-            if( strcmp(inMessage, legacyHandshake) == 1 )
-            {
-                // Get data port number
-                dataPort = atoi(portCStr);
-                printf("OInputServer: '%s' requests omicron legacy data to be sent on port '%d'\n", clientAddress, dataPort);
-                printf("OInputServer: WARNING - This server does not support legacy data!\n");
-                createClient( clientAddress, dataPort, true, clientSocket );
-            }
-            else if( strcmp(inMessage, omicronHandshake) == 1 )
-            {
-                // Get data port number
-                dataPort = atoi(portCStr);
-                printf("OInputServer: '%s' requests omicron data to be sent on port '%d'\n", clientAddress, dataPort);
-                createClient( clientAddress, dataPort, false, clientSocket );
-            }
-            else if( strcmp(inMessage, handshake) == 1 )
+    std::vector<PendingConnection*>::iterator itr = pendingConnections.begin();
+    while( itr != pendingConnections.end() )
+    {
+        PendingConnection* pc = *itr;
+
+        // Read all the available handshake data.
+        bool closed = false;
+        bool failed = false;
+        while( pc->length < EventPacketSize - 1 )
+        {
+            int result = recv(pc->socket, &pc->buffer[pc->length], EventPacketSize - 1 - pc->length, 0);
+            if( result > 0 )
             {
-                // Get data port number
-                dataPort = atoi(portCStr);
-                printf("OInputServer: '%s' requests data (old handshake) to be sent on port '%d'\n", clientAddress, dataPort);
-                createClient( clientAddress, dataPort, false, clientSocket );
+                pc->length += result;
             }
             else
             {
-                // Get data port number
-                dataPort = atoi(portCStr);
-                printf("OInputServer: '%s' requests data to be sent on port '%d'\n", clientAddress, dataPort);
-                printf("OInputServer: '%s' using unknown handshake '%s'\n", clientAddress, inMessage);
-                createClient( clientAddress, dataPort, false, clientSocket );
+                if( result == 0 ) closed = true;
+                else if( !SOCKET_WOULD_BLOCK() ) failed = true;
+                break;
             }
+        }
+        pc->buffer[pc->length] = '\0';
 
-            gotData = true;
-            delete inMessage;
-            delete portCStr;
-        } 
-        else if (iResult == 0)
+        // Clients send the handshake with a single send call: the handshake
+        // is complete when some data has been received and nothing else is
+        // available.
+        bool done = true;
+        if( pc->length > 0 )
         {
-            printf("OInputServer: Connection closing...\n");
+            // Reliable clients keep using the socket for acknowledgements 
+            // (see watchClient).
+            if( serviceManager != NULL )
+                serviceManager->removeWaitSocket((int)pc->socket);
+            NetClient* client = handleHandshake(pc);
+            if( client != NULL ) lastClientSocket = pc->socket;
+            else SOCKET_CLOSE(pc->socket);
         }
-        else 
+        else if( closed || failed )
         {
-            timer = time (NULL);
-            if( timer > startTime + timeout )
-            {
-                printf("OInputServer: Handshake timed out\n");
-                break;
-            }
+            printf("OInputServer: Client '%s' closed the connection before the handshake\n", pc->address);
+            SOCKET_CLOSE(pc->socket);
         }
-    } while (!gotData);
-    
+        else if( now > pc->deadline )
+        {
+            printf("OInputServer: Client '%s' handshake timed out\n", pc->address);
+            SOCKET_CLOSE(pc->socket);
+        }
+        else
+        {
+            done = false;
+        }
+
+        if( done )
+        {
+            if( serviceManager != NULL && pc->length == 0 )
+                serviceManager->removeWaitSocket((int)pc->socket);
+            delete pc;
+            itr = pendingConnections.erase(itr);
+        }
+        else
+        {
+            itr++;
+        }
+    }
+    return lastClientSocket;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parses a client handshake: '<handshake>,<data port>[ <option> ...]' and 
+// creates the client. Returns NULL if the handshake is not valid.
+NetClient* InputServer::handleHandshake(PendingConnection* pc)
+{
+    // Remove the trailing newline sent by some clients.
+    char* message = pc->buffer;
+    int len = (int)strlen(message);
+    while( len > 0 && (message[len - 1] == '\n' || message[len - 1] == '\r') )
+        message[--len] = '\0';
+
+    char* portCStr = strchr(message, ',');
+    if( portCStr == NULL )
+    {
+        printf("OInputServer: '%s' sent an invalid handshake '%s'\n", pc->address, message);
+        return NULL;
+    }
+    *portCStr++ = '\0';
+
+    // Handshake options follow the data port, separated by spaces.
+    const char* options = strchr(portCStr, ' ');
+    if( options == NULL ) options = "";
+
+    int dataPort = atoi(portCStr);
+    bool legacy = false;
+    if( strcmp(message, "omicron_legacy_data_on") == 0 )
+    {
+        printf("OInputServer: '%s' requests omicron legacy data to be sent on port '%d'\n", pc->address, dataPort);
+        printf("OInputServer: WARNING - This server does not support legacy data!\n");
+        legacy = true;
+    }
+    else if( strcmp(message, "omicron_data_on") == 0 )
+    {
+        printf("OInputServer: '%s' requests omicron data to be sent on port '%d'\n", pc->address, dataPort);
+    }
+    else if( strcmp(message, "data_on") == 0 )
+    {
+        printf("OInputServer: '%s' requests data (old handshake) to be sent on port '%d'\n", pc->address, dataPort);
+    }
+    else
+    {
+        printf("OInputServer: '%s' requests data to be sent on port '%d'\n", pc->address, dataPort);
+        printf("OInputServer: '%s' using unknown handshake '%s'\n", pc->address, message);
+    }
+
+    NetClient* client = createClient( pc->address, dataPort, legacy, pc->socket, options );
+
+    // Clients sending handshake options wait for the server to 
+    // acknowledge them. Older clients do not read the message socket.
+    if( options[0] != '\0' && client != NULL )
+        sendHandshakeAck( client, pc->socket );
+
+    return client;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void InputServer::sendHandshakeAck(NetClient* client, SOCKET clientSocket)
+{
+    // The acknowledgement lists the options accepted by the server, 
+    // separated by spaces, and ends with a newline.
+    char ack[256];
+    strcpy( ack, "omicron_data_ack" );
+    if( client->isBatch() )
+        strcat( ack, " batch" );
+    if( client->isSequenced() )
+        strcat( ack, " seq" );
+    if( client->isReliable() && client->getStream() != NULL )
+    {
+        char buf[32];
+        sprintf( buf, " reliable=%u", client->getStream()->reliable->getSequence() );
+        strcat( ack, buf );
+    }
+    if( client->isCompact() )
+    {
+        char buf[32];
+        sprintf( buf, " compact=%d", compactCodec.getScale() );
+        strcat( ack, buf );
+    }
+    if( client->isTimeSync() )
+        strcat( ack, " time" );
+    if( client->getPredictionLead() > 0 )
+    {
+        char buf[32];
+        sprintf( buf, " lead=%d", client->getPredictionLead() );
+        strcat( ack, buf );
+    }
+    if( client->isSharedMemory() )
+    {
+        char buf[96];
+        sprintf( buf, " shm=%.63s", sharedRingName );
+        strcat( ack, buf );
+    }
+    else if( client->isMulticast() )
+    {
+        char buf[96];
+        sprintf( buf, " multicast=%.63s:%d", multicastGroup, multicastPort );
+        strcat( ack, buf );
+    }
+    else
+    {
+        // Subscription and policy, as understood by the server.
+        char filter[omicronConnector::OutputPolicy::MaxStringLength];
+        client->getFilter().toString( filter, sizeof(filter) );
+        omicronConnector::appendOption( ack, sizeof(ack) - 1, filter );
+        client->getPolicy().toString( filter, sizeof(filter) );
+        omicronConnector::appendOption( ack, sizeof(ack) - 1, filter );
+    }
+    strcat( ack, "\n" );
+
+    // Do not raise SIGPIPE if the client already closed the connection.
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+    send( clientSocket, ack, (int)strlen(ack), flags );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns true if the client connected from this machine and can use the 
+// shared memory ring.
+bool InputServer::isLocalClient(SOCKET clientSocket)
+{
+    if( sharedRing == NULL )
+        return false;
+
+    // The client is local if the connection local and remote addresses match.
+    sockaddr_in localAddr;
+    sockaddr_in remoteAddr;
+    socklen_t localSize = sizeof(localAddr);
+    socklen_t remoteSize = sizeof(remoteAddr);
+    if( getsockname(clientSocket, (sockaddr*)&localAddr, &localSize) != 0 ||
+        getpeername(clientSocket, (sockaddr*)&remoteAddr, &remoteSize) != 0 )
+        return false;
+    return localAddr.sin_addr.s_addr == remoteAddr.sin_addr.s_addr;
+}
 
-    return clientSocket;
+///////////////////////////////////////////////////////////////////////////////
+// Returns the prediction lead time granted to a client: 0 when prediction is
+// disabled, at most predictionMaxLead.
+int InputServer::getPredictionLead(NetClient* client)
+{
+    if( predictor == NULL )
+        return 0;
+    int lead = client->getPredictionLead();
+    return lead < predictor->getMaxLead() ? lead : predictor->getMaxLead();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Wake up when clients send acknowledgements or time sync requests.
+void InputServer::watchClient(NetClient* client)
+{
+    if( client->hasMessages() && serviceManager != NULL )
+        serviceManager->addWaitSocket((int)client->getMessageSocket());
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -707,7 +2748,7 @@ void InputServer::loop()
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-void InputServer::createClient(const char* clientAddress, int dataPort, bool legacy, SOCKET clientSocket)
+NetClient* InputServer::createClient(const char* clientAddress, int dataPort, bool legacy, SOCKET clientSocket, const char* options)
 {
     // Generate a unique name for client "address:port"
     char* addr = new char[128];
@@ -744,9 +2785,39 @@ void InputServer::createClient(const char* clientAddress, int dataPort, bool leg
                     printf("OInputServer: NetClient %s now using omicron data \n", addr );
                 p->second->setLegacy(legacy);
             }
-            return;
+            // The client now talks on the new connection.
+            if( p->second->hasMessages() && serviceManager != NULL )
+                serviceManager->removeWaitSocket((int)p->second->getMessageSocket());
+            p->second->setMessageSocket(clientSocket);
+            p->second->setConnected(true);
+
+            p->second->setOptions(options);
+            if( multicastSocket == INVALID_SOCKET )
+                p->second->setMulticast(false);
+            p->second->setSharedMemory(p->second->isSharedMemory() && isLocalClient(clientSocket));
+            p->second->setCompact(p->second->isCompact() && compactEncoding);
+            p->second->setPredictionLead(getPredictionLead(p->second));
+            if( p->second->getPolicy().isEmpty() )
+                p->second->setPolicy(defaultPolicy);
+            attachStream(p->second);
+            watchClient(p->second);
+            return p->second;
         }
     }
 
-    netClients[addr] = new NetClient( clientAddress, dataPort, legacy, clientSocket );
+    NetClient* client = new NetClient( clientAddress, dataPort, legacy, clientSocket );
+    client->setOptions(options);
+    // Multicast is only available if the server has a multicast group.
+    if( multicastSocket == INVALID_SOCKET )
+        client->setMulticast(false);
+    // Shared memory is only available to clients on this machine.
+    client->setSharedMemory(client->isSharedMemory() && isLocalClient(clientSocket));
+    client->setCompact(client->isCompact() && compactEncoding);
+    client->setPredictionLead(getPredictionLead(client));
+    if( client->getPolicy().isEmpty() )
+        client->setPolicy(defaultPolicy);
+    attachStream(client);
+    watchClient(client);
+    netClients[addr] = client;
+    return client;
 }
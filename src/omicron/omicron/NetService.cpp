@@ -26,67 +26,396 @@
  * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *************************************************************************************************/
 #include "omicron/NetService.h"
+#include "omicron/StringUtils.h"
+#include "omicron/InputServer.h"
 using namespace omicron;
 
-NetService* NetService::mysInstance = NULL;
+InputServer* NetService::mysRelayServer = NULL;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// An upstream input server: its connector client, with its own receive socket, and the events 
+// waiting to be merged with other upstreams. Upstreams are only accessed from NetService::poll,
+// so they need no locking.
+class omicron::NetUpstream: public omicronConnector::IOmicronConnectorClientListener
+{
+public:
+	// An event waiting for merge, and its creation time on the local clock.
+	struct QueuedEvent
+	{
+		uint64 time;
+		omicronConnector::EventData data;
+	};
+
+	// Events waiting for merge are flushed when an upstream queue gets this long.
+	static const size_t MaxQueuedEvents = OMICRON_MAX_EVENTS;
+
+	NetUpstream(NetService* service, int index): 
+		service(service), index(index), serverPort(27000), dataPort(7000)
+	{
+		client = new omicronConnector::OmicronConnectorClient(this);
+	}
+
+	~NetUpstream()
+	{
+		delete client;
+	}
+
+	virtual void onEvent(const omicronConnector::EventData& ed)
+	{
+		service->onUpstreamEvent(this, ed);
+	}
+
+	virtual bool onEventPacket(const char* packet, int size)
+	{
+		return service->onUpstreamPacket(this, packet, size);
+	}
+
+	// Returns the creation time of an event on the local clock, or the
+	// current time if the upstream clock offset is unknown.
+	uint64 getLocalTime(const omicronConnector::EventData& ed)
+	{
+		long long age = client->getEventAge(ed);
+		return age > 0 ? otimestamp() - age : otimestamp();
+	}
+
+	NetService* service;
+	int index;
+	omicronConnector::OmicronConnectorClient* client;
+	String serverAddress;
+	int serverPort;
+	int dataPort;
+	std::deque<QueuedEvent> queue;
+	// Relayed packets with a remapped service id are copied here.
+	char relayBuffer[omicronConnector::EventLayout::HeaderSize + 
+		omicronConnector::EventData::ExtraDataSize + 128];
+};
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 NetService::NetService()
 {
-	mysInstance = this;
-	myClient = new omicronConnector::OmicronConnectorClient(this);
+	myUpstreams.push_back(new NetUpstream(this, 0));
+	sequence = true;
+	reliable = true;
+	sharedMemory = false;
+	compact = false;
+	timeSync = true;
+	predictionLead = 0;
+	relay = false;
+	myLastStatsTime = 0;
+	myMerge = false;
+	myReorderWindow = 5000;
+	myLastMergedTime = 0;
+	myLateEvents = 0;
+	myRemapServiceIds = false;
+	myNextServiceId = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+NetService::~NetService()
+{
+	foreach(NetUpstream* upstream, myUpstreams) delete upstream;
+	myUpstreams.clear();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void NetService::setup(Setting& settings)
 {
-	serverAddress = Config::getStringValue("serverIP", settings, "localhost");
-	serverPort = Config::getIntValue("msgPort", settings, 27000); 
-	dataPort = Config::getIntValue("dataPort", settings, 7000); 
+	NetUpstream* first = myUpstreams[0];
+	first->serverAddress = Config::getStringValue("serverIP", settings, "localhost");
+	first->serverPort = Config::getIntValue("msgPort", settings, 27000); 
+	first->dataPort = Config::getIntValue("dataPort", settings, 7000); 
+	// Ask the server to number the data packets, to keep track of lost
+	// and reordered packets.
+	sequence = Config::getBoolValue("sequence", settings, true);
+	// Ask the server to retransmit lost discrete events (button presses, 
+	// pointer info and the like).
+	reliable = Config::getBoolValue("reliable", settings, true);
+	// Read events from the server shared memory when running on the server
+	// machine. The service is then polled instead of waiting on a socket.
+	sharedMemory = Config::getBoolValue("sharedMemory", settings, false);
+	// Ask the server for the compact encoding of continuous events 
+	// (quantized poses and skeletons, sent as deltas). Needs reliable.
+	compact = Config::getBoolValue("compact", settings, false);
+	// Estimate the server clock offset, so that event times can be 
+	// converted to local time (see getEventAge).
+	timeSync = Config::getBoolValue("timeSync", settings, true);
+	// Ask the server to extrapolate mocap and wand poses this many 
+	// milliseconds in the future, to compensate the rendering latency.
+	predictionLead = Config::getFloatValue("predictionLead", settings, 0);
+
+	// Subscription sent to the server, as handshake options (for instance
+	// 'services=0x2 sources=0-3', see omicronConnector::EventFilter).
+	String subscription = Config::getStringValue("subscription", settings, "");
+
+	// Additional upstream servers. Each one uses its own data port, and 
+	// inherits the subscription of the first server unless it has its own.
+	Vector<String> subscriptions;
+	subscriptions.push_back(subscription);
+	if(settings.exists("upstreams"))
+	{
+		Setting& sUpstreams = settings["upstreams"];
+		for(int i = 0; i < sUpstreams.getLength(); i++)
+		{
+			Setting& sUpstream = sUpstreams[i];
+			NetUpstream* upstream = new NetUpstream(this, (int)myUpstreams.size());
+			upstream->serverAddress = Config::getStringValue("serverIP", sUpstream, "localhost");
+			upstream->serverPort = Config::getIntValue("msgPort", sUpstream, 27000); 
+			upstream->dataPort = Config::getIntValue("dataPort", sUpstream, 7000 + upstream->index); 
+			subscriptions.push_back(Config::getStringValue("subscription", sUpstream, subscription));
+			myUpstreams.push_back(upstream);
+		}
+	}
+
+	foreach(NetUpstream* upstream, myUpstreams)
+	{
+		Vector<String> options = StringUtils::split(subscriptions[upstream->index], " ");
+		foreach(const String& option, options)
+		{
+			if(!option.empty() && !upstream->client->getEventFilter().parseOption(option.c_str()))
+			{
+				ofwarn("NetService: unknown subscription option '%1%'", %option);
+			}
+		}
+	}
+
+	// Events from multiple upstreams are merged by creation time. Events 
+	// are delayed by up to reorderWindow milliseconds, waiting for older 
+	// events from other upstreams. Late events are delivered anyway, out 
+	// of order. With a 0 window, events are delivered as they arrive.
+	myReorderWindow = (int)(Config::getFloatValue("reorderWindow", settings, 5) * 1000);
+	myMerge = myUpstreams.size() > 1 && myReorderWindow > 0;
+
+	// Give events a service id unique to their upstream and original 
+	// service (see getUpstreamServiceId). When disabled, all events get 
+	// the NetService id.
+	myRemapServiceIds = Config::getBoolValue("remapServiceIds", settings, myUpstreams.size() > 1);
+
+	// Relay mode: forward the events to the clients of this process input
+	// server (see setRelayServer). Relayed events are never re-encoded, so
+	// the standard encoding is used, and poses are not predicted. Relayed 
+	// events are not merged.
+	relay = Config::getBoolValue("relay", settings, false);
+	if(relay)
+	{
+		compact = false;
+		predictionLead = 0;
+		myMerge = false;
+		setPollThreaded(false);
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void NetService::initialize() 
 {
-	myClient->connect(serverAddress.c_str(), serverPort, dataPort);
+	foreach(NetUpstream* upstream, myUpstreams)
+	{
+		omicronConnector::OmicronConnectorClient* client = upstream->client;
+		client->setSequenceMode(sequence);
+		client->setReliableMode(reliable);
+		client->setSharedMemoryMode(sharedMemory);
+		client->setCompactMode(compact);
+		client->setTimeSyncMode(timeSync);
+		client->setPredictionLead(predictionLead);
+		client->connect(upstream->serverAddress.c_str(), upstream->serverPort, upstream->dataPort);
+		// Let the service manager wake up when event data comes in. When 
+		// merging, the service must also be polled when the reorder window
+		// of queued events expires, so it does not wait on its sockets.
+		if(!myMerge) addWaitSocket((int)client->getDataSocket());
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void NetService::poll()
 {
-	myClient->poll();
+	foreach(NetUpstream* upstream, myUpstreams) upstream->client->poll();
+
+	if(myMerge) mergeEvents(otimestamp() - myReorderWindow);
+
+	// Print packet statistics every 5 seconds in debug mode.
+	if(sequence && isDebugEnabled())
+	{
+		uint64 now = otimestamp();
+		if(now - myLastStatsTime > 5000000)
+		{
+			foreach(NetUpstream* upstream, myUpstreams)
+			{
+				omicronConnector::OmicronConnectorClient* client = upstream->client;
+				const omicronConnector::PacketStats& stats = client->getPacketStats();
+				ofmsg("NetService: %1%: received %2% lost %3% reordered %4% duplicated %5% recovered %6% abandoned %7%",
+					%upstream->serverAddress
+					%stats.received %stats.lost %stats.reordered %stats.duplicated %stats.recovered %stats.abandoned);
+				if(client->isTimeSynchronized())
+				{
+					ofmsg("NetService: %1%: clock offset %2%us drift %3%us/s round trip %4%us",
+						%upstream->serverAddress
+						%client->getClockOffset(omicronConnector::OmicronConnectorClient::getTime())
+						%client->getClockDrift() %client->getRoundTripTime());
+				}
+			}
+			if(myMerge) ofmsg("NetService: late events %1%", %myLateEvents);
+			myLastStatsTime = now;
+		}
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void NetService::dispose() 
 {
-	myClient->dispose();
+	foreach(NetUpstream* upstream, myUpstreams)
+	{
+		if(!myMerge) removeWaitSocket((int)upstream->client->getDataSocket());
+		upstream->client->dispose();
+		upstream->queue.clear();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void NetService::onUpstreamEvent(NetUpstream* upstream, const omicronConnector::EventData& ed)
+{
+	// NOTE: unless service ids are remapped, the original event service id is substituted by 
+	// NetService own service id. This is made because in the local context, original service 
+	// ids have no meaning, so all events are marked as being originated from NetService.
+	int serviceId = myRemapServiceIds ? remapServiceId(upstream, ed.serviceId) : getServiceId();
+
+	if(!myMerge)
+	{
+		// Use the server creation time, converted to the local clock, instead
+		// of the receive time.
+		long long age = upstream->client->getEventAge(ed);
+		writeEvent(ed, serviceId, age > 0 ? otimestamp() - age : 0);
+		return;
+	}
+
+	// Queue the event, sorted by creation time. Events from the same upstream
+	// are usually in order, so look for the insertion point from the back.
+	std::deque<NetUpstream::QueuedEvent>& queue = upstream->queue;
+	if(queue.size() >= NetUpstream::MaxQueuedEvents) mergeEvents(queue.front().time);
+
+	uint64 time = upstream->getLocalTime(ed);
+	std::deque<NetUpstream::QueuedEvent>::iterator it = queue.end();
+	while(it != queue.begin() && (it - 1)->time > time) --it;
+	it = queue.insert(it, NetUpstream::QueuedEvent());
+	it->time = time;
+	it->data = ed;
+	it->data.serviceId = serviceId;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void NetService::mergeEvents(uint64 horizon)
+{
+	while(true)
+	{
+		// Find the oldest queued event.
+		NetUpstream* oldest = NULL;
+		foreach(NetUpstream* upstream, myUpstreams)
+		{
+			if(!upstream->queue.empty() && 
+				(oldest == NULL || upstream->queue.front().time < oldest->queue.front().time))
+			{
+				oldest = upstream;
+			}
+		}
+		if(oldest == NULL || oldest->queue.front().time > horizon) return;
+
+		NetUpstream::QueuedEvent& qe = oldest->queue.front();
+		// Events older than the last delivered one arrived after the reorder
+		// window expired.
+		if(qe.time < myLastMergedTime) myLateEvents++;
+		else myLastMergedTime = qe.time;
+
+		writeEvent(qe.data, qe.data.serviceId, qe.time);
+		commitEvent();
+		oldest->queue.pop_front();
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void NetService::onEvent(const omicronConnector::EventData& ed)
+void NetService::writeEvent(const omicronConnector::EventData& ed, int serviceId, uint64 time)
 {
-	Event* evt = mysInstance->writeHead();
-	// NOTE: original event service id is substituted by NetService own service id.
-	// This is made because in the local context, original service ids have no meaning, so all events are marked
-	// as being originated from NetService.
-	evt->reset((Event::Type)ed.type, (Service::ServiceType)ed.serviceType, ed.sourceId, mysInstance->getServiceId());
+	Event* evt = writeHead();
+	evt->reset((Event::Type)ed.type, (Service::ServiceType)ed.serviceType, ed.sourceId, serviceId);
 	evt->setPosition(ed.posx, ed.posy, ed.posz);
 	evt->setOrientation(ed.orw, ed.orx, ed.ory, ed.orz);
 	evt->setFlags(ed.flags);
 	evt->setExtraData((Event::ExtraDataType)ed.extraDataType, ed.extraDataItems, ed.extraDataMask, (void*)ed.extraData);
+	if(time != 0) evt->setTime(time);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int NetService::remapServiceId(NetUpstream* upstream, int serviceId)
+{
+	uint64 key = ((uint64)upstream->index << 32) | (uint)serviceId;
+	Dictionary<uint64, int>::iterator it = myServiceIds.find(key);
+	if(it != myServiceIds.end()) return it->second;
+
+	// Remapped ids start above the ids used by local services, in a range
+	// reserved to this service.
+	int id = ((getServiceId() + 1) << 16) + myNextServiceId++;
+	myServiceIds[key] = id;
+	return id;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool NetService::getUpstreamServiceId(int serviceId, int* upstream, int* originalServiceId)
+{
+	typedef Dictionary<uint64, int>::value_type Item;
+	foreach(const Item& item, myServiceIds)
+	{
+		if(item.second == serviceId)
+		{
+			if(upstream != NULL) *upstream = (int)(item.first >> 32);
+			if(originalServiceId != NULL) *originalServiceId = (int)(uint)item.first;
+			return true;
+		}
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool NetService::onUpstreamPacket(NetUpstream* upstream, const char* packet, int size)
+{
+	if(!relay || mysRelayServer == NULL) return false;
+
+	if(myRemapServiceIds && size <= (int)sizeof(upstream->relayBuffer))
+	{
+		int serviceId = omicronConnector::EventLayout::ServiceId::read(packet);
+		memcpy(upstream->relayBuffer, packet, size);
+		omicronConnector::EventLayout::ServiceId::write(upstream->relayBuffer, 
+			remapServiceId(upstream, serviceId));
+		packet = upstream->relayBuffer;
+	}
+
+	// Offset between the server clock and otimestamp.
+	omicronConnector::OmicronConnectorClient* client = upstream->client;
+	if(client->isTimeSynchronized())
+	{
+		unsigned long long now = omicronConnector::OmicronConnectorClient::getTime();
+		long long offset = client->getClockOffset(now) + (long long)(now - otimestamp());
+		mysRelayServer->relayEvent(packet, size, true, offset);
+	}
+	else
+	{
+		mysRelayServer->relayEvent(packet, size);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const omicronConnector::PacketStats& NetService::getPacketStats(int upstream)
+{
+	return myUpstreams[upstream]->client->getPacketStats();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void NetService::setServer(const String& address, int port) 
 {
-	serverAddress = address;
-	serverPort = port;
+	myUpstreams[0]->serverAddress = address;
+	myUpstreams[0]->serverPort = port;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void NetService::setDataport(int port) 
 {
 	printf("Dataport set to '%s'\n", port);
-	dataPort = port;
+	myUpstreams[0]->dataPort = port;
 }
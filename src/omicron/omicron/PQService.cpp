@@ -38,6 +38,9 @@ bool PQService::useGestureManager = false;
 bool PQService::showStreamSpeed = false;
 int PQService::lastIncomingEventTime = 0;
 int PQService::eventCount = 0;
+uint64 PQService::frameTime = 0;
+long long PQService::frameTimeOffset = 0;
+bool PQService::hasFrameTimeOffset = false;
 Vector2i PQService::serverResolution = Vector2i(1920,1080);
 Vector2i PQService::screenOffset = Vector2i(0,0);
 Vector2i PQService::rawDataResolution = Vector2i(1920,1080);
@@ -215,6 +218,18 @@ void PQService::OnReceivePointFrame(int frame_id, int time_stamp, int moving_poi
 	pqService = mysInstance;
 
 	assert(pqService != NULL);
+
+	// time_stamp is a millisecond counter with an arbitrary origin. Map it to
+	// the local timestamp clock, using the smallest offset seen so far 
+	// (the one with the lowest transmission delay).
+	uint64 now = otimestamp();
+	long long offset = (long long)now - (long long)time_stamp * 1000;
+	if(!hasFrameTimeOffset || offset < frameTimeOffset)
+	{
+		frameTimeOffset = offset;
+		hasFrameTimeOffset = true;
+	}
+	frameTime = (uint64)((long long)time_stamp * 1000 + frameTimeOffset);
 	const char * tp_event[] = 
 	{
 		"down",
@@ -363,6 +378,7 @@ void PQService::OnTouchPoint(const TouchPoint & tp)
 			}
 
 			evt->setPosition(touch.xPos, touch.yPos);
+			evt->setDeviceTime(frameTime);
 
 			evt->setExtraDataType(Event::ExtraDataFloatArray);
 			evt->setExtraDataFloat(0, touch.xWidth);
@@ -37,6 +37,7 @@
 #include "omicron/Service.h"
 #include "omicron/ServiceManager.h"
 #include "omicron/StringUtils.h"
+#include "omicron/Config.h"
 
 using namespace omicron;
 
@@ -61,6 +62,10 @@ void Service::doSetup(ServiceManager* mng, Setting& settings)
 		myDebug = (bool)settings["debug"];
 	}
 
+	// Polling options
+	myPollRate = Config::getFloatValue("pollRate", settings, myPollRate);
+	myPollThreaded = Config::getBoolValue("pollThread", settings, myPollThreaded);
+
 	// call service specific setup method
 	setup(settings);
 }
@@ -102,19 +107,55 @@ Event* Service::writeHead()
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-Event* Service::readHead()
+void Service::commitEvent()
 { 
-	return myManager->readHead();
+	myManager->commitEvent();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-Event* Service::readTail()
-{ 
-	return myManager->readTail(); 
+void Service::addWaitSocket(int socket)
+{
+	myManager->addWaitSocket(socket, this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Service::removeWaitSocket(int socket)
+{
+	myManager->removeWaitSocket(socket);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+EventCursor* Service::getEventCursor()
+{
+	if(myEventCursor == NULL)
+	{
+		// Services with PollLast priority are event filters: they read
+		// events before other consumers.
+		myEventCursor = myManager->createEventCursor(myName, myPriority == PollLast);
+	}
+	return myEventCursor;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int Service::getAvailableEvents()
+{
+	return getEventCursor()->getAvailableEvents();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 Event* Service::getEvent(int index)
 {
-	return myManager->getEvent(index);
+	return getEventCursor()->getEvent(index);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Service::clearEvents()
+{
+	getEventCursor()->clearEvents();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Event* Service::readTail()
+{ 
+	return getEventCursor()->readTail(); 
 }
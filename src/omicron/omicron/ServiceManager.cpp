@@ -86,30 +86,130 @@
 #ifdef OMICRON_USE_THINKGEAR
 	#include "omicron/ThinkGearService.h"
 #endif
+
+// Event waiting support
+#if defined(OMICRON_OS_LINUX)
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+#elif !defined(OMICRON_OS_WIN)
+	#include <sys/select.h>
+	#include <unistd.h>
+	#include <fcntl.h>
+#endif
+
 using namespace omicron;
 using namespace std;
 
+// Thread local storage qualifier, used to keep track of the event reserved by 
+// each writer thread.
+#ifdef _MSC_VER
+	#define OMICRON_THREAD_LOCAL __declspec(thread)
+#else
+	#define OMICRON_THREAD_LOCAL __thread
+#endif
+
 // The maximum number of events stored in the event buffer.
 const int ServiceManager::MaxEvents = OMICRON_MAX_EVENTS;
 
+// The event ring index mask: MaxEvents needs to be a power of two.
+#define EVENT_RING_MASK (OMICRON_MAX_EVENTS - 1)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The event slot reserved by writeHead on the current thread and not committed yet.
+struct PendingEvent
+{
+	volatile uint* sequence;
+	uint value;
+};
+static OMICRON_THREAD_LOCAL PendingEvent sPendingEvent = { NULL, 0 };
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The scratch event returned by writeHead on the current thread when the ring is full, and the
+// id of the manager owning it.
+struct ScratchEvent
+{
+	uint manager;
+	Event* event;
+};
+static OMICRON_THREAD_LOCAL ScratchEvent sScratchEvent = { 0, NULL };
+static volatile uint sServiceManagerCounter = 0;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Polls a service on a dedicated thread.
+class omicron::ServicePollThread: public Thread
+{
+public:
+	ServicePollThread(ServiceManager* mng, Service* svc): 
+		myManager(mng), myService(svc), myRunning(false) {}
+
+	void startPolling()
+	{
+		myRunning = true;
+		start();
+	}
+
+	void stopPolling()
+	{
+		myRunning = false;
+		stop();
+	}
+
+	virtual void threadProc()
+	{
+		while(myRunning)
+		{
+			uint64 startTime = otimestamp();
+			myService->poll();
+			myManager->commitEvent();
+
+			// Wait for the next poll. If no poll rate has been specified, 
+			// poll about 1000 times per second.
+			float rate = myService->getPollRate();
+			uint64 interval = rate > 0 ? (uint64)(1000000.0f / rate) : 1000;
+			uint64 elapsed = otimestamp() - startTime;
+			if(elapsed < interval)
+			{
+				osleep((uint)((interval - elapsed + 999) / 1000));
+			}
+		}
+	}
+
+private:
+	ServiceManager* myManager;
+	Service* myService;
+	volatile bool myRunning;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ServiceManager::ServiceManager():
 	myInitialized(false),
-	myEventBuffer(NULL),
-	myEventBufferHead(0),
-	myEventBufferTail(0),
-	myAvailableEvents(0),
+	myServiceIdCounter(0),
+	myEventRing(NULL),
+	myExtraDataArena(NULL),
+	myWriteSequence(0),
+	myGatingSequence(0),
+	myId(oatomicadd(&sServiceManagerCounter, 1)),
+	myDefaultCursor(NULL),
+	myPublishEnabled(false),
+	myPublishedSequence(0),
 	myDroppedEvents(0),
-	myServiceIdCounter(0)
+	myCommitCount(0),
+	myWaiting(0),
+	myWaitCommitCount(0),
+	myWaitHandle(-1),
+	myWakeHandle(-1),
+	myWakeWriteHandle(-1)
 {
-	myEventBufferLock = new Lock();
+	oassert((MaxEvents & EVENT_RING_MASK) == 0);
 	registerDefaultServices();
+	initializeWait();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ServiceManager::~ServiceManager()
 {
-	delete myEventBufferLock;
+	disposeWait();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -225,7 +325,15 @@ void ServiceManager::initialize()
 {
 	omsg("ServiceManager::initialize");
 
-	myEventBuffer = new Event[MaxEvents];
+	// Each ring slot gets a block from the extra data arena, used by events
+	// whose extra data does not fit in the event itself.
+	myEventRing = new EventSlot[MaxEvents];
+	myExtraDataArena = new char[MaxEvents * Event::ExtraDataSize];
+	for(int i = 0; i < MaxEvents; i++) 
+	{
+		myEventRing[i].sequence = i;
+		myEventRing[i].event.setExtraDataBlock(&myExtraDataArena[i * Event::ExtraDataSize]);
+	}
 	ofmsg("Event buffer allocated. Max events: %1%", %MaxEvents);
 
 	foreach(Service* it, myServices)
@@ -243,11 +351,32 @@ void ServiceManager::dispose()
 	foreach(Service* it, myServices)
 	{
 		it->dispose();
+		it->myEventCursor = NULL;
 	}
 
 	myServices.clear();
 
-	delete[] myEventBuffer;
+#ifdef OMICRON_OS_LINUX
+	typedef Dictionary<int, Service*>::value_type WaitSocketItem;
+	foreach(WaitSocketItem item, myWaitSockets)
+	{
+		epoll_ctl(myWaitHandle, EPOLL_CTL_DEL, item.first, NULL);
+	}
+#endif
+	myWaitSockets.clear();
+
+	foreach(EventCursor* cursor, myCursors) delete cursor;
+	myCursors.clear();
+	myDefaultCursor = NULL;
+
+	delete[] myEventRing;
+	delete[] myExtraDataArena;
+	foreach(Event* evt, myScratchEvents) delete evt;
+	myEventRing = NULL;
+	myExtraDataArena = NULL;
+	myScratchEvents.clear();
+	// Scratch events of this manager are not valid anymore.
+	myId = oatomicadd(&sServiceManagerCounter, 1);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -257,13 +386,60 @@ void ServiceManager::start()
 	{
 		it->start();
 	}
+
+	// Filter services get their cursors now, before publishing is enabled: 
+	// events written before a filter cursor exists would skip that filter.
+	foreach(Service* it, myServices)
+	{
+		if(it->getPollPriority() == Service::PollLast) it->getEventCursor();
+	}
+
+	// Start worker threads for threaded services.
+	foreach(Service* it, myServices)
+	{
+		if(it->isPollThreaded() && it->myPollThread == NULL)
+		{
+			if(it->getPollPriority() == Service::PollLast)
+			{
+				// Filter services need to run in order, after all the other
+				// services: they can't be polled on their own thread.
+				ofwarn("ServiceManager::start: %1% is an event filter and can't be polled on a separate thread", 
+					%it->getName());
+				it->setPollThreaded(false);
+				continue;
+			}
+			ofmsg("ServiceManager::start: polling %1% on a separate thread", %it->getName());
+			it->myPollThread = new ServicePollThread(this, it);
+			myPollThreads.push_back(it->myPollThread);
+
+			// From now on, events need to go through the filter stages 
+			// before being published to consumers.
+			if(!myPublishEnabled)
+			{
+				myPublishedSequence = myWriteSequence;
+				myPublishEnabled = true;
+			}
+			it->myPollThread->startPolling();
+		}
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void ServiceManager::stop()
 {
+	// Stop worker threads first, so services do not get polled after they
+	// have been stopped.
+	foreach(ServicePollThread* t, myPollThreads)
+	{
+		t->stopPolling();
+		delete t;
+	}
+	myPollThreads.clear();
+	myPublishEnabled = false;
+
 	foreach(Service* it, myServices)
 	{
+		it->myPollThread = NULL;
 		it->stop();
 	}
 }
@@ -271,13 +447,49 @@ void ServiceManager::stop()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void ServiceManager::poll()
 {
+	uint64 now = otimestamp();
 	for(int pollPriority = Service::PollFirst; pollPriority <= Service::PollLast; pollPriority++)
 	{
 		foreach(Service* svc, myServices)
 		{
-			if(svc->getPollPriority() == pollPriority) svc->poll();
+			// Threaded services are polled by their own thread.
+			if(svc->getPollPriority() == pollPriority && svc->myPollThread == NULL) 
+			{
+				// Respect the service poll rate, if specified.
+				if(svc->myPollRate > 0)
+				{
+					uint64 interval = (uint64)(1000000.0f / svc->myPollRate);
+					if(now - svc->myLastPollTime < interval) continue;
+					svc->myLastPollTime = now;
+				}
+
+				svc->poll();
+				// Make sure the last event written by the service is visible
+				// to the following services.
+				commitEvent();
+			}
 		}
 	}
+
+	if(myPublishEnabled) publishFilteredEvents();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ServiceManager::publishFilteredEvents()
+{
+	// Events read by all the filter cursors have gone through all the filter
+	// stages: make them visible to the other consumers.
+	uint published = oatomicload(&myWriteSequence);
+	myCursorLock.lock();
+	foreach(EventCursor* cursor, myCursors)
+	{
+		if(cursor->myFilter && (int)(cursor->myReadSequence - published) < 0)
+		{
+			published = cursor->myReadSequence;
+		}
+	}
+	myCursorLock.unlock();
+	oatomicstore(&myPublishedSequence, published);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -319,118 +531,469 @@ Service* ServiceManager::addService(const String& svcClass)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int ServiceManager::incrementBufferIndex(int index)
+EventCursor* ServiceManager::createEventCursor(const String& name, bool filter)
 {
-	index++;
-	if(index == ServiceManager::MaxEvents) index = 0;
-	return index;
+	myCursorLock.lock();
+	// New cursors start at the gating sequence: events before it may have 
+	// been overwritten already, events after it are guaranteed to be kept
+	// until the new cursor reads them.
+	updateGatingSequence(myWriteSequence);
+	EventCursor* cursor = new EventCursor(this, name, myGatingSequence, filter);
+	myCursors.push_back(cursor);
+	myCursorLock.unlock();
+	return cursor;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int ServiceManager::decrementBufferIndex(int index)
+void ServiceManager::destroyEventCursor(EventCursor* cursor)
 {
-	if(index == 0) index = ServiceManager::MaxEvents;
-	index--;
-	return index;
+	myCursorLock.lock();
+	myCursors.remove(cursor);
+	if(cursor == myDefaultCursor) myDefaultCursor = NULL;
+	myCursorLock.unlock();
+	delete cursor;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int ServiceManager::getEvents(Event* ptr, int maxEvents)
+EventCursor* ServiceManager::getDefaultEventCursor()
 {
-	int returnedEvents = 0;
-	Event* evt;
-	
-	lockEvents();
-	do
+	if(myDefaultCursor == NULL)
+	{
+		myDefaultCursor = createEventCursor("default");
+	}
+	return myDefaultCursor;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ServiceManager::updateGatingSequence(uint writeSequence)
+{
+	// NOTE: must be called with the cursor lock held.
+	// When no cursors are registered, keep the current gating sequence: the
+	// ring fills up and keeps the oldest events for the first new cursor.
+	if(!myCursors.empty())
 	{
-		evt = readTail();
-		if(evt)	
+		uint minSequence = writeSequence;
+		foreach(EventCursor* cursor, myCursors)
 		{
-			memcpy(&ptr[returnedEvents], evt, sizeof(Event));
-			returnedEvents++;
+			uint seq = oatomicload(&cursor->myReleaseSequence);
+			if((int)(seq - minSequence) < 0) minSequence = seq;
 		}
-	} while(evt && returnedEvents < maxEvents);
-	unlockEvents();
-
-	// This is a sort of HACK but it is needed to solve several issues with oinput server and
-	// the circular buffer not being implemented correctly. Basically, a getEvents call resets 
-	// the event buffer, regardless of how many events have been read. A better fix would require 
-	// a deeper rewrite of several ServiceManager methods (namely, getting rid of the circular 
-	// buffer machinery and just using a simple poll-read system with dropping of events that 
-	// can't be queued.
-	clearEvents();
-
-	return returnedEvents;
+		oatomicstore(&myGatingSequence, minSequence);
+	}
+	return (int)(writeSequence - myGatingSequence) < MaxEvents;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void ServiceManager::lockEvents()
+int ServiceManager::getAvailableEvents()
 {
-	myEventBufferLock->lock();
+	return getDefaultEventCursor()->getAvailableEvents();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void ServiceManager::unlockEvents()
+int ServiceManager::getEvents(Event* ptr, int maxEvents)
 {
-	myEventBufferLock->unlock();
+	return getDefaultEventCursor()->getEvents(ptr, maxEvents);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 Event* ServiceManager::getEvent(int index)
 {
-	oassert(index >= 0 && index < myAvailableEvents);
-	return &myEventBuffer[index];
+	return getDefaultEventCursor()->getEvent(index);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void ServiceManager::clearEvents()
 {
-	myAvailableEvents = 0;
-	myEventBufferHead = 0;
-	myEventBufferTail = 0;
+	getDefaultEventCursor()->clearEvents();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Event* ServiceManager::readTail()
+{
+	return getDefaultEventCursor()->readTail();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 Event* ServiceManager::writeHead()
 {
-	Event* evt = &myEventBuffer[myEventBufferHead];
-	myEventBufferHead = incrementBufferIndex(myEventBufferHead);
+	// Commit the previous event written by this thread, if any.
+	commitEvent();
 
-	// This is not totally exact, we would need an event more to actually start dropping..
-	if(myAvailableEvents == MaxEvents)
+	uint pos = oatomicload(&myWriteSequence);
+	while(true)
 	{
-		myDroppedEvents++;
+		if((int)(pos - oatomicload(&myGatingSequence)) >= MaxEvents)
+		{
+			// The ring looks full: refresh the gating sequence from the 
+			// cursor positions.
+			myCursorLock.lock();
+			if(!updateGatingSequence(pos))
+			{
+				// The ring is full: drop the event and charge it to the 
+				// cursors holding the writers back.
+				foreach(EventCursor* cursor, myCursors)
+				{
+					if(oatomicload(&cursor->myReleaseSequence) == myGatingSequence)
+					{
+						oatomicadd(&cursor->myOverruns, 1);
+					}
+				}
+				// Each writer thread gets its own scratch event, so that 
+				// concurrent writers never share it.
+				if(sScratchEvent.manager != myId || sScratchEvent.event == NULL)
+				{
+					sScratchEvent.manager = myId;
+					sScratchEvent.event = new Event();
+					myScratchEvents.push_back(sScratchEvent.event);
+				}
+				myCursorLock.unlock();
+				oatomicadd(&myDroppedEvents, 1);
+				return sScratchEvent.event;
+			}
+			myCursorLock.unlock();
+		}
+		// Try to claim the slot.
+		if(oatomiccas(&myWriteSequence, pos, pos + 1))
+		{
+			EventSlot& slot = myEventRing[pos & EVENT_RING_MASK];
+			sPendingEvent.sequence = &slot.sequence;
+			sPendingEvent.value = pos + 1;
+			return &slot.event;
+		}
+		// Another writer claimed this slot: retry with the current position.
+		pos = oatomicload(&myWriteSequence);
 	}
-	else
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ServiceManager::commitEvent()
+{
+	if(sPendingEvent.sequence != NULL)
+	{
+		oatomicstore(sPendingEvent.sequence, sPendingEvent.value);
+		sPendingEvent.sequence = NULL;
+
+		// oatomicadd is a full barrier: the waiting flag is read after the
+		// commit counter is incremented (see waitForEvents). Only the first
+		// writer that sees the flag signals the waiting thread.
+		oatomicadd(&myCommitCount, 1);
+		if(oatomicload(&myWaiting) && oatomiccas(&myWaiting, 1, 0))
+		{
+			wakeUp();
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ServiceManager::initializeWait()
+{
+#if defined(OMICRON_OS_LINUX)
+	myWakeHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	myWakeWriteHandle = myWakeHandle;
+	myWaitHandle = epoll_create(16);
+	if(myWakeHandle == -1 || myWaitHandle == -1)
+	{
+		owarn("ServiceManager::initializeWait: could not create wait handles, waitForEvents will poll");
+		disposeWait();
+		return;
+	}
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = myWakeHandle;
+	epoll_ctl(myWaitHandle, EPOLL_CTL_ADD, myWakeHandle, &ev);
+#elif !defined(OMICRON_OS_WIN)
+	int fds[2];
+	if(pipe(fds) != 0)
+	{
+		owarn("ServiceManager::initializeWait: could not create wait handles, waitForEvents will poll");
+		return;
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	myWakeHandle = fds[0];
+	myWakeWriteHandle = fds[1];
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ServiceManager::disposeWait()
+{
+#ifndef OMICRON_OS_WIN
+	if(myWaitHandle != -1) close(myWaitHandle);
+	if(myWakeHandle != -1) close(myWakeHandle);
+	if(myWakeWriteHandle != -1 && myWakeWriteHandle != myWakeHandle) close(myWakeWriteHandle);
+#endif
+	myWaitHandle = -1;
+	myWakeHandle = -1;
+	myWakeWriteHandle = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ServiceManager::addWaitSocket(int socket, Service* svc)
+{
+	if(socket < 0 || myWaitSockets.find(socket) != myWaitSockets.end()) return;
+
+	myWaitSockets[socket] = svc;
+	if(svc != NULL) svc->myWaitSockets++;
+
+#ifdef OMICRON_OS_LINUX
+	if(myWaitHandle != -1)
 	{
-		myAvailableEvents++;
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = socket;
+		if(epoll_ctl(myWaitHandle, EPOLL_CTL_ADD, socket, &ev) != 0)
+		{
+			ofwarn("ServiceManager::addWaitSocket: could not register socket %1%", %socket);
+		}
 	}
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ServiceManager::removeWaitSocket(int socket)
+{
+	Dictionary<int, Service*>::iterator it = myWaitSockets.find(socket);
+	if(it == myWaitSockets.end()) return;
+
+	if(it->second != NULL) it->second->myWaitSockets--;
+	myWaitSockets.erase(it);
 
-	return evt;
+#ifdef OMICRON_OS_LINUX
+	// NOTE: this fails harmlessly if the socket has been closed already.
+	if(myWaitHandle != -1) epoll_ctl(myWaitHandle, EPOLL_CTL_DEL, socket, NULL);
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-Event* ServiceManager::readHead()
+void ServiceManager::wakeUp()
 {
-	if(myAvailableEvents > 0)
+#if defined(OMICRON_OS_LINUX)
+	if(myWakeHandle != -1)
 	{
-		Event* evt = &myEventBuffer[myEventBufferHead];
-		myEventBufferHead = decrementBufferIndex(myEventBufferHead);
-		myAvailableEvents--;
-		return evt;
+		uint64 val = 1;
+		if(write(myWakeHandle, &val, sizeof(val)) < 0) { /* already signalled */ }
 	}
-	return NULL;
+#elif !defined(OMICRON_OS_WIN)
+	if(myWakeWriteHandle != -1)
+	{
+		char val = 1;
+		if(write(myWakeWriteHandle, &val, 1) < 0) { /* pipe full: already signalled */ }
+	}
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-Event* ServiceManager::readTail()
+int ServiceManager::getWaitTimeout(int timeoutMs)
+{
+	// Returns the wait timeout in microseconds, or -1 to wait indefinitely.
+	int timeout = -1;
+	if(timeoutMs >= 0) timeout = timeoutMs < 1000000 ? timeoutMs * 1000 : 1000000000;
+
+	// Wake up in time for the next poll of services that can't notify us
+	// when they have new data. Threaded services commit events on their own,
+	// event filters only need to run when new events come in.
+	uint64 now = otimestamp();
+	foreach(Service* svc, myServices)
+	{
+		if(svc->myPollThread != NULL || svc->myWaitSockets > 0 ||
+			svc->getPollPriority() == Service::PollLast) continue;
+
+		// Services without a poll rate get polled every millisecond, like
+		// the old input server loop did.
+		int due = 1000;
+		if(svc->myPollRate > 0)
+		{
+			uint64 interval = (uint64)(1000000.0f / svc->myPollRate);
+			uint64 elapsed = now - svc->myLastPollTime;
+			due = elapsed < interval ? (int)(interval - elapsed) : 0;
+		}
+		if(timeout < 0 || due < timeout) timeout = due;
+	}
+	return timeout;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ServiceManager::waitForEvents(int timeoutMs)
 {
-	if(myAvailableEvents > 0)
+	// Tell writers we are about to wait, then check for events committed 
+	// since the last wait. Writers increment the commit counter before 
+	// reading the waiting flag: either we see their commit here, or they see
+	// the flag and signal the wake handle.
+	oatomicstore(&myWaiting, 1);
+	oatomicfence();
+	uint commitCount = oatomicload(&myCommitCount);
+	if(commitCount != myWaitCommitCount)
 	{
-		Event* evt = &myEventBuffer[myEventBufferTail];
-		myEventBufferTail = incrementBufferIndex(myEventBufferTail);
-		myAvailableEvents--;
-		return evt;
+		oatomicstore(&myWaiting, 0);
+		myWaitCommitCount = commitCount;
+		return true;
+	}
+
+	int timeout = getWaitTimeout(timeoutMs);
+	bool ready = false;
+	if(timeout != 0)
+	{
+#if defined(OMICRON_OS_LINUX)
+		if(myWaitHandle != -1)
+		{
+			// epoll timeouts have millisecond resolution: round up.
+			epoll_event events[16];
+			int n = epoll_wait(myWaitHandle, events, 16, timeout < 0 ? -1 : (timeout + 999) / 1000);
+			for(int i = 0; i < n; i++)
+			{
+				if(events[i].data.fd == myWakeHandle)
+				{
+					uint64 val;
+					if(read(myWakeHandle, &val, sizeof(val)) < 0) { /* not signalled */ }
+				}
+			}
+			ready = n > 0;
+		}
+#elif !defined(OMICRON_OS_WIN)
+		if(myWakeHandle != -1)
+		{
+			fd_set readFds;
+			FD_ZERO(&readFds);
+			FD_SET(myWakeHandle, &readFds);
+			int maxFd = myWakeHandle;
+			typedef Dictionary<int, Service*>::value_type WaitSocketItem;
+			foreach(WaitSocketItem item, myWaitSockets)
+			{
+				if(item.first >= FD_SETSIZE) continue;
+				FD_SET(item.first, &readFds);
+				if(item.first > maxFd) maxFd = item.first;
+			}
+			timeval tv;
+			tv.tv_sec = timeout / 1000000;
+			tv.tv_usec = timeout % 1000000;
+			int n = select(maxFd + 1, &readFds, NULL, NULL, timeout < 0 ? NULL : &tv);
+			if(n > 0 && FD_ISSET(myWakeHandle, &readFds))
+			{
+				char buf[64];
+				while(read(myWakeHandle, buf, sizeof(buf)) > 0);
+			}
+			ready = n > 0;
+		}
+#endif
+		// No wait handles: sleep for a short time, the caller will poll again.
+		if(myWakeHandle == -1) osleep(1);
+	}
+	oatomicstore(&myWaiting, 0);
+
+	commitCount = oatomicload(&myCommitCount);
+	if(commitCount != myWaitCommitCount)
+	{
+		myWaitCommitCount = commitCount;
+		ready = true;
+	}
+	return ready;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+EventCursor::EventCursor(ServiceManager* mng, const String& name, uint sequence, bool filter):
+	myManager(mng),
+	myName(name),
+	myFilter(filter),
+	myReadSequence(sequence),
+	myReleaseSequence(sequence),
+	myVisibleEvents(0),
+	myOverruns(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int EventCursor::getAvailableEvents()
+{
+	ServiceManager::EventSlot* ring = myManager->myEventRing;
+	if(ring == NULL) return 0;
+
+	// Count the committed events following the read position. Events are 
+	// committed out of order by different writers: stop at the first slot 
+	// that has been reserved but not committed yet.
+	int available = 0;
+	uint pos = myReadSequence;
+	while(available < ServiceManager::MaxEvents && isReadable(pos))
+	{
+		available++;
+		pos++;
+	}
+	myVisibleEvents = available;
+	return available;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Event* EventCursor::getEvent(int index)
+{
+	oassert(index >= 0 && index < ServiceManager::MaxEvents);
+	uint pos = myReadSequence + index;
+	ServiceManager::EventSlot& slot = myManager->myEventRing[pos & EVENT_RING_MASK];
+	oassert(slot.sequence == pos + 1);
+	return &slot.event;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void EventCursor::clearEvents()
+{
+	myReadSequence += myVisibleEvents;
+	myVisibleEvents = 0;
+	releaseReadEvents();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Event* EventCursor::readTail()
+{
+	ServiceManager::EventSlot* ring = myManager->myEventRing;
+	if(ring == NULL) return NULL;
+
+	releaseReadEvents();
+	ServiceManager::EventSlot& slot = ring[myReadSequence & EVENT_RING_MASK];
+	if(isReadable(myReadSequence))
+	{
+		myReadSequence++;
+		if(myVisibleEvents > 0) myVisibleEvents--;
+		return &slot.event;
 	}
 	return NULL;
 }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int EventCursor::getEvents(Event* ptr, int maxEvents)
+{
+	int returnedEvents = 0;
+	Event* evt;
+	while(returnedEvents < maxEvents && (evt = readTail()) != NULL)
+	{
+		ptr[returnedEvents].copyFrom(*evt);
+		returnedEvents++;
+	}
+	// The events have been copied: the ring slots can be reused right away.
+	releaseReadEvents();
+	return returnedEvents;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int EventCursor::getLag()
+{
+	return (int)(oatomicload(&myManager->myWriteSequence) - myReadSequence);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool EventCursor::isReadable(uint sequence)
+{
+	// Non-filter cursors can only read published events.
+	if(!myFilter && myManager->myPublishEnabled &&
+		(int)(oatomicload(&myManager->myPublishedSequence) - sequence) <= 0)
+	{
+		return false;
+	}
+	ServiceManager::EventSlot& slot = myManager->myEventRing[sequence & EVENT_RING_MASK];
+	return oatomicload(&slot.sequence) == sequence + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void EventCursor::releaseReadEvents()
+{
+	// Hand the slots we are done reading back to the writers.
+	oatomicstore(&myReleaseSequence, myReadSequence);
+}
@@ -174,6 +174,15 @@ void VRPNService::generateEvent(vrpn_TRACKERCB t, int id)
 		 evt->reset(Event::Update, Service::Mocap, id);
 		 evt->setPosition(t.pos[0], t.pos[1], t.pos[2]);
 
+		 // Convert the report time (wall clock time on the VRPN server) to the
+		 // local timestamp clock, using the report age. Without a usable age (i.e. clocks out
+		 // of sync) the capture time is unknown.
+		 timeval now;
+		 vrpn_gettimeofday(&now, NULL);
+		 long long age = (now.tv_sec - t.msg_time.tv_sec) * 1000000LL + (now.tv_usec - t.msg_time.tv_usec);
+		 if(age > 0 && (uint64)age < evt->getTime()) evt->setDeviceTime(evt->getTime() - age);
+		 else evt->setDeviceTime(0);
+
 		// //double euler[3];
 		// //q_to_euler(euler, t.quat);
 		 evt->setOrientation(t.quat[3], t.quat[0], t.quat[1], t.quat[2]);
@@ -67,8 +67,10 @@ void WandService::initialize()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void WandService::poll()
 {
-	lockEvents();
-	int numEvts = getManager()->getAvailableEvents();
+	// The wand service reads events through its own cursor, so it processes
+	// each event once. Since it is polled last, controller events are 
+	// remapped before the application reads them.
+	int numEvts = getAvailableEvents();
 	for(int i = 0; i < numEvts; i++)
 	{
 		Event* evt = getEvent(i);
@@ -111,7 +113,7 @@ void WandService::poll()
 		}
 	}
 
-	unlockEvents();
+	clearEvents();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -38,6 +38,12 @@
 #define Sleep(x) usleep((x)*1000)
 #endif
 
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include <time.h>
+
 namespace omicron
 {
 	//////////////////////////////////////////////////////////////////////////////////////////////////
@@ -259,4 +265,61 @@ namespace omicron
 		}
 #endif
 	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	uint64 otimestamp()
+	{
+#if defined(WIN32)
+		static LARGE_INTEGER sFrequency = { 0 };
+		if(sFrequency.QuadPart == 0) QueryPerformanceFrequency(&sFrequency);
+		LARGE_INTEGER count;
+		QueryPerformanceCounter(&count);
+		// Split the conversion to avoid overflowing with high counter frequencies.
+		uint64 secs = count.QuadPart / sFrequency.QuadPart;
+		uint64 rem = count.QuadPart % sFrequency.QuadPart;
+		return secs * 1000000 + rem * 1000000 / sFrequency.QuadPart;
+#elif defined(__APPLE__)
+		static mach_timebase_info_data_t sTimebase = { 0, 0 };
+		if(sTimebase.denom == 0) mach_timebase_info(&sTimebase);
+		uint64 ns = mach_absolute_time() * sTimebase.numer / sTimebase.denom;
+		return ns / 1000;
+#else
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	// Returns the wall clock time in milliseconds since the epoch.
+	static long long getWallClockMs()
+	{
+#if defined(WIN32)
+		FILETIME ft;
+		GetSystemTimeAsFileTime(&ft);
+		// 100ns intervals since 1601 to milliseconds since 1970.
+		unsigned long long t = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+		return (long long)((t - 116444736000000000ULL) / 10000);
+#else
+		timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+	}
+
+	// Offset between the timestamp clock and the wall clock, in milliseconds.
+	// Computed once when the library is loaded, before any thread can call
+	// otimestampms, so we do not have to query the wall clock for each event.
+	static const long long sLegacyOffset = getWallClockMs() - (long long)(otimestamp() / 1000);
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////
+	uint otimestampms(uint64 timestamp)
+	{
+		// The legacy timestamp wraps every 0xfffff seconds.
+		static const long long sLegacyPeriod = 0x100000LL * 1000;
+
+		long long ms = ((long long)(timestamp / 1000) + sLegacyOffset) % sLegacyPeriod;
+		if(ms < 0) ms += sLegacyPeriod;
+		return (uint)ms;
+	}
 }